@@ -0,0 +1,250 @@
+#ifndef __ASSETPACK_H_
+#define __ASSETPACK_H_
+
+// Pack of pre-decoded images.
+// Instead of decoding a PNG and converting it to the screen format when an
+// effect starts, the images are decoded and converted once, offline (the
+// demo's --pack out.dap image.png ...), into one file: a header, the pixels
+// of every image starting on a 64 byte boundary, and a table of contents at
+// the end. At runtime the file is mapped and every image becomes an
+// SDL_Surface over the mapped pixels, without decoding or copying them.
+// assetLoadImage() looks in ASSET_PACK_FILE first and falls back to the PNG
+// when the pack, or that image in that format, is missing. The pack stays
+// mapped until the process exits.
+
+#include <SDL.h>
+#include <SDL_image.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "memtrack.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define ASSET_PACK_FILE "assets.dap"
+#define ASSET_PACK_VERSION 1
+#define ASSET_PACK_ALIGN 64
+#define ASSET_PACK_NAME 48
+
+struct AssetPackHeader {
+	char magic[4];          // "DAP1"
+	uint32_t version;
+	uint32_t count;
+	uint32_t pad;
+	uint64_t toc;           // offset of the count entries
+};
+
+struct AssetPackEntry {
+	char name[ASSET_PACK_NAME];     // file name without the directory
+	uint32_t format;                // SDL_PIXELFORMAT_*
+	int32_t width, height, pitch;
+	uint64_t offset;                // of the pixels, a multiple of ASSET_PACK_ALIGN
+	uint64_t size;
+};
+
+struct AssetPack {
+	bool tried;             // opened once, even when there is no pack
+	unsigned char* data;
+	size_t size;
+	const AssetPackEntry* toc;
+	int count;
+	std::vector<unsigned char> copy;    // where there is no mmap
+};
+
+struct AssetPackStats {
+	int mapped, decoded;
+};
+
+AssetPack assetPack;
+AssetPackStats assetPackStats;
+
+inline const char* assetPackBaseName(const char* path)
+{
+	const char* name = path;
+	for (const char* p = path; *p; p++) {
+		if (*p == '/' || *p == '\\') name = p + 1;
+	}
+	return name;
+}
+
+/*
+* map a pack, false if it is missing or not a pack of this version. the
+* mapping is private and writable: the surfaces share the pages of the file
+* until something draws on them
+*/
+inline bool assetPackOpen(AssetPack& pack, const char* path)
+{
+#ifdef __linux__
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(AssetPackHeader)) {
+		close(fd);
+		return false;
+	}
+	void* p = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return false;
+	pack.data = (unsigned char*)p;
+	pack.size = (size_t)st.st_size;
+#else
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) return false;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size < (long)sizeof(AssetPackHeader)) {
+		fclose(f);
+		return false;
+	}
+	pack.copy.resize((size_t)size);
+	bool ok = fread(&pack.copy[0], 1, (size_t)size, f) == (size_t)size;
+	fclose(f);
+	if (!ok) return false;
+	pack.data = &pack.copy[0];
+	pack.size = (size_t)size;
+#endif
+
+	const AssetPackHeader* h = (const AssetPackHeader*)pack.data;
+	bool valid = memcmp(h->magic, "DAP1", 4) == 0 && h->version == ASSET_PACK_VERSION
+		&& h->toc <= pack.size && (pack.size - h->toc) / sizeof(AssetPackEntry) >= h->count;
+	const AssetPackEntry* toc = (const AssetPackEntry*)(pack.data + (valid ? h->toc : 0));
+	for (uint32_t n = 0; valid && n < h->count; n++) {
+		valid = toc[n].name[ASSET_PACK_NAME - 1] == 0 && toc[n].offset % ASSET_PACK_ALIGN == 0
+			&& toc[n].offset <= pack.size && toc[n].size <= pack.size - toc[n].offset
+			&& (uint64_t)toc[n].height * toc[n].pitch <= toc[n].size;
+	}
+	if (!valid) {
+		printf("Ignoring the asset pack %s, it is corrupt or from another version\n", path);
+#ifdef __linux__
+		munmap(pack.data, pack.size);
+#endif
+		pack.copy.clear();
+		pack.data = NULL;
+		pack.size = 0;
+		return false;
+	}
+	pack.toc = toc;
+	pack.count = (int)h->count;
+	return true;
+}
+
+inline const AssetPackEntry* assetPackFind(const AssetPack& pack, const char* path)
+{
+	const char* name = assetPackBaseName(path);
+	for (int n = 0; n < pack.count; n++) {
+		if (strcmp(pack.toc[n].name, name) == 0) return &pack.toc[n];
+	}
+	return NULL;
+}
+
+/*
+* memLoadImage() through the pack: the image comes from ASSET_PACK_FILE
+* when it is there in this format, otherwise the PNG is decoded. free it
+* with memFreeSurface(), the pixels of the pack are not freed with it
+*/
+inline SDL_Surface* assetLoadImage(const char* owner, const char* path, Uint32 format)
+{
+	const AssetPackEntry* e = NULL;
+	{
+		// the startup tasks load images from several threads
+		std::lock_guard<std::recursive_mutex> guard(memLock);
+		if (!assetPack.tried) {
+			assetPack.tried = true;
+			assetPackOpen(assetPack, ASSET_PACK_FILE);
+		}
+		e = assetPackFind(assetPack, path);
+		if (e != NULL && e->format != format) e = NULL;
+		if (e != NULL) assetPackStats.mapped++;
+		else assetPackStats.decoded++;
+	}
+	if (e == NULL) return memLoadImage(owner, path, format);
+	SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormatFrom(assetPack.data + e->offset, e->width, e->height,
+		SDL_BITSPERPIXEL(format), e->pitch, format);
+	if (surface == NULL) return memLoadImage(owner, path, format);
+	return memTrackSurface(owner, surface);
+}
+
+/*
+* decode the images, convert them to format and write them to a pack at
+* path. false with a message if an image or the file fails
+*/
+inline bool assetPackWrite(const char* path, const char* const* images, int count, Uint32 format)
+{
+	std::vector<AssetPackEntry> toc((size_t)count);
+	std::vector<SDL_Surface*> surfaces((size_t)count, (SDL_Surface*)NULL);
+	uint64_t offset = sizeof(AssetPackHeader);
+	bool ok = true;
+	for (int n = 0; n < count && ok; n++) {
+		const char* name = assetPackBaseName(images[n]);
+		if (strlen(name) >= ASSET_PACK_NAME) {
+			printf("Image name %s is too long for the asset pack!\n", name);
+			ok = false;
+			break;
+		}
+		SDL_Surface* temp = IMG_Load(images[n]);
+		if (temp == NULL) {
+			printf("Unable to load image %s! SDL_image Error: %s\n", images[n], IMG_GetError());
+			ok = false;
+			break;
+		}
+		surfaces[n] = SDL_ConvertSurfaceFormat(temp, format, 0);
+		SDL_FreeSurface(temp);
+		if (surfaces[n] == NULL) {
+			ok = false;
+			break;
+		}
+		AssetPackEntry& e = toc[n];
+		memset(&e, 0, sizeof(e));
+		strcpy(e.name, name);
+		e.format = format;
+		e.width = surfaces[n]->w;
+		e.height = surfaces[n]->h;
+		e.pitch = surfaces[n]->pitch;
+		offset = (offset + ASSET_PACK_ALIGN - 1) & ~(uint64_t)(ASSET_PACK_ALIGN - 1);
+		e.offset = offset;
+		e.size = (uint64_t)e.height * e.pitch;
+		offset += e.size;
+	}
+
+	if (ok) {
+		AssetPackHeader h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, "DAP1", 4);
+		h.version = ASSET_PACK_VERSION;
+		h.count = (uint32_t)count;
+		h.toc = (offset + 7) & ~(uint64_t)7;
+
+		FILE* f = fopen(path, "wb");
+		ok = f != NULL && fwrite(&h, sizeof(h), 1, f) == 1;
+		uint64_t written = sizeof(h);
+		const char zeros[ASSET_PACK_ALIGN] = { 0 };
+		for (int n = 0; n < count && ok; n++) {
+			ok = fwrite(zeros, 1, (size_t)(toc[n].offset - written), f) == toc[n].offset - written
+				&& fwrite(surfaces[n]->pixels, 1, (size_t)toc[n].size, f) == toc[n].size;
+			written = toc[n].offset + toc[n].size;
+			printf("%-24s %4dx%-4d %8.1f KB at %llu\n", toc[n].name, toc[n].width, toc[n].height,
+				toc[n].size / 1024.0, (unsigned long long)toc[n].offset);
+		}
+		ok = ok && fwrite(zeros, 1, (size_t)(h.toc - written), f) == h.toc - written
+			&& (count == 0 || fwrite(&toc[0], sizeof(AssetPackEntry), (size_t)count, f) == (size_t)count);
+		if (f != NULL) ok = (fclose(f) == 0) && ok;
+		if (!ok) {
+			printf("Unable to write the asset pack %s!\n", path);
+			remove(path);
+		}
+	}
+	for (int n = 0; n < count; n++) {
+		if (surfaces[n] != NULL) SDL_FreeSurface(surfaces[n]);
+	}
+	return ok;
+}
+
+#endif
@@ -6,9 +6,30 @@
 #include <iostream>
 #include <cmath>
 #include <string>
+#include <vector>
+#include <algorithm>
 
 #include "vector.h"
 #include "matrix.h"
+#include "trace.h"
+#include "perfcounters.h"
+#include "overlay.h"
+#include "memtrack.h"
+#include "assetpack.h"
+#include "kernels.h"
+#include "indexed.h"
+#include "sampler.h"
+#include "validate.h"
+#include "farm.h"
+#include "framecache.h"
+#include "tablecache.h"
+#include "rendergraph.h"
+#include "resolution.h"
+#include "replay.h"
+#include "sprite.h"
+#include "initgraph.h"
+#include "rng.h"
+#include "fastmath.h"
 
 // Screen dimension constants
 const int SCREEN_WIDTH = 640;
@@ -48,13 +69,17 @@ public:
     int getHeight();
 
 private:
-    //The actual hardware texture
-    SDL_Texture* mTexture;
+    //The image in the screen format, color-keyed texels are transparent
+    SDL_Surface* mSurface;
 
     //Image dimensions
     int mWidth;
     int mHeight;
 
+    //Modulation and blending applied when drawing
+    Uint8 mRed, mGreen, mBlue, mAlpha;
+    SDL_BlendMode mBlendMode;
+
 };
 
 // The window we'll be rendering to
@@ -63,9 +88,16 @@ SDL_Window* window = NULL;
 // The surface contained by the window
 SDL_Surface* screenSurface = NULL;
 
+// Screen size the effects are specialized for, picked at the start of every frame
+ResolutionMode renderMode = RES_GENERIC;
+RenderTarget renderTarget;
+
 // Frame Logic
 #define FPS 60
-int lastTime = 0, currentTime, deltaTime;
+// milliseconds as SDL_GetTicks() counts them: they wrap after 49.7 days,
+// so times are only ever compared through elapsedMs(), never with < or >
+Uint32 lastTime = 0, currentTime = 0;
+int deltaTime;
 float msFrame = 1 / (FPS / 1000.0f);
 
 // TRANSITION & DEMO HANDLER VARIABLES
@@ -74,6 +106,9 @@ const int ALLOCATED_TRANSITION_TIME = 500;
 
 // 0->transition, 1->stars, 2->plasma, 3 -> spaceships
 int current_demo = 1; 
+const char* moduleNames[] = { "transition", "stars", "plasma", "spaceships" };
+// part of the frame cache key, bump a module's when its frames change
+const char* moduleVersions[] = { "transition.v2", "stars.v1", "plasma.v2", "spaceships.v2" };
 int prev_demo = 0;
 
 // milliseconds left until swap.
@@ -85,6 +120,8 @@ int numDemos = 3;
 // transition buffers
 unsigned char *transBuffer;
 bool transFirstInit = true;
+// the buffer at the other sizes, resampled every frame
+ModeBuffer transModes[RES_COUNT];
 
 // number of initial lines in transition
 const int numTransLines = 5;
@@ -95,9 +132,17 @@ int height_lines[numTransLines * 2];
 // DEMO VARIABLES 
 // GENERAL
 
-// color palette
-struct RGBColor { unsigned char R, G, B; };
-RGBColor palette[256];
+// random numbers: every module draws from its own streams of the demo seed
+// (--seed n), indexed by the showing, so a showing plays the same whatever
+// came before it
+uint64_t demoSeed = 1;
+enum DemoStream { STREAM_TRANSITION, STREAM_STARS, STREAM_SPACESHIPS };
+// showings of any module since the timeline started
+int clipIndex = 0;
+Rng transitionRng, starsRng, spaceshipsRng;
+
+// color palette, packed for the resolve pass
+Uint32 palette[256];
 
 // STARS
 // change this to adjust the number of stars
@@ -114,11 +159,17 @@ TStar* stars;
 bool starsFirstInit = true;
 
 // PLASMA
-// the two function buffers sized SCREEN_WIDTH * SCREEN_HEIGHT * 4
-unsigned char *plasma1;
-unsigned char *plasma2;
+// the two function buffers, twice the screen in each direction
+// ((SCREEN_WIDTH * 2) * (SCREEN_HEIGHT * 2) bytes) so they can be scrolled,
+// one after the other in a table that may be mapped from the table cache
+const unsigned char *plasma1;
+const unsigned char *plasma2;
+// the tables at the other sizes, resampled once
+ModeBuffer plasmaModes[RES_COUNT][2];
 
 bool plasmaFirstInit = true;
+// the indices of the frame, resolved through the palette
+IndexedFrame plasmaFrame;
 
 // plasma movement
 int Windowx1, Windowy1, Windowx2, Windowy2;
@@ -131,9 +182,6 @@ const float MSEG_BPM = (60000 / BPM_MUSIC);
 const int SPACESHIP_TTL = 6000;
 const int MAX_SPACESHIPS = 11; // The maximum numberof spaceships that will be active at any given moment
 
-// the window renderer
-SDL_Renderer* spaceshipRenderer = NULL;
-
 //Currently displayed texture
 LTexture spaceshipTexture;
 
@@ -150,47 +198,113 @@ TSpaceship *spaceships;
 //Flip type
 SDL_RendererFlip flipType = SDL_FLIP_NONE;
 
-int MusicCurrentTime;
+Uint32 MusicCurrentTime;
 int MusicCurrentTimeBeat;
 int MusicCurrentBeat;
 int MusicPreviousBeat;
 
 bool firstInitMusic = true;
 bool firstInitSpaceship = true;
+// the ship image and the music are loaded, the first showing only places the ships
+bool spaceshipsPrepared = false;
+bool musicPrepared = false;
+
+// PROFILING
+// output file of the timeline trace, NULL when not tracing (--trace out.json)
+const char* tracePath = NULL;
+
+// headless benchmark (--bench [frames]): no window, no audio, fixed clock
+bool headless = false;
+int benchFrames = 0;
+// read hardware counters around every render call (--counters)
+bool benchCounters = false;
+// headless leak check over this many timeline loops (--memcheck [loops])
+int memcheckLoops = 0;
+// endurance run of this many hours of the timeline on an accelerated clock (--soak [hours])
+double soakHours = 0;
+// offline export over worker processes (--farm out.ppm [--frames n] [--workers n])
+const char* farmPath = NULL;
+int farmFrames = 0;
+int farmWorkers = 0;
+// windowed playback on the fixed clock, the same frames on every run (--fixed)
+bool fixedClock = false;
+// recordings of the fixed clock clips, replayed instead of rendered (--cache dir)
+const char* frameCacheDir = NULL;
+FrameCache frameCache;
+// frames since the start of the timeline on the fixed clock, and the clip
+// (one showing of a module) being played
+int fixedFrame = 0;
+int clipStartFrame = 0;
+int clipFrames = 0;
+// input session recorded with the frame hashes (--record file, implies
+// --fixed), and replayed headlessly against them (--replay file)
+const char* recordPath = NULL;
+const char* replayPath = NULL;
+Replay replay;
+// render graph benchmark at 4K, 0 layers runs a sweep (--graph [layers])
+bool graphBench = false;
+int graphLayers = 0;
+// prepare every module concurrently at startup instead of on first showing (--preload)
+bool preload = false;
+
 // FUNTION DECLARATIONS
 
 // General functions
 bool initSDL();
 void update();
 void render();
+void renderTimeline();
 void close();
 void waitTime();
+int elapsedMs(Uint32 from, Uint32 to);
+void handleEvent(const SDL_Event& e, bool& quit);
 void putpixel(SDL_Surface* surface, int x, int y, Uint32 pixel);
 
 
+// Benchmark
+void runBenchmark();
+void advanceFixedClock();
+void waitFixedClock();
+int moduleTime(int demo);
+int timelineFrames();
+int runMemcheck();
+int runSoak();
+float percentile(std::vector<float>& samples, float p);
+void farmRenderRange(int first, int last, int fd);
+int runFarm();
+int runGraph();
+uint64_t frameHash();
+int runReplay();
+
 // Demo control
 void demoControlTime(int deltaTime);
+void prepareTransition();
 void initTransition();
 void updateTransition();
 void renderTransition();
 void initCorrespondingModule();
+bool preloadModules();
 
 // Demo functions
 // Stars
+ void prepareStars();
  void initStars();
  void updateStars();
  void renderStars();
 
 // Plasma
+void preparePlasma();
 void initPlasma();
 void updatePlasma();
 void renderPlasma();
 void buildPalettePlasma();
 
 // Spaceships
+bool prepareMusic();
 void initMusic();
 void updateMusic();
 
+bool prepareSpaceships();
 void initSpaceships();
 void updateSpaceships();
 void renderSpaceships();
@@ -201,6 +315,22 @@ void renderSpaceships();
 * Initialize the window and screen surface variables.
 */
 bool initSDL() {
+    if (headless) {
+        // render into an offscreen surface with the same layout as the window one
+        if (SDL_Init(0) < 0)
+        {
+            std::cout << "SDL could not initialize! SDL_Error: %s\n" << SDL_GetError();
+            return false;
+        }
+        screenSurface = SDL_CreateRGBSurfaceWithFormat(0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (screenSurface == NULL)
+        {
+            std::cout << "Offscreen surface could not be created! SDL_Error: %s\n" << SDL_GetError();
+            return false;
+        }
+        return true;
+    }
+
     //Initialize SDL
     if (SDL_Init(SDL_INIT_VIDEO) < 0)
     {
@@ -208,12 +338,6 @@ bool initSDL() {
         return false;
     }
 
-    //Set texture filtering to linear
-    if (!SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1"))
-    {
-        printf("Warning: Linear texture filtering not enabled!");
-    }
-
     //Create window
     window = SDL_CreateWindow("Demoscene", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
 
@@ -229,6 +353,7 @@ bool initSDL() {
 }
 
 void update() {
+    TRACE_ZONE("update");
     // Handle update functions here.
     // 0->transition, 1->stars, 2->plasma
     switch (current_demo) {
@@ -249,8 +374,14 @@ void update() {
 }
 
 void render() {
-    //Fill with black
-    SDL_FillRect(screenSurface, NULL, SDL_MapRGB(screenSurface->format, 0, 0, 0));
+    TRACE_ZONE("render");
+    //Fill with black, the spaceships fly over white
+    Uint8 background = current_demo == 3 ? 0xFF : 0;
+    SDL_FillRect(screenSurface, NULL, SDL_MapRGB(screenSurface->format, background, background, background));
+
+    // the effects below run the kernels for this size
+    renderMode = resolutionPick(screenSurface);
+    renderTarget = resolutionTarget(screenSurface);
 
     // Handle render functions here.
     switch (current_demo) {
@@ -269,7 +400,36 @@ void render() {
     }
 }
 
+/*
+* render() through the frame cache: on the fixed clock a clip recorded by
+* an earlier run is decompressed instead of rendered
+*/
+void renderTimeline() {
+    bool cacheable = frameCacheDir != NULL && (fixedClock || headless);
+    if (!cacheable) {
+        render();
+        return;
+    }
+    int index = fixedFrame - clipStartFrame;
+    if (frameCache.clip != clipStartFrame) {
+        char params[64];
+        snprintf(params, sizeof(params), "%s/%d/%llu", moduleVersions[current_demo], clipStartFrame, (unsigned long long)demoSeed);
+        frameCacheBegin(frameCache, frameCacheDir, params, clipStartFrame, SCREEN_WIDTH, SCREEN_HEIGHT, clipFrames, index == 0);
+    }
+    {
+        TRACE_ZONE("frameCache");
+        if (frameCacheFetch(frameCache, index, screenSurface->pixels, screenSurface->pitch)) return;
+    }
+    render();
+    frameCacheStore(frameCache, index, screenSurface->pixels, screenSurface->pitch);
+}
+
 void initCorrespondingModule() {
+    // a new clip starts with the next frame and lasts until the module changes
+    clipStartFrame = fixedFrame;
+    clipFrames = (current_time_left + (int)msFrame - 1) / (int)msFrame;
+    clipIndex++;
+
     // 0->transition, 1->stars, 2->plasma, 3-> spaceships
     switch (current_demo) {
     case 0:
@@ -288,36 +448,113 @@ void initCorrespondingModule() {
     }
 }
 
+/*
+* open SDL and prepare every module as a task graph. the window and the audio
+* device stay on this thread, the tables and the ship image are made on the
+* pool meanwhile, so the first showing of a module has nothing left to load
+*/
+bool preloadModules() {
+    ThreadPool pool;
+    poolStart(pool, 0);
+    InitGraph graph;
+    int sdl = initAdd(graph, "sdl", {}, initSDL, true);
+    initAdd(graph, "transition", {}, []() { prepareTransition(); return true; });
+    initAdd(graph, "stars", {}, []() { prepareStars(); return true; });
+    initAdd(graph, "plasma tables", {}, []() { preparePlasma(); return true; });
+    initAdd(graph, "spaceships", { sdl }, prepareSpaceships);
+    if (!headless) {
+        initAdd(graph, "music", { sdl }, prepareMusic, true);
+    }
+    bool ok = initRun(graph, pool);
+    poolStop(pool);
+    initReport(graph);
+    return ok;
+}
+
 void close() {
+    // flush the timeline before tearing everything down
+    if (tracePath != NULL) {
+        traceWrite(tracePath);
+    }
+
     // free memory
-    delete[](stars);
+    memFree(stars);
+
+    tableCacheFree(plasma1);
+    indexedFree(plasmaFrame);
 
-    free(plasma1);
-    free(plasma2);
+    memFree(transBuffer);
 
-    free(transBuffer);
+    for (int m = 0; m < RES_COUNT; m++) {
+        modeBufferFree(transModes[m]);
+        modeBufferFree(plasmaModes[m][0]);
+        modeBufferFree(plasmaModes[m][1]);
+    }
 
-    delete[](spaceships);
+    memFree(spaceships);
 
     //Free loaded image
     spaceshipTexture.free();
 
     //Destroy window    
-    SDL_DestroyRenderer(spaceshipRenderer);
+    if (headless) {
+        SDL_FreeSurface(screenSurface);
+        screenSurface = NULL;
+    }
     SDL_DestroyWindow(window);
 
     window = NULL;
-    spaceshipRenderer = NULL;
     
+    if (memReportOnExit) {
+        memReport();
+    }
+    // farm workers report their own cache use
+    if (frameCacheDir != NULL && farmPath == NULL) {
+        frameCacheEnd(frameCache);
+        printf("\n");
+        frameCacheReport(stdout);
+    }
+    if (tableCacheDir != NULL && farmPath == NULL) {
+        tableCacheReport(stdout);
+    }
+
     //Quit SDL subsystems
     SDL_Quit();
     IMG_Quit();
 
 }
 
+/*
+* react to one event, from SDL or from a recording
+*/
+void handleEvent(const SDL_Event& e, bool& quit) {
+    if (e.type == SDL_KEYDOWN) {
+        if (e.key.keysym.scancode == SDL_SCANCODE_ESCAPE) {
+            quit = true;
+        }
+        // F1 toggles the performance HUD
+        if (e.key.keysym.scancode == SDL_SCANCODE_F1) {
+            hudVisible = !hudVisible;
+        }
+    }
+    //User requests quit
+    if (e.type == SDL_QUIT)
+    {
+        quit = true;
+    }
+}
+
+/*
+* milliseconds from one clock reading to a later one, right across the wrap
+* of the 32 bit counter (and of a signed int, after 24.8 days)
+*/
+int elapsedMs(Uint32 from, Uint32 to) {
+    return (int)(Uint32)(to - from);
+}
+
 void waitTime() {
     currentTime = SDL_GetTicks();
-    deltaTime = currentTime - lastTime;
+    deltaTime = elapsedMs(lastTime, currentTime);
     if (deltaTime < (int)msFrame) {
         SDL_Delay((int)msFrame - deltaTime);
     }
@@ -371,6 +608,7 @@ void putpixel(SDL_Surface* surface, int x, int y, Uint32 pixel)
 
 // TRANSITION
 void demoControlTime(int deltaTime) {
+    TRACE_ZONE("demoControlTime");
     current_time_left -= deltaTime;
     if (current_time_left <= 0) { // Time to change demo.
         std::cout << "Changing to new module, ";
@@ -397,17 +635,21 @@ void demoControlTime(int deltaTime) {
     }
 }
 
-void initTransition() {
-    std::cout << "Initializing Transition Module \n";
-
+void prepareTransition() {
     int tot = SCREEN_HEIGHT * SCREEN_WIDTH;
-    //try and deallocate memory for buffer.
-   
     // asignamos memoria para el buffer.
     if (transFirstInit) {
-        transBuffer = (unsigned char*)malloc(tot);
+        transBuffer = (unsigned char*)memAlloc("transition", tot);
         transFirstInit = false;
     }
+}
+
+void initTransition() {
+    TRACE_ZONE("initTransition");
+    std::cout << "Initializing Transition Module \n";
+
+    prepareTransition();
+    transitionRng = rngSeed(demoSeed, STREAM_TRANSITION, clipIndex);
     //limpiamos lo que haya
     memset(transBuffer, 0, SCREEN_HEIGHT * SCREEN_WIDTH);
 
@@ -416,7 +658,7 @@ void initTransition() {
     // draw n horizontal lines randomly.
     int n, j;
     for (n = 0; n < numTransLines*2; n += 2) {
-        int initial_line = rand() % SCREEN_HEIGHT;
+        int initial_line = rngBelow(transitionRng, SCREEN_HEIGHT);
         height_lines[n] = initial_line;
         height_lines[n + 1] = initial_line;
         for (j = 0; j < SCREEN_WIDTH; j++) {
@@ -428,10 +670,11 @@ void initTransition() {
 
 // We add the new lines 
 void updateTransition(){
+    TRACE_ZONE("updateTransition");
     int n, j;
     for (n = 0; n < numTransLines * 2; n += 2) {
         if (height_lines[n] - 1 >= 0) { height_lines[n] --;}
-        if (height_lines[n+1] + 1 <= SCREEN_HEIGHT) { height_lines[n+1] ++; }
+        if (height_lines[n+1] + 1 < SCREEN_HEIGHT) { height_lines[n+1] ++; }
         
         if (transBuffer[height_lines[n] + 1] != 0xFFFFFFFF) {
             for (j = 0; j < SCREEN_WIDTH; j++) {
@@ -447,39 +690,68 @@ void updateTransition(){
     }
 }
 
-void renderTransition() {
-    int i, j;
-    for (j = 0; j < SCREEN_HEIGHT; j++)
-    {
-        for (i = 0; i < SCREEN_WIDTH; i++)
+template<int W, int H>
+struct TransitionKernel {
+    static void run(const RenderTarget& target) {
+        const int width = Resolution<W, H>::width(target), height = Resolution<W, H>::height(target);
+        const int pitch = Resolution<W, H>::pitch(target);
+        const unsigned char* buffer = transBuffer;
+        if (width != SCREEN_WIDTH || height != SCREEN_HEIGHT) {
+            // the lines are drawn at the screen size, scale them to this one
+            ModeBuffer& b = transModes[renderMode];
+            modeBufferEnsure(b, "transition", width, height);
+            modeBufferResample(b, transBuffer, SCREEN_WIDTH, SCREEN_HEIGHT);
+            buffer = b.pixels;
+        }
+        for (int j = 0; j < height; j++)
         {
-            // plot the pixel as the value from the transition buffer
-            putpixel(screenSurface, i, j, transBuffer[i * j]);
+            Uint32* row = target.pixels + j * pitch;
+            for (int i = 0; i < width; i++)
+            {
+                // plot the pixel as the value from the transition buffer
+                row[i] = buffer[j * width + i];
+            }
         }
     }
+};
+
+void renderTransition() {
+    TRACE_ZONE("renderTransition");
+    resolutionKernel<TransitionKernel>(renderMode)(renderTarget);
 }
 
 
 // STARS
-void initStars() {
-    std::cout << "Initializing Stars Module \n";
-
+void prepareStars() {
     // allocate memory for all our stars
     if (starsFirstInit) {
-        stars = new TStar[MAXSTARS];
+        stars = (TStar*)memAlloc("stars", MAXSTARS * sizeof(TStar));
         starsFirstInit = false;
     }
+}
+
+void initStars() {
+    TRACE_ZONE("initStars");
+    std::cout << "Initializing Stars Module \n";
+
+    prepareStars();
     
-    // randomly generate some stars
+    // randomly generate some stars, the numbers for all of them at once
+    Uint32 random[MAXSTARS * 3];
+    RngLanes lanes = rngSeedLanes(demoSeed, STREAM_STARS, clipIndex);
+    kernels.rngFill(random, MAXSTARS * 3, lanes);
     for (int i = 0; i < MAXSTARS; i++)
     {
-        stars[i].x = (float)(rand() % SCREEN_WIDTH);
-        stars[i].y = (float)(rand() % SCREEN_HEIGHT);
-        stars[i].plane = rand() % 3;     // star colour between 0 and 2
+        stars[i].x = (float)rngRange(random[i * 3], SCREEN_WIDTH);
+        stars[i].y = (float)rngRange(random[i * 3 + 1], SCREEN_HEIGHT);
+        stars[i].plane = rngRange(random[i * 3 + 2], 3);     // star colour between 0 and 2
     }
+    // and the ones that wrap around
+    starsRng = rngSeed(demoSeed, STREAM_STARS, clipIndex);
 }
 
 void updateStars() {
+    TRACE_ZONE("updateStars");
     // update all stars
     for (int i = 0; i < MAXSTARS; i++)
     {
@@ -490,109 +762,139 @@ void updateStars() {
         if (stars[i].x > SCREEN_WIDTH)
         {
             // if so, make it return to the left
-            stars[i].x = -(float)(rand() % SCREEN_WIDTH);
+            stars[i].x = -(float)rngBelow(starsRng, SCREEN_WIDTH);
             // and randomly change the y position
-            stars[i].y = (float)(rand() % SCREEN_HEIGHT);
+            stars[i].y = (float)rngBelow(starsRng, SCREEN_HEIGHT);
         }
     }
 }
 
-void renderStars() {
-    // update all stars
-    for (int i = 0; i < MAXSTARS; i++)
-    {
-        // draw this star, with a colour depending on the plane
-        unsigned int color = 0;
-        switch (1 + stars[i].plane) {
-        case 1:
-            color = 0xFF606060; // dark grey
-            break;
-        case 2:
-            color = 0xFFC2C2C2; // light grey
-            break;
-        case 3:
-            color = 0xFFFFFFFF; // white
-            break;
+template<int W, int H>
+struct StarsKernel {
+    static void run(const RenderTarget& target) {
+        const int width = Resolution<W, H>::width(target), height = Resolution<W, H>::height(target);
+        const int pitch = Resolution<W, H>::pitch(target);
+        // colour depending on the plane
+        static const Uint32 colors[3] = {
+            0xFF606060, // dark grey
+            0xFFC2C2C2, // light grey
+            0xFFFFFFFF  // white
+        };
+        for (int i = 0; i < MAXSTARS; i++)
+        {
+            int x = (int)stars[i].x, y = (int)stars[i].y;
+            // Clipping
+            if ((x < 0) || (x >= width) || (y < 0) || (y >= height))
+                continue;
+            target.pixels[y * pitch + x] = colors[stars[i].plane];
         }
-        putpixel(screenSurface, (int)stars[i].x, (int)stars[i].y, color);
     }
+};
+
+void renderStars() {
+    TRACE_ZONE("renderStars");
+    resolutionKernel<StarsKernel>(renderMode)(renderTarget);
 }
 
 
 // PLASMA
+// the tables never change, they are computed once
+void preparePlasma() {
+    TRACE_ZONE("preparePlasma");
+    if (!plasmaFirstInit) return;
+    const size_t size = (SCREEN_WIDTH * 2) * (SCREEN_HEIGHT * 2);
+    char params[32];
+    snprintf(params, sizeof(params), "%dx%d", SCREEN_WIDTH, SCREEN_HEIGHT);
+    // bump the version when the functions or the MATH_TABLE sine change
+    plasma1 = (const unsigned char*)tableCacheGet("plasma", "plasma.v1", params, size * 2, [size](void* table) {
+        unsigned char* p1 = (unsigned char*)table;
+        unsigned char* p2 = p1 + size;
+        int i, j, dst = 0;
+        for (j = 0; j < (SCREEN_HEIGHT * 2); j++) {
+            for (i = 0; i < (SCREEN_WIDTH * 2); i++)
+            {
+                p1[dst] = (unsigned char)(64 + 63 * (mathSin<MATH_TABLE>((double)mathHypot<MATH_TABLE>(SCREEN_HEIGHT - j, SCREEN_WIDTH - i) / 16)));
+                p2[dst] = (unsigned char)(64 + 63 * mathSin<MATH_TABLE>((float)i / (37 + 15 * mathCos<MATH_TABLE>((float)j / 74))) * mathCos<MATH_TABLE>((float)j / (31 + 11 * mathSin<MATH_TABLE>((float)i / 57))));
+                dst++;
+            }
+        }
+    });
+    plasma2 = plasma1 + size;
+    plasmaFirstInit = false;
+}
+
 void initPlasma() {
+    TRACE_ZONE("initPlasma");
     std::cout << "Initializing Plasma Module \n";
 
-    if (plasmaFirstInit) {
-        plasma1 = (unsigned char*)malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 4);
-        plasma2 = (unsigned char*)malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 4);
-        plasmaFirstInit = false;
-    }
-
-    int i, j, dst = 0;
-    for (j = 0; j < (SCREEN_HEIGHT * 2); j++) {
-        for (i = 0; i < (SCREEN_WIDTH * 2); i++)
-        {
-            plasma1[dst] = (unsigned char)(64 + 63 * (sin((double)hypot(SCREEN_HEIGHT - j, SCREEN_WIDTH - i) / 16)));
-            plasma2[dst] = (unsigned char)(64 + 63 * sin((float)i / (37 + 15 * cos((float)j / 74))) * cos((float)j / (31 + 11 * sin((float)i / 57))));
-            dst++;
-        }
-    }
+    preparePlasma();
 }
 
 void updatePlasma() {
+    TRACE_ZONE("updatePlasma");
     // setup some nice colours, different every frame
     // this is a palette that wraps around itself, with different period sine
     // functions to prevent monotonous colours
     buildPalettePlasma();
 
     // move plasma with more sine functions :)
-    Windowx1 = (SCREEN_WIDTH / 2) + (int)(((SCREEN_WIDTH / 2) - 1) * cos((double)currentTime / 970));
-    Windowx2 = (SCREEN_WIDTH / 2) + (int)(((SCREEN_WIDTH / 2) - 1) * sin((double)-currentTime / 1140));
-    Windowy1 = (SCREEN_HEIGHT / 2) + (int)(((SCREEN_HEIGHT / 2) - 1) * sin((double)currentTime / 1230));
-    Windowy2 = (SCREEN_HEIGHT / 2) + (int)(((SCREEN_HEIGHT / 2) - 1) * cos((double)-currentTime / 750));
+    Windowx1 = (SCREEN_WIDTH / 2) + (int)(((SCREEN_WIDTH / 2) - 1) * mathCos<MATH_POLY>((double)currentTime / 970));
+    Windowx2 = (SCREEN_WIDTH / 2) + (int)(((SCREEN_WIDTH / 2) - 1) * mathSin<MATH_POLY>(-(double)currentTime / 1140));
+    Windowy1 = (SCREEN_HEIGHT / 2) + (int)(((SCREEN_HEIGHT / 2) - 1) * mathSin<MATH_POLY>((double)currentTime / 1230));
+    Windowy2 = (SCREEN_HEIGHT / 2) + (int)(((SCREEN_HEIGHT / 2) - 1) * mathCos<MATH_POLY>(-(double)currentTime / 750));
     // we only select the part of the precalculated buffer that we need
     src1 = Windowy1 * (SCREEN_WIDTH * 2) + Windowx1;
     src2 = Windowy2 * (SCREEN_WIDTH * 2) + Windowx2;
 }
 
-void renderPlasma() {
-    // draw the plasma... this is where most of the time is spent.
-
-    Uint8* dst;
-    long i, j;
-    Uint8* initbuffer = (Uint8*)screenSurface->pixels;
-    int bpp = screenSurface->format->BytesPerPixel;
-
-    SDL_LockSurface(screenSurface);
-
-    dst = initbuffer;
-    for (j = 0; j < SCREEN_HEIGHT; j++)
-    {
-        dst = initbuffer + j * screenSurface->pitch;
-        for (i = 0; i < SCREEN_WIDTH; i++)
+template<int W, int H>
+struct PlasmaKernel {
+    static void run(const RenderTarget& target) {
+        const int width = Resolution<W, H>::width(target), height = Resolution<W, H>::height(target);
+        const int pitch = Resolution<W, H>::pitch(target);
+
+        indexedEnsure(plasmaFrame, "plasma", width, height);
+        const unsigned char* line1 = plasma1 + src1;
+        const unsigned char* line2 = plasma2 + src2;
+        if (width != SCREEN_WIDTH || height != SCREEN_HEIGHT) {
+            // the tables scaled to twice this size, the windows move over them in proportion
+            ModeBuffer* tables = plasmaModes[renderMode];
+            if (modeBufferEnsure(tables[0], "plasma", width * 2, height * 2)) {
+                modeBufferResample(tables[0], plasma1, SCREEN_WIDTH * 2, SCREEN_HEIGHT * 2);
+            }
+            if (modeBufferEnsure(tables[1], "plasma", width * 2, height * 2)) {
+                modeBufferResample(tables[1], plasma2, SCREEN_WIDTH * 2, SCREEN_HEIGHT * 2);
+            }
+            line1 = tables[0].pixels + (Windowy1 * height / SCREEN_HEIGHT) * (width * 2) + Windowx1 * width / SCREEN_WIDTH;
+            line2 = tables[1].pixels + (Windowy2 * height / SCREEN_HEIGHT) * (width * 2) + Windowx2 * width / SCREEN_WIDTH;
+        }
+        for (int j = 0; j < height; j++)
         {
-            // plot the pixel as a sum of all our plasma functions
-            unsigned int Color = 0;
-            int indexColor = (plasma1[src1] + plasma2[src2]) % 256;
-            Color = 0xFF000000 + (palette[indexColor].R << 16) + (palette[indexColor].G << 8) + palette[indexColor].B;
-            *(Uint32*)dst = Color;
-
-            dst += bpp;
-            src1++; src2++;
+            // the index is the sum of all our plasma functions, wrapping like the palette
+            unsigned char* index = plasmaFrame.pixels + j * width;
+            indexedAdd(index, line1, line2, width);
+            // get the next line in the precalculated buffers
+            line1 += width * 2; line2 += width * 2;
         }
-        // get the next line in the precalculated buffers
-        src1 += SCREEN_WIDTH; src2 += SCREEN_WIDTH;
+        indexedResolve(plasmaFrame, palette, target.pixels, pitch);
     }
+};
+
+void renderPlasma() {
+    TRACE_ZONE("renderPlasma");
+    // draw the plasma... this is where most of the time is spent.
+    SDL_LockSurface(screenSurface);
+    resolutionKernel<PlasmaKernel>(renderMode)(renderTarget);
     SDL_UnlockSurface(screenSurface);
 }
 
 void buildPalettePlasma() {
     for (int i = 0; i < 256; i++)
     {
-        palette[i].R = (unsigned char)(128 + 127 * cos(i * M_PI / 128 + (double)currentTime / 740));
-        palette[i].G = (unsigned char)(128 + 127 * sin(i * M_PI / 128 + (double)currentTime / 630));
-        palette[i].B = (unsigned char)(128 - 127 * cos(i * M_PI / 128 + (double)currentTime / 810));
+        palette[i] = palettePack(
+            (unsigned char)(128 + 127 * mathCos<MATH_TABLE>(i * M_PI / 128 + (double)currentTime / 740)),
+            (unsigned char)(128 + 127 * mathSin<MATH_TABLE>(i * M_PI / 128 + (double)currentTime / 630)),
+            (unsigned char)(128 - 127 * mathCos<MATH_TABLE>(i * M_PI / 128 + (double)currentTime / 810)));
     }
 
 }
@@ -603,9 +905,11 @@ void buildPalettePlasma() {
 LTexture::LTexture()
 {
     //Initialize
-    mTexture = NULL;
+    mSurface = NULL;
     mWidth = 40;
     mHeight = 40;
+    mRed = mGreen = mBlue = mAlpha = 0xFF;
+    mBlendMode = SDL_BLENDMODE_BLEND;
 }
 
 LTexture::~LTexture()
@@ -619,49 +923,30 @@ bool LTexture::loadFromFile(std::string path)
     //Get rid of preexisting texture
     free();
 
-    //The final texture
-    SDL_Texture* newTexture = NULL;
-
-    //Load image at specified path
-    SDL_Surface* loadedSurface = IMG_Load(path.c_str());
-    if (loadedSurface == NULL)
-    {
-        printf("Unable to load image %s! SDL_image Error: %s\n", path.c_str(), IMG_GetError());
-    }
-    else
+    //Load image at specified path, in the format of the screen
+    SDL_Surface* loadedSurface = assetLoadImage("spaceships", path.c_str(), SDL_PIXELFORMAT_ARGB8888);
+    if (loadedSurface != NULL)
     {
         //Color key image
-        SDL_SetColorKey(loadedSurface, SDL_TRUE, SDL_MapRGB(loadedSurface->format, 0, 0xFF, 0xFF));
-
-        //Create texture from surface pixels
-        newTexture = SDL_CreateTextureFromSurface(spaceshipRenderer, loadedSurface);
-        if (newTexture == NULL)
-        {
-            printf("Unable to create texture from %s! SDL Error: %s\n", path.c_str(), SDL_GetError());
-        }
-        else
-        {
-            //Get image dimensions
-            mWidth = loadedSurface->w/5;
-            mHeight = loadedSurface->h/5;
-        }
+        spriteApplyColorKey(loadedSurface, SDL_MapRGB(loadedSurface->format, 0, 0xFF, 0xFF));
 
-        //Get rid of old loaded surface
-        SDL_FreeSurface(loadedSurface);
+        //Get image dimensions
+        mWidth = loadedSurface->w/5;
+        mHeight = loadedSurface->h/5;
     }
 
     //Return success
-    mTexture = newTexture;
-    return mTexture != NULL;
+    mSurface = loadedSurface;
+    return mSurface != NULL;
 }
 
 void LTexture::free()
 {
     //Free texture if it exists
-    if (mTexture != NULL)
+    if (mSurface != NULL)
     {
-        SDL_DestroyTexture(mTexture);
-        mTexture = NULL;
+        memFreeSurface(mSurface);
+        mSurface = NULL;
         mWidth = 0;
         mHeight = 0;
     }
@@ -670,23 +955,27 @@ void LTexture::free()
 void LTexture::setColor(Uint8 red, Uint8 green, Uint8 blue)
 {
     //Modulate texture rgb
-    SDL_SetTextureColorMod(mTexture, red, green, blue);
+    mRed = red;
+    mGreen = green;
+    mBlue = blue;
 }
 
 void LTexture::setBlendMode(SDL_BlendMode blending)
 {
     //Set blending function
-    SDL_SetTextureBlendMode(mTexture, blending);
+    mBlendMode = blending;
 }
 
 void LTexture::setAlpha(Uint8 alpha)
 {
     //Modulate texture alpha
-    SDL_SetTextureAlphaMod(mTexture, alpha);
+    mAlpha = alpha;
 }
 
 void LTexture::render(int x, int y, SDL_Rect* clip, double angle, SDL_Point* center, SDL_RendererFlip flip)
 {
+    if (mSurface == NULL) return;
+
     //Set rendering space and render to screen
     SDL_Rect renderQuad = { x, y, mWidth, mHeight };
 
@@ -697,8 +986,18 @@ void LTexture::render(int x, int y, SDL_Rect* clip, double angle, SDL_Point* cen
         renderQuad.h = clip->h;
     }
 
-    //Render to screen
-    SDL_RenderCopyEx(spaceshipRenderer, mTexture, clip, &renderQuad, angle, center, flip);
+    //Render to the framebuffer of this frame
+    Sprite sprite;
+    sprite.pixels = (const Uint32*)mSurface->pixels;
+    sprite.width = mSurface->w;
+    sprite.height = mSurface->h;
+    sprite.pitch = mSurface->pitch / 4;
+    sprite.r = mRed;
+    sprite.g = mGreen;
+    sprite.b = mBlue;
+    sprite.a = mAlpha;
+    sprite.blend = mBlendMode == SDL_BLENDMODE_BLEND;
+    spriteBlit(renderTarget, sprite, clip, renderQuad, angle, center, flip);
 }
 
 int LTexture::getWidth()
@@ -713,6 +1012,7 @@ int LTexture::getHeight()
 
 bool loadMedia()
 {
+    TRACE_ZONE("loadMedia");
     //Loading success flag
     bool success = true;
 
@@ -729,38 +1029,43 @@ bool loadMedia()
 
 // SPACESHIP LOGIC
 
+/*
+* allocate the ships and load their image, false when it can not be loaded
+*/
+bool prepareSpaceships() {
+    if (spaceshipsPrepared) return true;
+    if (spaceships == NULL) {
+        spaceships = (TSpaceship*)memAlloc("spaceships", MAX_SPACESHIPS * sizeof(TSpaceship));
+    }
+    // the ships are drawn by the sprite blitter into the screen surface
+    int imgFlags = IMG_INIT_PNG;
+
+    if (!(IMG_Init(imgFlags) & imgFlags)) {
+        printf("SDL_image could not initialize! SDL_image Error: %s\n", IMG_GetError());
+        return false;
+    }
+
+    if (!loadMedia()) {
+        printf("Failed to load media!\n");
+        return false;
+    }
+    spaceshipsPrepared = true;
+    return true;
+}
+
 void initSpaceships() {
+    TRACE_ZONE("initSpaceships");
     std::cout << "Initializing Spaceship Module \n";
     if (firstInitSpaceship) {
-        spaceships = new TSpaceship[MAX_SPACESHIPS];
-        //create renderer for window.
-        spaceshipRenderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-        if (spaceshipRenderer == NULL) {
-            printf("Renderer could not be created! SDL Error: %s\n", SDL_GetError());
-            close();
-            exit(1);
-        }
-        else {
-            // initialize renderer as white.
-            std::cout << "assigned renderer successfully. \n";
-            SDL_SetRenderDrawColor(spaceshipRenderer, 0xFF, 0xFF, 0xFF, 0xFF);
-            int imgFlags = IMG_INIT_PNG;
-
-            if (!(IMG_Init(imgFlags) & imgFlags)) {
-                printf("SDL_image could not initialize! SDL_image Error: %s\n", IMG_GetError());
-                close();
-                exit(1);
-            }
-        }
-
-        if (!loadMedia()) {
-            printf("Failed to load media!\n");
+        if (!prepareSpaceships()) {
             close();
             exit(1);
         }
 
         std::cout << "loaded media. \n";
 
+        // the ships are placed once, on their own stream
+        spaceshipsRng = rngSeed(demoSeed, STREAM_SPACESHIPS, 0);
         int i = 0;
         int heights[2] = { 20, SCREEN_HEIGHT - 20 };
         int widths[2] = { 20, SCREEN_WIDTH - 20 };
@@ -768,8 +1073,8 @@ void initSpaceships() {
         for (i = 0; i < MAX_SPACESHIPS; i++) {
             spaceships[i].active = false;
             spaceships[i].TTL = SPACESHIP_TTL;
-            int a = widths[rand() % 2];
-            int b = heights[rand() % 2];
+            int a = widths[rngBelow(spaceshipsRng, 2)];
+            int b = heights[rngBelow(spaceshipsRng, 2)];
             spaceships[i].start_x = a;
             spaceships[i].start_y = b;
             spaceships[i].x = a;
@@ -797,6 +1102,7 @@ void initSpaceships() {
 }
 
 void updateSpaceships() {
+    TRACE_ZONE("updateSpaceships");
     for (int i = 0; i < MAX_SPACESHIPS; i++) {
         if (spaceships[i].active) {
             spaceships[i].TTL -= deltaTime;
@@ -831,29 +1137,47 @@ void updateSpaceships() {
 }
 
 void renderSpaceships() {
-    //Clear screen
-    SDL_SetRenderDrawColor(spaceshipRenderer, 0xFF, 0xFF, 0xFF, 0xFF);
-    SDL_RenderClear(spaceshipRenderer);
-
+    TRACE_ZONE("renderSpaceships");
+    // render() cleared the screen to white
     for (int i = 0; i < MAX_SPACESHIPS; i++) {
         TSpaceship s = spaceships[i];
         if (spaceships[i].active) {
             spaceshipTexture.render(spaceships[i].x, spaceships[i].y, NULL, spaceships[i].rotation, NULL, SDL_FLIP_HORIZONTAL);
         }
     }
-
-    SDL_RenderPresent(spaceshipRenderer);
 }
 
 
+/*
+* open the audio device and load the music, false when it can not be loaded
+*/
+bool prepareMusic() {
+    TRACE_ZONE("prepareMusic");
+    if (musicPrepared) return true;
+    Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 4096);
+    Mix_Init(MIX_INIT_OGG);
+    imperial = Mix_LoadMUS("../imperial.ogg");
+    if (!imperial) {
+        std::cout << "Error loading Music: " << Mix_GetError() << std::endl;
+        return false;
+    }
+    musicPrepared = true;
+    return true;
+}
+
 void initMusic() {
+    TRACE_ZONE("initMusic");
     std::cout << "Initializing Music Module \n";
+    if (firstInitMusic && headless) {
+        // no audio device when benchmarking, only the beat counters are needed
+        MusicCurrentTime = 0;
+        MusicCurrentTimeBeat = 0;
+        MusicCurrentBeat = 0;
+        MusicPreviousBeat = -1;
+        firstInitMusic = false;
+    }
     if (firstInitMusic) {
-        Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 4096);
-        Mix_Init(MIX_INIT_OGG);
-        imperial = Mix_LoadMUS("../imperial.ogg");
-        if (!imperial) {
-            std::cout << "Error loading Music: " << Mix_GetError() << std::endl;
+        if (!prepareMusic()) {
             close();
             exit(1);
         }
@@ -867,6 +1191,7 @@ void initMusic() {
 }
 
 void updateMusic(){
+    TRACE_ZONE("updateMusic");
     MusicCurrentTime += deltaTime;
     MusicCurrentTimeBeat += deltaTime;
     MusicPreviousBeat = MusicCurrentBeat;
@@ -885,16 +1210,806 @@ void updateMusic(){
     }
 }
 
+// BENCHMARK
+
+/*
+* run every module for benchFrames frames with a fixed 60 fps clock and
+* report the time spent in render(), plus hardware counters if requested.
+*/
+void runBenchmark() {
+    const double pixels = (double)SCREEN_WIDTH * SCREEN_HEIGHT;
+
+    if (benchCounters) {
+        perfInit();
+    }
+    kernelsReport();
+    printf("Effects specialized for %s\n", resolutionNames[resolutionPick(screenSurface)]);
+
+    printf("\n%-12s %10s", "module", "ms/frame");
+    if (benchCounters) {
+        printf(" %6s %12s %12s %12s %14s %15s", "IPC", "cycles/px", "L1D miss/px", "LLC miss/px", "br miss/px", "dTLB miss/kpx");
+    }
+    printf("\n");
+
+    for (int demo = 0; demo <= numDemos; demo++) {
+        // deterministic clock: every module starts at t=0 and advances one frame at a time
+        currentTime = 0;
+        lastTime = 0;
+        deltaTime = (int)msFrame;
+        current_demo = demo;
+        initCorrespondingModule();
+
+        Uint64 ticks = 0;
+        PerfSample total, before, after;
+        memset(&total, 0, sizeof(total));
+
+        for (int frame = 0; frame < benchFrames; frame++) {
+            currentTime += deltaTime;
+            update();
+
+            Uint64 start = SDL_GetPerformanceCounter();
+            if (benchCounters) perfRead(&before);
+            render();
+            if (benchCounters) {
+                perfRead(&after);
+                perfAccumulate(&total, before, after);
+            }
+            ticks += SDL_GetPerformanceCounter() - start;
+        }
+
+        double frames = (double)benchFrames;
+        printf("%-12s %10.3f", moduleNames[demo], 1000.0 * ticks / SDL_GetPerformanceFrequency() / frames);
+        if (benchCounters) {
+            double cycles = (double)total.value[PERF_CYCLES];
+            double perPixel = frames * pixels;
+            if (perfAvailable(PERF_CYCLES) && perfAvailable(PERF_INSTRUCTIONS) && cycles > 0)
+                printf(" %6.2f", total.value[PERF_INSTRUCTIONS] / cycles);
+            else
+                printf(" %6s", "n/a");
+            // TLB misses are rare enough to count per thousand pixels
+            const int perPixelCounters[] = { PERF_CYCLES, PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_BRANCH_MISSES, PERF_DTLB_MISSES };
+            const int widths[] = { 12, 12, 12, 14, 15 };
+            const double scales[] = { 1, 1, 1, 1, 1000 };
+            for (int c = 0; c < 5; c++) {
+                if (perfAvailable(perPixelCounters[c]))
+                    printf(" %*.4f", widths[c], scales[c] * total.value[perPixelCounters[c]] / perPixel);
+                else
+                    printf(" %*s", widths[c], "n/a");
+            }
+        }
+        printf("\n");
+    }
+
+    // compare the dTLB misses against a run with --small-pages
+    for (int n = 0; n < memNumTables; n++) {
+        printf("table of %s: %.1f MB on %s\n", memOwners[memTables[n].owner].name, memTables[n].size / 1048576.0,
+            memPagesNames[memTables[n].pages]);
+    }
+
+    // cost of the HUD on a 1080p framebuffer, its budget is 0.2 ms
+    SDL_Surface* hd = SDL_CreateRGBSurfaceWithFormat(0, 1920, 1080, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (hd != NULL) {
+        // touched first, a window surface is resident and the page faults
+        // of a fresh one are not the HUD's
+        memset(hd->pixels, 0, (size_t)hd->pitch * hd->h);
+        hudVisible = true;
+        for (int n = 0; n < HUD_GRAPH_SAMPLES; n++) hudAddFrame(16.7f, 5.0f);
+        float total = 0;
+        for (int frame = 0; frame < benchFrames; frame++) {
+            hudRender(hd, "plasma", frame);
+            total += hudCostMs;
+        }
+        hudVisible = false;
+        printf("\nHUD at 1920x1080: %.4f ms/frame (budget 0.2 ms)%s\n", total / benchFrames,
+            total / benchFrames > 0.2f ? " OVER BUDGET" : "");
+        SDL_FreeSurface(hd);
+    }
+
+    // sprite blitter throughput with the spaceship image, upright and rotated
+    renderTarget = resolutionTarget(screenSurface);
+    const double angles[] = { 0, 45, 115 };
+    printf("\n");
+    for (int a = 0; a < 3; a++) {
+        const int sprites = 20000;
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int n = 0; n < sprites; n++) {
+            spaceshipTexture.render((n * 37) % (SCREEN_WIDTH - 40), (n * 53) % (SCREEN_HEIGHT - 40), NULL, angles[a], NULL,
+                SDL_FLIP_HORIZONTAL);
+        }
+        double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        printf("sprites at %3.0f degrees: %10.0f sprites/s\n", angles[a], sprites / seconds);
+    }
+
+    // what bilinear filtering costs over nearest texels, and what the
+    // texture layouts save as the rotozoomer turns, in cycles with --counters
+    samplerBenchmark(20);
+    samplerSweep(256, 4);
+    samplerSweep(1024, 4);
+    if (benchCounters) {
+        perfClose();
+    }
+
+    memReport();
+}
+
+/*
+* advance the clock by exactly one frame, used instead of waitTime() when
+* running headless so every run sees the same sequence of times
+*/
+void advanceFixedClock() {
+    fixedFrame++;
+    lastTime = currentTime;
+    currentTime += (Uint32)msFrame;
+    deltaTime = elapsedMs(lastTime, currentTime);
+    demoControlTime(deltaTime);
+}
+
+/*
+* windowed --fixed playback: wait for the frame time like waitTime(), but
+* the demo only ever sees whole frames
+*/
+void waitFixedClock() {
+    static Uint32 frameStart = 0;
+    int spent = (int)(SDL_GetTicks() - frameStart);
+    if (spent < (int)msFrame) {
+        SDL_Delay((int)msFrame - spent);
+    }
+    frameStart = SDL_GetTicks();
+    advanceFixedClock();
+}
+
+/*
+* milliseconds a module runs for before the next one, 0 is the transition
+*/
+int moduleTime(int demo) {
+    return demo == 0 ? ALLOCATED_TRANSITION_TIME : ALLOCATED_DEMO_TIMES[demo - 1];
+}
+
+/*
+* frames in one loop of the whole timeline at the fixed clock
+*/
+int timelineFrames() {
+    int loopMs = 0;
+    for (int n = 0; n < numDemos; n++) {
+        loopMs += ALLOCATED_DEMO_TIMES[n] + ALLOCATED_TRANSITION_TIME;
+    }
+    return loopMs / (int)msFrame + 1;
+}
+
+/*
+* leak check: run the whole timeline once to warm up every module, then
+* memcheckLoops more times, and fail if the resident size or the tracked
+* memory grew. returns the process exit code
+*/
+int runMemcheck() {
+    int loopFrames = timelineFrames();
+
+    currentTime = 0;
+    lastTime = 0;
+    initCorrespondingModule();
+    for (int frame = 0; frame < loopFrames; frame++) {
+        update();
+        render();
+        advanceFixedClock();
+    }
+    size_t rssBefore = residentBytes();
+    size_t trackedBefore = memTrackedBytes();
+
+    for (int loop = 0; loop < memcheckLoops; loop++) {
+        for (int frame = 0; frame < loopFrames; frame++) {
+            update();
+            render();
+            advanceFixedClock();
+        }
+    }
+    size_t rssAfter = residentBytes();
+    size_t trackedAfter = memTrackedBytes();
+
+    memReport();
+    // the allocator may keep a few pages around, anything above this is a leak
+    const size_t rssTolerance = 256 * 1024;
+    printf("\nmemcheck: %d loops of %d frames, resident %+ld KB, tracked %+ld KB\n", memcheckLoops, loopFrames,
+        ((long)rssAfter - (long)rssBefore) / 1024, ((long)trackedAfter - (long)trackedBefore) / 1024);
+    if (trackedAfter > trackedBefore || rssAfter > rssBefore + rssTolerance) {
+        printf("memcheck FAILED: memory grew over the timeline loop\n");
+        return 1;
+    }
+    printf("memcheck passed\n");
+    return 0;
+}
+
+/*
+* p-th percentile (0..100) of the samples, which get reordered
+*/
+float percentile(std::vector<float>& samples, float p) {
+    if (samples.empty()) return 0;
+    size_t n = (size_t)(p / 100 * (samples.size() - 1) + 0.5f);
+    std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+    return samples[n];
+}
+
+/*
+* endurance run: play the timeline over and over on the fixed clock, as fast
+* as it renders, for soakHours of show time. every loop samples the memory,
+* the live surfaces and the frame time percentiles of every module, and the
+* run fails if memory grows after the first loop or the frame times drift.
+* the clock starts right before a signed int of milliseconds overflows
+* (24.8 days) and jumps halfway to right before SDL_GetTicks() wraps
+* (49.7 days), so both happen on every soak.
+* returns the process exit code
+*/
+int runSoak() {
+    const int loopFrames = timelineFrames();
+    const double loopMs = loopFrames * (double)(Uint32)msFrame;
+    int loops = (int)ceil(soakHours * 3600000.0 / loopMs);
+    // the baselines need a few loops on both sides of the jump
+    if (loops < 8) loops = 8;
+    const Uint32 lead = (Uint32)(2 * loopMs);
+    const Uint32 intWrap = 0x80000000u - lead, uintWrap = 0u - lead;
+
+    // memory may grow 256 KB in total, the median frame time half its baseline
+    const size_t rssTolerance = 256 * 1024;
+    const float driftTolerance = 0.5f;
+
+    printf("soak: %d loops of %d frames (%.1f hours of show time)\n", loops, loopFrames, loops * loopMs / 3600000.0);
+    printf("%5s %11s %10s %10s %8s", "loop", "clock", "RSS KB", "tracked KB", "surfaces");
+    for (int m = 0; m <= numDemos; m++) printf(" %17s", moduleNames[m]);
+    printf("\n%49s", "");
+    for (int m = 0; m <= numDemos; m++) printf(" %8s %8s", "p50 ms", "p99 ms");
+    printf("\n");
+
+    // the modules log every switch, thousands of times over a soak
+    std::cout.setstate(std::ios::failbit);
+    currentTime = intWrap;
+    lastTime = intWrap;
+    MusicCurrentTime = intWrap;
+    fixedFrame = 0;
+    initCorrespondingModule();
+
+    bool ok = true;
+    size_t rssBase = 0, trackedBase = 0;
+    int surfacesBase = 0;
+    // the timeline checks: the module that was left before the running
+    // transition, the milliseconds spent in the running module and in the
+    // running loop of the timeline. the soak starts in the middle of a module,
+    // so the first one and the first loop are not measured
+    const int frameMs = (int)(Uint32)msFrame;
+    int cycleExpected = 0;
+    for (int m = 1; m <= numDemos; m++) cycleExpected += moduleTime(m) + moduleTime(0);
+    int prevEffect = prev_demo;
+    int timeLeft, segmentMs = 0, cycleMs = 0, cycles = 0;
+    bool segmentStarted = false, cycleStarted = false;
+    // median frame time of every module, per loop
+    std::vector<std::vector<float> > medians(numDemos + 1);
+    std::vector<std::vector<float> > times(numDemos + 1);
+    for (int loop = 0; loop < loops; loop++) {
+        if (loop == loops / 2) {
+            currentTime = uintWrap;
+            lastTime = uintWrap;
+            MusicCurrentTime = uintWrap;
+        }
+        for (int m = 0; m <= numDemos; m++) times[m].clear();
+        for (int frame = 0; frame < loopFrames; frame++) {
+            int demo = current_demo;
+            timeLeft = current_time_left;
+            Uint64 start = SDL_GetPerformanceCounter();
+            update();
+            render();
+            times[demo].push_back((float)(1000.0 * (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency()));
+            advanceFixedClock();
+            segmentMs += deltaTime;
+            const char* broke = NULL;
+            if (deltaTime != frameMs) broke = "the frame delta changed";
+            else if (current_demo == demo) {
+                // inside a module the time left only counts down, one frame at a time
+                if (current_time_left != timeLeft - deltaTime || current_time_left <= 0) broke = "the time left did not count down";
+            }
+            else {
+                // a switch goes to the next module with its whole allocation, after spending all of the last one
+                int next = demo != 0 ? 0 : (prevEffect == numDemos ? 1 : prevEffect + 1);
+                if (current_demo != next) broke = "the modules switched out of order";
+                else if (current_time_left != moduleTime(current_demo)) broke = "the module did not start with its allocation";
+                else if (segmentStarted && (segmentMs < moduleTime(demo) || segmentMs >= moduleTime(demo) + frameMs))
+                    broke = "the module did not last its allocation";
+                if (demo != 0) prevEffect = demo;
+                // the timeline adds up once it comes back to the first effect
+                if (current_demo == 1 && cycleStarted && (cycleMs + segmentMs < cycleExpected ||
+                    cycleMs + segmentMs >= cycleExpected + 2 * numDemos * frameMs)) {
+                    broke = "the timeline did not add up";
+                }
+                if (segmentStarted) cycleMs += segmentMs;
+                if (current_demo == 1) {
+                    if (cycleStarted) cycles++;
+                    cycleStarted = true;
+                    cycleMs = 0;
+                }
+                segmentStarted = true;
+                segmentMs = 0;
+            }
+            if (broke != NULL) {
+                std::cout.clear();
+                printf("soak FAILED: clock broke at %u ms, %s (delta %d, %s with %d ms left)\n", currentTime, broke,
+                    deltaTime, moduleNames[current_demo], current_time_left);
+                return 1;
+            }
+        }
+
+        size_t rss = residentBytes(), tracked = memTrackedBytes();
+        int surfaces = 0;
+        for (int n = 0; n < memNumOwners; n++) surfaces += memOwners[n].surfaces;
+        printf("%5d %11u %10.0f %10.0f %8d", loop, currentTime, rss / 1024.0, tracked / 1024.0, surfaces);
+        for (int m = 0; m <= numDemos; m++) {
+            float p50 = percentile(times[m], 50), p99 = percentile(times[m], 99);
+            medians[m].push_back(p50);
+            printf(" %8.3f %8.3f", p50, p99);
+        }
+        printf("\n");
+
+        // the first loop initializes every module
+        if (loop == 0) {
+            rssBase = rss;
+            trackedBase = tracked;
+            surfacesBase = surfaces;
+        }
+        else if (tracked > trackedBase || surfaces > surfacesBase || rss > rssBase + rssTolerance) {
+            printf("soak FAILED: memory grew in loop %d (resident %+ld KB, tracked %+ld KB, surfaces %+d)\n", loop,
+                ((long)rss - (long)rssBase) / 1024, ((long)tracked - (long)trackedBase) / 1024, surfaces - surfacesBase);
+            ok = false;
+        }
+    }
+
+    std::cout.clear();
+
+    // drift: the last loops against the ones after the warm up
+    int window = (loops - 1) / 3;
+    for (int m = 0; m <= numDemos; m++) {
+        std::vector<float> first(medians[m].begin() + 1, medians[m].begin() + 1 + window);
+        std::vector<float> last(medians[m].end() - window, medians[m].end());
+        float before = percentile(first, 50), after = percentile(last, 50);
+        bool drifted = after > before * (1 + driftTolerance) + 0.01f;
+        printf("%-12s median %.3f ms -> %.3f ms%s\n", moduleNames[m], before, after, drifted ? "  DRIFTED" : "");
+        if (drifted) ok = false;
+    }
+    printf("timeline: %d loops of %d ms checked\n", cycles, cycleExpected);
+    printf("soak %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+/*
+* farm worker: render frames [first, last) of the fixed clock timeline and
+* send them to the coordinator as packed RGB.
+* the effects keep all their state in update(), so running only the updates
+* of the frames before the range brings the worker to the same state as if
+* it had rendered them, at a fraction of the cost
+*/
+void farmRenderRange(int first, int last, int fd) {
+    std::vector<Uint8> rgb(SCREEN_WIDTH * SCREEN_HEIGHT * 3);
+    currentTime = 0;
+    lastTime = 0;
+    fixedFrame = 0;
+    initCorrespondingModule();
+    for (int frame = 0; frame < last; frame++) {
+        update();
+        if (frame >= first) {
+            renderTimeline();
+            Uint8* dst = &rgb[0];
+            for (int j = 0; j < SCREEN_HEIGHT; j++) {
+                Uint32* src = (Uint32*)((Uint8*)screenSurface->pixels + j * screenSurface->pitch);
+                for (int i = 0; i < SCREEN_WIDTH; i++) {
+                    *dst++ = (Uint8)(src[i] >> 16);
+                    *dst++ = (Uint8)(src[i] >> 8);
+                    *dst++ = (Uint8)src[i];
+                }
+            }
+            if (!farmSendFrame(fd, frame, &rgb[0], (int)rgb.size())) return;
+        }
+        advanceFixedClock();
+    }
+    if (frameCacheDir != NULL) {
+        // stdout is closed in the workers
+        fprintf(stderr, "frames %d-%d ", first, last - 1);
+        frameCacheReport(stderr);
+    }
+}
+
+/*
+* export farmFrames frames as a stream of binary PPM images, split over
+* farmWorkers processes. returns the process exit code
+*/
+int runFarm() {
+    if (farmFrames <= 0) farmFrames = timelineFrames();
+    if (farmWorkers <= 0) farmWorkers = farmDefaultWorkers();
+    char header[32];
+    snprintf(header, sizeof(header), "P6\n%d %d\n255\n", SCREEN_WIDTH, SCREEN_HEIGHT);
+    return farmRun(farmPath, farmFrames, farmWorkers, header, SCREEN_WIDTH * SCREEN_HEIGHT * 3, farmRenderRange) ? 0 : 1;
+}
+
+// graph benchmark: plasma layers blended one after the other at 4K, then a
+// post pass into the output
+static const int GRAPH_WIDTH = 3840, GRAPH_HEIGHT = 2160;
+
+struct GraphLayer {
+    Uint32 palette[256];
+    long src1, src2;
+};
+
+/*
+* a plasma layer at 4K, tiling the windows of the precalculated tables
+*/
+void graphPlasma(const GraphLayer& layer, Uint32* dst, int pitch) {
+    for (int j = 0; j < GRAPH_HEIGHT; j++) {
+        long row = (long)(j % SCREEN_HEIGHT) * (SCREEN_WIDTH * 2);
+        for (int i = 0; i < GRAPH_WIDTH; i += SCREEN_WIDTH) {
+            kernels.plasmaRow(dst + j * pitch + i, plasma1 + layer.src1 + row, plasma2 + layer.src2 + row, layer.palette, SCREEN_WIDTH);
+        }
+    }
+}
+
+/*
+* 50% mix of two layers
+*/
+void graphBlend(const Uint32* a, const Uint32* b, Uint32* dst, int pitch) {
+    for (int j = 0; j < GRAPH_HEIGHT; j++) {
+        for (int i = 0; i < GRAPH_WIDTH; i++) {
+            dst[i] = ((a[i] >> 1) & 0x7F7F7F7F) + ((b[i] >> 1) & 0x7F7F7F7F);
+        }
+        a += pitch; b += pitch; dst += pitch;
+    }
+}
+
+/*
+* post pass: darken every other line like an old monitor
+*/
+void graphScanlines(const Uint32* src, Uint32* dst, int pitch) {
+    for (int j = 0; j < GRAPH_HEIGHT; j++) {
+        for (int i = 0; i < GRAPH_WIDTH; i++) {
+            dst[i] = (j & 1) ? 0xFF000000 | (((src[i] >> 2) & 0x3F3F3F3F) * 3) : src[i];
+        }
+        src += pitch; dst += pitch;
+    }
+}
+
+/*
+* benchmark of the render graph: for every layer count build the graph,
+* check it against the same passes run by hand on two scratch buffers, and
+* time it run serially and on the thread pool. the memory of the transients
+* must stay flat however many layers there are.
+* returns the process exit code
+*/
+int runGraph() {
+    int sweep[] = { 2, 8, 32 };
+    int runs = 3;
+    if (graphLayers > 0) {
+        sweep[0] = graphLayers;
+        runs = 1;
+    }
+    const int frames = 4;
+    initPlasma();
+    ThreadPool pool;
+    poolStart(pool, 0);
+    kernelsReport();
+    printf("\nthreads: %d, %dx%d\n\n", (int)pool.threads.size() + 1, GRAPH_WIDTH, GRAPH_HEIGHT);
+    printf("%6s %6s %6s %12s %12s %10s %10s %6s\n", "layers", "nodes", "levels", "naive MB", "pooled MB", "serial ms", "pool ms", "check");
+
+    bool ok = true;
+    std::vector<Uint32> output((size_t)GRAPH_WIDTH * GRAPH_HEIGHT);
+    std::vector<Uint32> expected(output.size());
+    for (int run = 0; run < runs; run++) {
+        const int layers = sweep[run] < 2 ? 2 : sweep[run];
+
+        // every layer a different window and palette, as the plasma at a different time
+        std::vector<GraphLayer> params(layers);
+        for (int n = 0; n < layers; n++) {
+            currentTime = 1000 + 733 * n;
+            updatePlasma();
+            memcpy(params[n].palette, palette, sizeof(palette));
+            params[n].src1 = src1;
+            params[n].src2 = src2;
+        }
+
+        RenderGraph graph;
+        std::vector<GraphBuffer> layer(layers), mix(layers);
+        GraphBuffer out = graphImport(graph, "output", GRAPH_WIDTH, GRAPH_HEIGHT, &output[0], GRAPH_WIDTH);
+        for (int n = 0; n < layers; n++) {
+            layer[n] = graphCreateTransient(graph, "layer", GRAPH_WIDTH, GRAPH_HEIGHT);
+            GraphBuffer target = layer[n];
+            const GraphLayer* p = &params[n];
+            graphAddNode(graph, "plasma layer", {}, { target }, [&graph, p, target]() {
+                graphPlasma(*p, graphPixels(graph, target), graphPitch(graph, target));
+            });
+        }
+        mix[0] = layer[0];
+        for (int n = 1; n < layers; n++) {
+            mix[n] = graphCreateTransient(graph, "mix", GRAPH_WIDTH, GRAPH_HEIGHT);
+            GraphBuffer a = mix[n - 1], b = layer[n], target = mix[n];
+            graphAddNode(graph, "blend", { a, b }, { target }, [&graph, a, b, target]() {
+                graphBlend(graphPixels(graph, a), graphPixels(graph, b), graphPixels(graph, target), graphPitch(graph, target));
+            });
+        }
+        GraphBuffer last = mix[layers - 1];
+        graphAddNode(graph, "scanlines", { last }, { out }, [&graph, last, out]() {
+            graphScanlines(graphPixels(graph, last), graphPixels(graph, out), graphPitch(graph, out));
+        });
+        graphCompile(graph);
+
+        // the same passes by hand
+        {
+            std::vector<Uint32> acc(output.size()), scratch(output.size());
+            graphPlasma(params[0], &acc[0], GRAPH_WIDTH);
+            for (int n = 1; n < layers; n++) {
+                graphPlasma(params[n], &scratch[0], GRAPH_WIDTH);
+                graphBlend(&acc[0], &scratch[0], &acc[0], GRAPH_WIDTH);
+            }
+            graphScanlines(&acc[0], &expected[0], GRAPH_WIDTH);
+        }
+
+        double ms[2];
+        bool match = true;
+        for (int parallel = 0; parallel < 2; parallel++) {
+            memset(&output[0], 0, output.size() * sizeof(Uint32));
+            Uint64 start = SDL_GetPerformanceCounter();
+            for (int frame = 0; frame < frames; frame++) {
+                graphExecute(graph, parallel ? &pool : NULL);
+            }
+            ms[parallel] = 1000.0 * (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency() / frames;
+            if (output != expected) match = false;
+        }
+        if (!match) ok = false;
+
+        printf("%6d %6d %6d %12.1f %12.1f %10.2f %10.2f %6s\n", layers, (int)graph.nodes.size(), graph.levels,
+            graphNaiveBytes(graph) / 1048576.0, graphPooledBytes(graph) / 1048576.0, ms[0], ms[1], match ? "ok" : "FAIL");
+        graphRelease(graph);
+    }
+    poolStop(pool);
+    printf("\ngraph %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+uint64_t frameHash() {
+    return replayHashFrame(screenSurface->pixels, screenSurface->pitch, SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+/*
+* play a recorded session again headlessly: the same events on the same
+* frames of the fixed clock, comparing every frame that has a hash.
+* returns the process exit code
+*/
+int runReplay() {
+    if (!replayLoad(replay, replayPath, SCREEN_WIDTH, SCREEN_HEIGHT)) return 1;
+
+    currentTime = 0;
+    lastTime = 0;
+    fixedFrame = 0;
+    initCorrespondingModule();
+    bool quit = false;
+    SDL_Event e;
+    while (!quit && fixedFrame < replay.frames) {
+        while (replayNextEvent(replay, fixedFrame, &e)) {
+            handleEvent(e, quit);
+        }
+        update();
+        renderTimeline();
+        replayCheckFrame(replay, fixedFrame, frameHash());
+        advanceFixedClock();
+    }
+    return replayReport(replay) ? 0 : 1;
+}
+
+/*
+* the command line options, after a bad one
+*/
+void printUsage() {
+    std::cout << "Usage: demoscene [--trace out.json] [--bench [frames] [--counters]] [--small-pages] [--hud]\n"
+        "                 [--memreport] [--memcheck [loops]] [--soak [hours]]\n"
+        "                 [--isa=scalar|sse2|avx2|avx512]\n"
+        "                 [--validate [seed]] [--farm out.ppm [--frames n] [--workers n]]\n"
+        "                 [--fixed] [--cache dir] [--tables dir] [--graph [layers]]\n"
+        "                 [--record session.bin] [--replay session.bin] [--preload]\n"
+        "                 [--seed n] [--math] [--pack out.dap image.png ...]\n";
+}
+
 int main(int argc, char* args[])
 {
-    //Initialize SDL
-    if (!initSDL())
+    // time to the first frame is measured from here
+    std::chrono::steady_clock::time_point startup = std::chrono::steady_clock::now();
+
+    // Command line options
+    KernelIsa isa = ISA_COUNT;
+    bool validate = false;
+    bool mathBench = false;
+    uint32_t validateSeed = 1;
+    const char* packPath = NULL;
+    int packFirst = 0;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(args[a], "--trace") == 0 && a + 1 < argc) {
+            tracePath = args[++a];
+        }
+        else if (strcmp(args[a], "--bench") == 0) {
+            headless = true;
+            benchFrames = 600;
+            if (a + 1 < argc && atoi(args[a + 1]) > 0) {
+                benchFrames = atoi(args[++a]);
+            }
+        }
+        else if (strcmp(args[a], "--counters") == 0) {
+            benchCounters = true;
+        }
+        else if (strcmp(args[a], "--small-pages") == 0) {
+            memHugePages = false;
+        }
+        else if (strcmp(args[a], "--hud") == 0) {
+            hudVisible = true;
+        }
+        else if (strcmp(args[a], "--memreport") == 0) {
+            memReportOnExit = true;
+        }
+        else if (strcmp(args[a], "--memcheck") == 0) {
+            headless = true;
+            memcheckLoops = 3;
+            if (a + 1 < argc && atoi(args[a + 1]) > 0) {
+                memcheckLoops = atoi(args[++a]);
+            }
+        }
+        else if (strcmp(args[a], "--soak") == 0) {
+            headless = true;
+            soakHours = 1;
+            if (a + 1 < argc && atof(args[a + 1]) > 0) {
+                soakHours = atof(args[++a]);
+            }
+        }
+        else if (strcmp(args[a], "--farm") == 0 && a + 1 < argc) {
+            headless = true;
+            farmPath = args[++a];
+        }
+        else if (strcmp(args[a], "--frames") == 0 && a + 1 < argc) {
+            farmFrames = atoi(args[++a]);
+        }
+        else if (strcmp(args[a], "--workers") == 0 && a + 1 < argc) {
+            farmWorkers = atoi(args[++a]);
+        }
+        else if (strcmp(args[a], "--fixed") == 0) {
+            fixedClock = true;
+        }
+        else if (strcmp(args[a], "--cache") == 0 && a + 1 < argc) {
+            frameCacheDir = args[++a];
+        }
+        else if (strcmp(args[a], "--tables") == 0 && a + 1 < argc) {
+            tableCacheDir = args[++a];
+        }
+        else if (strcmp(args[a], "--graph") == 0) {
+            headless = true;
+            graphBench = true;
+            if (a + 1 < argc && atoi(args[a + 1]) > 0) {
+                graphLayers = atoi(args[++a]);
+            }
+        }
+        else if (strcmp(args[a], "--record") == 0 && a + 1 < argc) {
+            recordPath = args[++a];
+            fixedClock = true;
+        }
+        else if (strcmp(args[a], "--replay") == 0 && a + 1 < argc) {
+            replayPath = args[++a];
+            headless = true;
+        }
+        else if (strcmp(args[a], "--seed") == 0 && a + 1 < argc) {
+            demoSeed = strtoull(args[++a], NULL, 10);
+        }
+        else if (strcmp(args[a], "--math") == 0) {
+            mathBench = true;
+        }
+        else if (strcmp(args[a], "--pack") == 0 && a + 1 < argc) {
+            // the rest of the arguments are the images
+            packPath = args[++a];
+            packFirst = a + 1;
+            a = argc;
+        }
+        else if (strcmp(args[a], "--preload") == 0) {
+            preload = true;
+        }
+        else if (strcmp(args[a], "--validate") == 0) {
+            validate = true;
+            if (a + 1 < argc && atoi(args[a + 1]) > 0) {
+                validateSeed = (uint32_t)atoi(args[++a]);
+            }
+        }
+        else if (kernelsParseIsa(args[a]) != ISA_COUNT) {
+            isa = kernelsParseIsa(args[a]);
+        }
+        else {
+            std::cout << "Unknown option " << args[a] << "\n";
+            printUsage();
+            return 1;
+        }
+    }
+    // the counters are only read around the benchmark
+    if (benchCounters && benchFrames == 0) {
+        std::cout << "--counters needs --bench\n";
+        printUsage();
+        return 1;
+    }
+
+    // compare every kernel variant with the scalar one, no window needed
+    if (validate) {
+        return validateKernels(validateSeed) ? 0 : 1;
+    }
+
+    // the fast math backends against libm, no window needed either
+    if (mathBench) {
+        mathBenchmark();
+        return 0;
+    }
+
+    // build the asset pack offline, assetLoadImage() maps it on later runs
+    if (packPath != NULL) {
+        IMG_Init(IMG_INIT_PNG);
+        bool ok = assetPackWrite(packPath, args + packFirst, argc - packFirst, SDL_PIXELFORMAT_ARGB8888);
+        IMG_Quit();
+        return ok ? 0 : 1;
+    }
+
+    // pick the kernel variants for this CPU
+    kernelsInit(isa);
+
+    // recorded frames are only valid on the fixed clock
+    if (frameCacheDir != NULL) {
+        frameCacheMakeDir(frameCacheDir);
+        fixedClock = true;
+    }
+    // the precomputed tables, generated once and mapped on later runs
+    if (tableCacheDir != NULL) {
+        frameCacheMakeDir(tableCacheDir);
+    }
+
+    if (tracePath != NULL) {
+        traceBegin();
+    }
+
+    //Initialize SDL, and everything else with it when preloading
+    if (!(preload ? preloadModules() : initSDL()))
     {
         std::cout << "Failed to initialize!\n";
         return 1;
     }
+    else if (farmPath != NULL)
+    {
+        int result = runFarm();
+        close();
+        return result;
+    }
+    else if (replayPath != NULL)
+    {
+        int result = runReplay();
+        close();
+        return result;
+    }
+    else if (graphBench)
+    {
+        int result = runGraph();
+        close();
+        return result;
+    }
+    else if (soakHours > 0)
+    {
+        int result = runSoak();
+        close();
+        return result;
+    }
+    else if (memcheckLoops > 0)
+    {
+        int result = runMemcheck();
+        close();
+        return result;
+    }
+    else if (headless)
+    {
+        runBenchmark();
+    }
     else
     {
+        if (recordPath != NULL && !replayRecordBegin(replay, recordPath, SCREEN_WIDTH, SCREEN_HEIGHT)) {
+            close();
+            return 1;
+        }
         //Modules initialization
         initCorrespondingModule();
 
@@ -903,32 +2018,58 @@ int main(int argc, char* args[])
 
         //Event handler
         SDL_Event e;
+        bool firstFrame = true;
 
         while (!quit) {
+            TRACE_ZONE("frame");
             // Handle events on queue
-            while (SDL_PollEvent(&e) != 0)
             {
-                if (e.type == SDL_KEYDOWN) {
-                    if (e.key.keysym.scancode == SDL_SCANCODE_ESCAPE) {
-                        quit = true;
-                    }
-                }
-                //User requests quit
-                if (e.type == SDL_QUIT)
+                TRACE_ZONE("events");
+                while (SDL_PollEvent(&e) != 0)
                 {
-                    quit = true;
+                    if (recordPath != NULL) {
+                        replayRecordEvent(replay, fixedFrame, e);
+                    }
+                    handleEvent(e, quit);
                 }
-            }           
+            }
+            Uint64 workStart = SDL_GetPerformanceCounter();
+
             // updates all
             update();
 
             //Render
-            render();
+            renderTimeline();
+            if (recordPath != NULL) {
+                replayRecordFrame(replay, fixedFrame, frameHash());
+            }
+
+            float workMs = (float)(1000.0 * (SDL_GetPerformanceCounter() - workStart) / SDL_GetPerformanceFrequency());
+            {
+                TRACE_ZONE("hud");
+                hudRender(screenSurface, moduleNames[current_demo], MusicCurrentBeat);
+            }
 
             //Update the surface
-            SDL_UpdateWindowSurface(window);
-            waitTime();
+            {
+                TRACE_ZONE("present");
+                SDL_UpdateWindowSurface(window);
+            }
+            if (firstFrame) {
+                printf("first frame after %.1f ms\n",
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startup).count());
+                firstFrame = false;
+            }
+            {
+                TRACE_ZONE("waitTime");
+                if (fixedClock) waitFixedClock();
+                else waitTime();
+            }
+            hudAddFrame((float)deltaTime, workMs);
         } 
+        if (recordPath != NULL) {
+            replayRecordEnd(replay, fixedFrame);
+        }
     }
     //Free resources and close SDL
     close();
@@ -0,0 +1,251 @@
+#ifndef __FARM_H_
+#define __FARM_H_
+
+// Offline render farm on one machine (Linux).
+// The coordinator forks one worker process per frame range. Every worker
+// renders its range headlessly and streams the finished frames back over a
+// pipe. The coordinator writes each frame at its place in the output file
+// (all frames have the same size), so the result is in order no matter
+// which worker finishes first.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// what a worker sends before every frame
+struct FarmFrameHeader {
+	int32_t frame;
+	int32_t bytes;
+};
+
+// renders frames [first, last) and sends every one with farmSendFrame()
+typedef void (*FarmRenderRange)(int first, int last, int fd);
+
+// one worker process seen from the coordinator
+struct FarmWorker {
+	int pid;
+	int fd;         // read end of its pipe, -1 once it is closed
+	int first, last;
+	int received;
+};
+
+#ifdef __linux__
+inline bool farmWriteAll(int fd, const void* data, size_t bytes)
+{
+	const char* p = (const char*)data;
+	while (bytes > 0) {
+		ssize_t n = write(fd, p, bytes);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		bytes -= (size_t)n;
+	}
+	return true;
+}
+
+/*
+* read exactly bytes, false on end of file or error
+*/
+inline bool farmReadAll(int fd, void* data, size_t bytes)
+{
+	char* p = (char*)data;
+	while (bytes > 0) {
+		ssize_t n = read(fd, p, bytes);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		bytes -= (size_t)n;
+	}
+	return true;
+}
+
+inline bool farmSendFrame(int fd, int frame, const void* data, int bytes)
+{
+	FarmFrameHeader header;
+	header.frame = frame;
+	header.bytes = bytes;
+	return farmWriteAll(fd, &header, sizeof(header)) && farmWriteAll(fd, data, bytes);
+}
+#else
+inline bool farmSendFrame(int fd, int frame, const void* data, int bytes)
+{
+	return false;
+}
+#endif
+
+inline int farmDefaultWorkers()
+{
+#ifdef __linux__
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? (int)cpus : 1;
+#else
+	return 1;
+#endif
+}
+
+/*
+* stop the workers started so far, when the farm can not start the rest:
+* their pipes are closed, they are killed and reaped
+*/
+inline void farmAbort(std::vector<FarmWorker>& pool, int started)
+{
+	for (int w = 0; w < started; w++) {
+		FarmWorker& worker = pool[w];
+		if (worker.fd >= 0) close(worker.fd);
+		worker.fd = -1;
+		if (worker.pid > 0) {
+			kill(worker.pid, SIGKILL);
+			waitpid(worker.pid, NULL, 0);
+		}
+		worker.pid = -1;
+	}
+}
+
+/*
+* render frames [0, frames) over the given number of worker processes into
+* path. every frame is written as header followed by frameBytes of data.
+* returns true when all the frames arrived and every worker exited cleanly
+*/
+inline bool farmRun(const char* path, int frames, int workers, const char* header, int frameBytes, FarmRenderRange render)
+{
+#ifdef __linux__
+	if (workers < 1) workers = 1;
+	if (workers > frames) workers = frames;
+	const size_t headerBytes = strlen(header);
+	const size_t recordBytes = headerBytes + frameBytes;
+
+	int out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0) {
+		printf("Unable to create %s!\n", path);
+		return false;
+	}
+
+	printf("Farm: %d frames over %d workers into %s\n", frames, workers, path);
+	auto start = std::chrono::steady_clock::now();
+
+	// anything still buffered would be printed once more by every worker
+	fflush(stdout);
+	std::vector<FarmWorker> pool(workers);
+	for (int w = 0; w < workers; w++) {
+		FarmWorker& worker = pool[w];
+		worker.first = (int)((long long)frames * w / workers);
+		worker.last = (int)((long long)frames * (w + 1) / workers);
+		worker.received = 0;
+
+		int fds[2];
+		if (pipe(fds) != 0) {
+			printf("Unable to create the pipe of worker %d!\n", w);
+			farmAbort(pool, w);
+			close(out);
+			return false;
+		}
+		int pid = fork();
+		if (pid == 0) {
+			// worker: keep the write end, silence the effects' logging
+			close(fds[0]);
+			for (int other = 0; other < w; other++) close(pool[other].fd);
+			close(out);
+			int null = open("/dev/null", O_WRONLY);
+			if (null >= 0) dup2(null, STDOUT_FILENO);
+			render(worker.first, worker.last, fds[1]);
+			close(fds[1]);
+			_exit(0);
+		}
+		close(fds[1]);
+		if (pid < 0) {
+			printf("Unable to start worker %d!\n", w);
+			close(fds[0]);
+			worker.pid = -1;
+			worker.fd = -1;
+			continue;
+		}
+		worker.pid = pid;
+		worker.fd = fds[0];
+	}
+
+	// take frames from whichever worker has one ready
+	std::vector<char> record(recordBytes);
+	memcpy(&record[0], header, headerBytes);
+	bool ok = true;
+	int running = 0;
+	for (int w = 0; w < workers; w++) if (pool[w].fd >= 0) running++;
+	std::vector<struct pollfd> fds;
+	std::vector<int> owners;
+	while (running > 0) {
+		fds.clear();
+		owners.clear();
+		for (int w = 0; w < workers; w++) {
+			if (pool[w].fd < 0) continue;
+			struct pollfd p;
+			p.fd = pool[w].fd;
+			p.events = POLLIN;
+			p.revents = 0;
+			fds.push_back(p);
+			owners.push_back(w);
+		}
+		if (poll(&fds[0], fds.size(), -1) < 0) {
+			if (errno == EINTR) continue;
+			ok = false;
+			break;
+		}
+		for (size_t n = 0; n < fds.size(); n++) {
+			if (fds[n].revents == 0) continue;
+			FarmWorker& worker = pool[owners[n]];
+			FarmFrameHeader frame;
+			bool got = farmReadAll(worker.fd, &frame, sizeof(frame));
+			if (got && (frame.bytes != frameBytes || frame.frame < worker.first || frame.frame >= worker.last)) {
+				printf("Worker %d sent a bad frame (%d, %d bytes)\n", owners[n], frame.frame, frame.bytes);
+				got = false;
+				ok = false;
+			}
+			if (got) got = farmReadAll(worker.fd, &record[headerBytes], frameBytes);
+			if (got) {
+				if (pwrite(out, &record[0], recordBytes, (off_t)recordBytes * frame.frame) != (ssize_t)recordBytes) {
+					printf("Unable to write frame %d!\n", frame.frame);
+					ok = false;
+				}
+				worker.received++;
+			}
+			else {
+				// end of file: the worker is done (or died)
+				close(worker.fd);
+				worker.fd = -1;
+				running--;
+			}
+		}
+	}
+	close(out);
+
+	for (int w = 0; w < workers; w++) {
+		FarmWorker& worker = pool[w];
+		int status = 0;
+		if (worker.pid > 0) waitpid(worker.pid, &status, 0);
+		bool clean = worker.pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+		int expected = worker.last - worker.first;
+		printf("worker %2d: frames %6d-%-6d %6d/%d%s\n", w, worker.first, worker.last - 1, worker.received, expected,
+			clean && worker.received == expected ? "" : "  FAILED");
+		if (!clean || worker.received != expected) ok = false;
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("Farm %s: %d frames in %.2f s (%.1f frames/s)\n", ok ? "done" : "FAILED", frames, seconds,
+		seconds > 0 ? frames / seconds : 0.0);
+	return ok;
+#else
+	printf("The render farm needs fork() and pipes, it only runs on Linux\n");
+	return false;
+#endif
+}
+
+#endif
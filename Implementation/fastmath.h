@@ -0,0 +1,364 @@
+#ifndef __FASTMATH_H_
+#define __FASTMATH_H_
+
+// Fast sin, cos, atan2, sqrt and hypot.
+// Every function is a template on the precision, so each call site picks:
+//   MATH_LIBM   the C library, in double
+//   MATH_POLY   minimax polynomial in float      sin/cos 1.1e-7, atan2 5.2e-7
+//   MATH_TABLE  lookup with linear interpolation sin/cos 3.5e-7, atan2 3.6e-7
+// (largest absolute error against libm, measured by mathBenchmark() over
+// the ranges it prints). sqrt and hypot have no table: both fast backends
+// use the float square root instruction, correctly rounded to float. The
+// SSE2 forms use the same polynomials; their square root is an estimate
+// refined once, 2.7e-7 relative.
+// The scalar functions take double and reduce the angle in double, so they
+// stay accurate for the large times the effects feed them. The SSE2 forms
+// work on four floats and reduce in float: keep |x| below a few thousand.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MATH_SSE2 1
+#include <emmintrin.h>
+#endif
+
+enum MathPrecision {
+	MATH_LIBM,
+	MATH_POLY,
+	MATH_TABLE,
+	MATH_PRECISION_COUNT
+};
+
+const char* mathPrecisionNames[MATH_PRECISION_COUNT] = { "libm", "poly", "table" };
+
+#define MATH_SIN_TABLE 4096     // entries per turn, a power of two
+#define MATH_ATAN_TABLE 1024    // entries over [0, 1]
+
+// sin(r) = r + r^3 (S3 + r^2 (S5 + r^2 (S7 + r^2 S9))) on [-pi/2, pi/2]
+const float MATH_S3 = -0.1666665709641097f;
+const float MATH_S5 = 0.008333017289125638f;
+const float MATH_S7 = -0.00019806615017901327f;
+const float MATH_S9 = 2.6000543495576604e-06f;
+// atan(t) = t (A1 + t^2 (A3 + ... t^2 A13)) on [0, 1]
+const float MATH_A1 = 0.9999961115088429f;
+const float MATH_A3 = -0.3331736791729486f;
+const float MATH_A5 = 0.19807814292869189f;
+const float MATH_A7 = -0.13233337149012797f;
+const float MATH_A9 = 0.07962358015814144f;
+const float MATH_A11 = -0.033604138961435805f;
+const float MATH_A13 = 0.006811765763485661f;
+
+// one extra entry at the end so the interpolation never wraps
+struct MathTables {
+	float sin[MATH_SIN_TABLE + 1];
+	float atan[MATH_ATAN_TABLE + 1];
+
+	MathTables()
+	{
+		for (int n = 0; n <= MATH_SIN_TABLE; n++) sin[n] = (float)::sin(n * (2 * M_PI / MATH_SIN_TABLE));
+		for (int n = 0; n <= MATH_ATAN_TABLE; n++) atan[n] = (float)::atan((double)n / MATH_ATAN_TABLE);
+	}
+};
+
+MathTables mathTables;
+
+
+// SCALAR BACKENDS
+
+inline float mathSinReduced(float r)
+{
+	float r2 = r * r;
+	return r + r * r2 * (MATH_S3 + r2 * (MATH_S5 + r2 * (MATH_S7 + r2 * MATH_S9)));
+}
+
+inline float mathSinPoly(double x)
+{
+	// x = q pi + r, and sin(x) = (-1)^q sin(r)
+	double q = floor(x * M_1_PI + 0.5);
+	float s = mathSinReduced((float)(x - q * M_PI));
+	return ((int64_t)q & 1) ? -s : s;
+}
+
+/*
+* turns is the angle in table entries
+*/
+inline float mathSinLookup(double turns)
+{
+	int64_t whole = (int64_t)turns;
+	if (turns < whole) whole--;
+	float frac = (float)(turns - whole);
+	int i = (int)(whole & (MATH_SIN_TABLE - 1));
+	return mathTables.sin[i] + (mathTables.sin[i + 1] - mathTables.sin[i]) * frac;
+}
+
+inline float mathAtanReduced(float t)
+{
+	float t2 = t * t;
+	return t * (MATH_A1 + t2 * (MATH_A3 + t2 * (MATH_A5 + t2 * (MATH_A7 + t2 * (MATH_A9 + t2 * (MATH_A11 + t2 * MATH_A13))))));
+}
+
+inline float mathAtanLookup(float t)
+{
+	float pos = t * MATH_ATAN_TABLE;
+	int i = (int)pos;
+	if (i >= MATH_ATAN_TABLE) return mathTables.atan[MATH_ATAN_TABLE];
+	return mathTables.atan[i] + (mathTables.atan[i + 1] - mathTables.atan[i]) * (pos - i);
+}
+
+
+// SCALAR INTERFACE
+
+template<MathPrecision P>
+inline double mathSin(double x)
+{
+	if (P == MATH_LIBM) return sin(x);
+	if (P == MATH_POLY) return mathSinPoly(x);
+	return mathSinLookup(x * (MATH_SIN_TABLE / (2 * M_PI)));
+}
+
+template<MathPrecision P>
+inline double mathCos(double x)
+{
+	if (P == MATH_LIBM) return cos(x);
+	if (P == MATH_POLY) return mathSinPoly(x + M_PI / 2);
+	// a quarter turn further in the table
+	return mathSinLookup(x * (MATH_SIN_TABLE / (2 * M_PI)) + MATH_SIN_TABLE / 4);
+}
+
+template<MathPrecision P>
+inline double mathAtan2(double y, double x)
+{
+	if (P == MATH_LIBM) return atan2(y, x);
+	// the first octant, then unfolded
+	float ax = (float)fabs(x), ay = (float)fabs(y);
+	float hi = ax > ay ? ax : ay, lo = ax > ay ? ay : ax;
+	if (hi == 0) return 0;
+	float t = lo / hi;
+	float a = P == MATH_POLY ? mathAtanReduced(t) : mathAtanLookup(t);
+	if (ay > ax) a = (float)(M_PI / 2) - a;
+	if (x < 0) a = (float)M_PI - a;
+	return y < 0 ? -a : a;
+}
+
+template<MathPrecision P>
+inline double mathSqrt(double x)
+{
+	if (P == MATH_LIBM) return sqrt(x);
+	return sqrtf((float)x);
+}
+
+/*
+* the fast ones do not guard against overflow like hypot() does
+*/
+template<MathPrecision P>
+inline double mathHypot(double x, double y)
+{
+	if (P == MATH_LIBM) return hypot(x, y);
+	return sqrtf((float)(x * x + y * y));
+}
+
+
+// SSE2 FORMS, four floats at a time, polynomial backend
+
+#ifdef MATH_SSE2
+
+/*
+* x - q pi, with pi in two parts: q times the short one is exact for the q we expect
+*/
+inline __m128 mathReducePs(__m128 x, __m128 q)
+{
+	return _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(q, _mm_set1_ps(3.140625f))), _mm_mul_ps(q, _mm_set1_ps(9.67653589793e-4f)));
+}
+
+inline __m128 mathSinReducedPs(__m128 r)
+{
+	__m128 r2 = _mm_mul_ps(r, r);
+	__m128 p = _mm_add_ps(_mm_set1_ps(MATH_S7), _mm_mul_ps(r2, _mm_set1_ps(MATH_S9)));
+	p = _mm_add_ps(_mm_set1_ps(MATH_S5), _mm_mul_ps(r2, p));
+	p = _mm_add_ps(_mm_set1_ps(MATH_S3), _mm_mul_ps(r2, p));
+	return _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), p));
+}
+
+inline __m128 mathSinPs(__m128 x)
+{
+	__m128i q = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps((float)M_1_PI)));
+	__m128 s = mathSinReducedPs(mathReducePs(x, _mm_cvtepi32_ps(q)));
+	// odd q flips the sign
+	return _mm_xor_ps(s, _mm_castsi128_ps(_mm_slli_epi32(q, 31)));
+}
+
+/*
+* x = (k + 1/2) pi + r gives cos(x) = (-1)^(k+1) sin(r), adding pi / 2 to x
+* in float would lose the low bits of r
+*/
+inline __m128 mathCosPs(__m128 x)
+{
+	__m128i k = _mm_cvtps_epi32(_mm_sub_ps(_mm_mul_ps(x, _mm_set1_ps((float)M_1_PI)), _mm_set1_ps(0.5f)));
+	__m128 half = _mm_add_ps(_mm_cvtepi32_ps(k), _mm_set1_ps(0.5f));
+	__m128 s = mathSinReducedPs(mathReducePs(x, half));
+	return _mm_xor_ps(s, _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(k, _mm_set1_epi32(1)), 31)));
+}
+
+inline __m128 mathAtan2Ps(__m128 y, __m128 x)
+{
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	__m128 ax = _mm_andnot_ps(sign, x), ay = _mm_andnot_ps(sign, y);
+	__m128 hi = _mm_max_ps(ax, ay), lo = _mm_min_ps(ax, ay);
+	// 0 / tiny is 0 where both are 0
+	__m128 t = _mm_div_ps(lo, _mm_max_ps(hi, _mm_set1_ps(1e-30f)));
+	__m128 t2 = _mm_mul_ps(t, t);
+	__m128 p = _mm_add_ps(_mm_set1_ps(MATH_A11), _mm_mul_ps(t2, _mm_set1_ps(MATH_A13)));
+	p = _mm_add_ps(_mm_set1_ps(MATH_A9), _mm_mul_ps(t2, p));
+	p = _mm_add_ps(_mm_set1_ps(MATH_A7), _mm_mul_ps(t2, p));
+	p = _mm_add_ps(_mm_set1_ps(MATH_A5), _mm_mul_ps(t2, p));
+	p = _mm_add_ps(_mm_set1_ps(MATH_A3), _mm_mul_ps(t2, p));
+	p = _mm_add_ps(_mm_set1_ps(MATH_A1), _mm_mul_ps(t2, p));
+	__m128 a = _mm_mul_ps(t, p);
+	// unfold the octant without branches
+	__m128 steep = _mm_cmpgt_ps(ay, ax);
+	a = _mm_or_ps(_mm_and_ps(steep, _mm_sub_ps(_mm_set1_ps((float)(M_PI / 2)), a)), _mm_andnot_ps(steep, a));
+	__m128 left = _mm_cmplt_ps(x, _mm_setzero_ps());
+	a = _mm_or_ps(_mm_and_ps(left, _mm_sub_ps(_mm_set1_ps((float)M_PI), a)), _mm_andnot_ps(left, a));
+	return _mm_xor_ps(a, _mm_and_ps(sign, y));
+}
+
+/*
+* reciprocal square root estimate and one Newton step, about 22 bits
+*/
+inline __m128 mathSqrtFastPs(__m128 x)
+{
+	__m128 r = _mm_rsqrt_ps(x);
+	r = _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), x), _mm_mul_ps(r, r))));
+	// rsqrt(0) is infinite
+	return _mm_and_ps(_mm_mul_ps(x, r), _mm_cmpgt_ps(x, _mm_setzero_ps()));
+}
+
+inline __m128 mathHypotPs(__m128 x, __m128 y)
+{
+	return mathSqrtFastPs(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+}
+
+#endif
+
+
+// BENCHMARK
+
+enum MathInputs {
+	MATH_IN_ANGLE,          // a in [-100, 100]
+	MATH_IN_POSITIVE,       // a in [0, 1e4]
+	MATH_IN_PLANE           // a, b in [-100, 100]
+};
+
+// one function under test
+struct MathCase {
+	const char* name;
+	const char* backend;
+	MathInputs inputs;
+	double (*reference)(double, double);
+	void (*run)(const float* a, const float* b, float* out, int count);
+	bool relative;          // error relative to the reference (sqrt, hypot)
+};
+
+template<double (*F)(double)>
+inline void mathRun1(const float* a, const float*, float* out, int count)
+{
+	for (int i = 0; i < count; i++) out[i] = (float)F(a[i]);
+}
+
+template<double (*F)(double, double)>
+inline void mathRun2(const float* a, const float* b, float* out, int count)
+{
+	for (int i = 0; i < count; i++) out[i] = (float)F(a[i], b[i]);
+}
+
+inline double mathRefSin(double a, double) { return sin(a); }
+inline double mathRefCos(double a, double) { return cos(a); }
+inline double mathRefSqrt(double a, double) { return sqrt(a); }
+inline double mathRefAtan2(double a, double b) { return atan2(a, b); }
+inline double mathRefHypot(double a, double b) { return hypot(a, b); }
+
+#ifdef MATH_SSE2
+template<__m128 (*F)(__m128)>
+inline void mathRunPs1(const float* a, const float*, float* out, int count)
+{
+	for (int i = 0; i < count; i += 4) _mm_storeu_ps(out + i, F(_mm_loadu_ps(a + i)));
+}
+
+template<__m128 (*F)(__m128, __m128)>
+inline void mathRunPs2(const float* a, const float* b, float* out, int count)
+{
+	for (int i = 0; i < count; i += 4) _mm_storeu_ps(out + i, F(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+}
+#endif
+
+/*
+* time every backend against libm and measure its error, printed as a table
+*/
+inline void mathBenchmark()
+{
+	typedef std::chrono::steady_clock Clock;
+	const int count = 1 << 20;
+	std::vector<float> angle(count), x(count), y(count), positive(count), out(count);
+	// spread evenly, the order is shuffled by a multiplicative step
+	for (int i = 0; i < count; i++) {
+		double u = (double)(((uint64_t)i * 2654435761u) % count) / count;
+		angle[i] = (float)(-100 + 200 * u);
+		x[i] = (float)(-100 + 200 * u);
+		y[i] = (float)(-100 + 200 * (double)(((uint64_t)i * 40503u) % count) / count);
+		positive[i] = (float)(10000 * u);
+	}
+
+	const MathCase cases[] = {
+		{ "sin", "libm", MATH_IN_ANGLE, mathRefSin, mathRun1<mathSin<MATH_LIBM> >, false },
+		{ "sin", "poly", MATH_IN_ANGLE, mathRefSin, mathRun1<mathSin<MATH_POLY> >, false },
+		{ "sin", "table", MATH_IN_ANGLE, mathRefSin, mathRun1<mathSin<MATH_TABLE> >, false },
+		{ "cos", "libm", MATH_IN_ANGLE, mathRefCos, mathRun1<mathCos<MATH_LIBM> >, false },
+		{ "cos", "poly", MATH_IN_ANGLE, mathRefCos, mathRun1<mathCos<MATH_POLY> >, false },
+		{ "cos", "table", MATH_IN_ANGLE, mathRefCos, mathRun1<mathCos<MATH_TABLE> >, false },
+		{ "atan2", "libm", MATH_IN_PLANE, mathRefAtan2, mathRun2<mathAtan2<MATH_LIBM> >, false },
+		{ "atan2", "poly", MATH_IN_PLANE, mathRefAtan2, mathRun2<mathAtan2<MATH_POLY> >, false },
+		{ "atan2", "table", MATH_IN_PLANE, mathRefAtan2, mathRun2<mathAtan2<MATH_TABLE> >, false },
+		{ "sqrt", "libm", MATH_IN_POSITIVE, mathRefSqrt, mathRun1<mathSqrt<MATH_LIBM> >, true },
+		{ "sqrt", "float", MATH_IN_POSITIVE, mathRefSqrt, mathRun1<mathSqrt<MATH_POLY> >, true },
+		{ "hypot", "libm", MATH_IN_PLANE, mathRefHypot, mathRun2<mathHypot<MATH_LIBM> >, true },
+		{ "hypot", "float", MATH_IN_PLANE, mathRefHypot, mathRun2<mathHypot<MATH_POLY> >, true },
+#ifdef MATH_SSE2
+		{ "sin", "poly sse2", MATH_IN_ANGLE, mathRefSin, mathRunPs1<mathSinPs>, false },
+		{ "cos", "poly sse2", MATH_IN_ANGLE, mathRefCos, mathRunPs1<mathCosPs>, false },
+		{ "atan2", "poly sse2", MATH_IN_PLANE, mathRefAtan2, mathRunPs2<mathAtan2Ps>, false },
+		{ "sqrt", "rsqrt sse2", MATH_IN_POSITIVE, mathRefSqrt, mathRunPs1<mathSqrtFastPs>, true },
+		{ "hypot", "rsqrt sse2", MATH_IN_PLANE, mathRefHypot, mathRunPs2<mathHypotPs>, true },
+#endif
+	};
+
+	const char* inputNames[] = { "[-100, 100]", "[0, 1e4]", "[-100, 100]^2" };
+	printf("\n%-6s %-11s %-18s %10s %12s\n", "", "backend", "inputs", "ns/value", "max error");
+	for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+		const MathCase& m = cases[c];
+		const float* a = m.inputs == MATH_IN_POSITIVE ? &positive[0] : m.inputs == MATH_IN_PLANE ? &y[0] : &angle[0];
+		const float* b = &x[0];
+		// best of a few runs
+		double best = 1e30;
+		for (int rep = 0; rep < 5; rep++) {
+			Clock::time_point start = Clock::now();
+			m.run(a, b, &out[0], count);
+			double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / count;
+			if (ns < best) best = ns;
+		}
+		double worst = 0;
+		for (int i = 0; i < count; i++) {
+			double ref = m.reference(a[i], b[i]);
+			double e = fabs(out[i] - ref);
+			if (m.relative && ref != 0) e /= fabs(ref);
+			if (e > worst) worst = e;
+		}
+		printf("%-6s %-11s %-18s %10.2f %12.2e%s\n", m.name, m.backend,
+			inputNames[m.inputs], best, worst, m.relative ? " rel" : "");
+	}
+}
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef __FIXED_H_
+#define __FIXED_H_
+
+// Typed fixed point numbers.
+// Fixed<I, F> is a number with I integer bits (sign included) and F
+// fractional bits kept in a plain integer, so the format is part of the type
+// instead of a shift repeated at every use, and mixing two formats needs an
+// explicit conversion. Products and quotients of two numbers go through 64
+// bits. Debug builds check that every result still fits in the I + F bits of
+// its format and stop on the first one that does not; with NDEBUG the checks
+// are gone and all that is left are the integer operations the effects used
+// to write by hand.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef NDEBUG
+#define FIXED_CHECKS 1
+#endif
+
+// raw integer of a format: 32 bits, 64 when it does not fit
+template<int Bits, bool Wide = (Bits > 32)> struct FixedRaw { typedef int32_t type; };
+template<int Bits> struct FixedRaw<Bits, true> { typedef int64_t type; };
+
+inline void fixedOverflow(const char* op, int intBits, int fracBits, int64_t raw)
+{
+	fprintf(stderr, "fixed point overflow: %s gives %lld/%lld, out of %d.%d\n", op,
+		(long long)raw, (long long)1 << fracBits, intBits, fracBits);
+	abort();
+}
+
+template<int I, int F, class Raw = typename FixedRaw<I + F>::type>
+struct Fixed {
+	static_assert(I > 0 && F >= 0 && I + F <= 8 * (int)sizeof(Raw), "the format does not fit its raw type");
+
+	Raw raw;
+
+	static constexpr int64_t one = (int64_t)1 << F;
+	static constexpr int64_t rawMin = -((int64_t)1 << (I + F - 1));
+	static constexpr int64_t rawMax = ((int64_t)1 << (I + F - 1)) - 1;
+
+	/*
+	* the number with raw value r, result of the operation op
+	*/
+	static constexpr Fixed make(int64_t r, const char* op)
+	{
+#ifdef FIXED_CHECKS
+		if (r < rawMin || r > rawMax) fixedOverflow(op, I, F, r);
+#endif
+		Fixed x{};
+		x.raw = (Raw)r;
+		return x;
+	}
+
+	static constexpr Fixed fromRaw(int64_t r) { return make(r, "fromRaw"); }
+	static constexpr Fixed fromInt(int v) { return make((int64_t)v * one, "fromInt"); }
+	// truncated toward zero, like the casts it replaces
+	static constexpr Fixed fromDouble(double v) { return make((int64_t)(v * one), "fromDouble"); }
+
+	/*
+	* the same number in another format, the lost fractional bits are floored
+	*/
+	template<int I2, int F2, class R2>
+	static constexpr Fixed from(Fixed<I2, F2, R2> x)
+	{
+		return make(F >= F2 ? (int64_t)x.raw * ((int64_t)1 << (F >= F2 ? F - F2 : 0))
+			: (int64_t)x.raw >> (F2 >= F ? F2 - F : 0), "from");
+	}
+
+	// floor, as the shifts it replaces
+	constexpr int toInt() const { return (int)(raw >> F); }
+	// the fractional bits, 0 .. one - 1 also for negative numbers
+	constexpr int frac() const { return (int)(raw & (Raw)(one - 1)); }
+	// the top Bits of the fraction, an interpolation weight of that many bits
+	template<int Bits> constexpr int fracHigh() const
+	{
+		static_assert(Bits > 0 && Bits <= F, "not that many fractional bits");
+		return (int)((raw >> (F - Bits)) & ((1 << Bits) - 1));
+	}
+	constexpr double toDouble() const { return (double)raw / one; }
+
+	constexpr Fixed operator+(Fixed b) const { return make((int64_t)raw + b.raw, "+"); }
+	constexpr Fixed operator-(Fixed b) const { return make((int64_t)raw - b.raw, "-"); }
+	constexpr Fixed operator-() const { return make(-(int64_t)raw, "negate"); }
+	constexpr Fixed operator*(int k) const { return make((int64_t)raw * k, "* int"); }
+	constexpr Fixed operator/(int k) const { return make((int64_t)raw / k, "/ int"); }
+	constexpr Fixed operator*(Fixed b) const { return make(((int64_t)raw * b.raw) >> F, "*"); }
+	constexpr Fixed operator/(Fixed b) const { return make((int64_t)raw * one / b.raw, "/"); }
+
+	Fixed& operator+=(Fixed b) { return *this = *this + b; }
+	Fixed& operator-=(Fixed b) { return *this = *this - b; }
+	Fixed& operator*=(int k) { return *this = *this * k; }
+	Fixed& operator/=(int k) { return *this = *this / k; }
+
+	constexpr bool operator==(Fixed b) const { return raw == b.raw; }
+	constexpr bool operator!=(Fixed b) const { return raw != b.raw; }
+	constexpr bool operator<(Fixed b) const { return raw < b.raw; }
+	constexpr bool operator>(Fixed b) const { return raw > b.raw; }
+	constexpr bool operator<=(Fixed b) const { return raw <= b.raw; }
+	constexpr bool operator>=(Fixed b) const { return raw >= b.raw; }
+};
+
+template<int I, int F, class Raw>
+constexpr Fixed<I, F, Raw> operator*(int k, Fixed<I, F, Raw> x) { return x * k; }
+
+// texture coordinates and screen positions
+typedef Fixed<16, 16> Fixed16_16;
+// depths: 12.4, kept in the 16 bit zbuffers once known to be positive
+typedef Fixed<13, 4> FixedDepth;
+// distortion displacements, one byte each
+typedef Fixed<5, 3, int8_t> Fixed5_3;
+// sampler coordinates: texels and 8 bits of position inside the texel
+typedef Fixed<24, 8> FixedTexel;
+
+#endif
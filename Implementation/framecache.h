@@ -0,0 +1,493 @@
+#ifndef __FRAMECACHE_H_
+#define __FRAMECACHE_H_
+
+// Frame cache for deterministic clips.
+// With the fixed clock a clip (one showing of an effect) renders the same
+// frames on every run, so the first run records them and later runs
+// decompress them instead of rendering. Every frame is stored as the XOR
+// against the previous one (mostly zeros) compressed with LZ4, with a plain
+// key frame every FRAME_CACHE_KEY_INTERVAL frames so a clip can also be
+// entered in the middle. One file per clip, named after the hash of the
+// clip parameters, read through a memory mapping.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <direct.h>
+#endif
+
+// bump when the effects or the key change so old recordings are not used,
+// the caller can also put a version of each effect in the params
+#define FRAME_CACHE_VERSION 4
+#define FRAME_CACHE_KEY_INTERVAL 30
+
+
+// LZ4 BLOCK FORMAT
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5     // the block always ends with this many literals
+#define LZ4_MF_LIMIT 12         // no match may start closer than this to the end
+#define LZ4_HASH_LOG 14
+
+inline int lz4CompressBound(int size)
+{
+	return size + size / 255 + 16;
+}
+
+inline uint32_t lz4Read32(const unsigned char* p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+inline unsigned char* lz4WriteLength(unsigned char* op, int length)
+{
+	for (; length >= 255; length -= 255) *op++ = 255;
+	*op++ = (unsigned char)length;
+	return op;
+}
+
+/*
+* compress src into dst, which must hold lz4CompressBound(srcSize) bytes.
+* returns the compressed size
+*/
+inline int lz4Compress(const unsigned char* src, int srcSize, unsigned char* dst)
+{
+	std::vector<int> table(1 << LZ4_HASH_LOG, -1);
+	unsigned char* op = dst;
+	int anchor = 0, ip = 0;
+
+	if (srcSize > LZ4_MF_LIMIT) {
+		const int limit = srcSize - LZ4_MF_LIMIT;
+		const int matchLimit = srcSize - LZ4_LAST_LITERALS;
+		while (ip < limit) {
+			uint32_t sequence = lz4Read32(src + ip);
+			uint32_t h = (sequence * 2654435761u) >> (32 - LZ4_HASH_LOG);
+			int ref = table[h];
+			table[h] = ip;
+			if (ref < 0 || ip - ref > 65535 || lz4Read32(src + ref) != sequence) {
+				// skip faster over data that does not compress
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+			int length = LZ4_MIN_MATCH;
+			while (ip + length < matchLimit && src[ref + length] == src[ip + length]) length++;
+
+			// token, literals, offset, match length
+			int literals = ip - anchor;
+			unsigned char* token = op++;
+			*token = (unsigned char)((literals >= 15 ? 15 : literals) << 4);
+			if (literals >= 15) op = lz4WriteLength(op, literals - 15);
+			memcpy(op, src + anchor, literals);
+			op += literals;
+			int offset = ip - ref;
+			*op++ = (unsigned char)offset;
+			*op++ = (unsigned char)(offset >> 8);
+			int extra = length - LZ4_MIN_MATCH;
+			*token |= (unsigned char)(extra >= 15 ? 15 : extra);
+			if (extra >= 15) op = lz4WriteLength(op, extra - 15);
+
+			ip += length;
+			anchor = ip;
+		}
+	}
+
+	// last literals
+	int literals = srcSize - anchor;
+	*op++ = (unsigned char)((literals >= 15 ? 15 : literals) << 4);
+	if (literals >= 15) op = lz4WriteLength(op, literals - 15);
+	memcpy(op, src + anchor, literals);
+	op += literals;
+	return (int)(op - dst);
+}
+
+/*
+* decompress a block, never writing past dstSize. returns the decompressed
+* size, or -1 if the block is corrupt
+*/
+inline int lz4Decompress(const unsigned char* src, int srcSize, unsigned char* dst, int dstSize)
+{
+	int ip = 0, op = 0;
+	while (ip < srcSize) {
+		int token = src[ip++];
+		int literals = token >> 4;
+		if (literals == 15) {
+			int b;
+			do {
+				if (ip >= srcSize) return -1;
+				b = src[ip++];
+				literals += b;
+			} while (b == 255);
+		}
+		if (literals > srcSize - ip || literals > dstSize - op) return -1;
+		memcpy(dst + op, src + ip, literals);
+		ip += literals;
+		op += literals;
+		// the last sequence has no match
+		if (ip >= srcSize) break;
+
+		if (ip + 2 > srcSize) return -1;
+		int offset = src[ip] | (src[ip + 1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op) return -1;
+		int length = token & 15;
+		if (length == 15) {
+			int b;
+			do {
+				if (ip >= srcSize) return -1;
+				b = src[ip++];
+				length += b;
+			} while (b == 255);
+		}
+		length += LZ4_MIN_MATCH;
+		if (length > dstSize - op) return -1;
+		unsigned char* d = dst + op;
+		const unsigned char* s = d - offset;
+		if (offset == 1) memset(d, *s, length);
+		else if (offset >= length) memcpy(d, s, length);
+		else for (int n = 0; n < length; n++) d[n] = s[n];
+		op += length;
+	}
+	return op;
+}
+
+
+// CACHE FILES
+
+struct FrameCacheHeader {
+	char magic[4];          // "DFC1"
+	uint32_t version;
+	uint64_t key;
+	int32_t width, height;
+	int32_t frames;
+	int32_t keyInterval;
+	// followed by frames + 1 uint64_t offsets of the blocks from the start of the file
+};
+
+// a read only view of a whole file
+struct FrameCacheMap {
+	const unsigned char* data;
+	size_t size;
+	std::vector<unsigned char> copy;    // where there is no mmap
+};
+
+struct FrameCacheStats {
+	int clipHits, clipMisses, clipsWritten;
+	int framesFetched, framesRendered;
+	uint64_t compressedBytes, decompressedBytes, bytesWritten;
+	double decodeSeconds;
+};
+
+FrameCacheStats frameCacheStats;
+
+// the clip being played or recorded
+struct FrameCache {
+	int clip;               // id given by the caller, -1 when none
+	uint64_t key;
+	std::string path;
+	int width, height, frames;
+	// playing
+	bool hit;
+	FrameCacheMap map;
+	int decoded;            // frame held in prev, -1 if none
+	// recording
+	bool recording;
+	int recorded;
+	std::vector<unsigned char> blocks;
+	std::vector<uint64_t> offsets;
+	std::vector<uint32_t> prev, packed;
+	std::vector<unsigned char> scratch;
+
+	FrameCache() : clip(-1), key(0), width(0), height(0), frames(0), hit(false), decoded(-1), recording(false), recorded(0)
+	{
+		map.data = NULL;
+		map.size = 0;
+	}
+};
+
+/*
+* FNV-1a of the clip parameters
+*/
+inline uint64_t frameCacheHash(const char* text)
+{
+	uint64_t h = 14695981039346656037ull;
+	for (; *text; text++) {
+		h ^= (unsigned char)*text;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+inline bool frameCacheMapFile(FrameCacheMap& map, const char* path)
+{
+#ifdef __linux__
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return false;
+	map.data = (const unsigned char*)p;
+	map.size = (size_t)st.st_size;
+	return true;
+#else
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) return false;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size <= 0) {
+		fclose(f);
+		return false;
+	}
+	map.copy.resize((size_t)size);
+	bool ok = fread(&map.copy[0], 1, (size_t)size, f) == (size_t)size;
+	fclose(f);
+	if (!ok) return false;
+	map.data = &map.copy[0];
+	map.size = (size_t)size;
+	return true;
+#endif
+}
+
+inline void frameCacheUnmap(FrameCacheMap& map)
+{
+#ifdef __linux__
+	if (map.data != NULL) munmap((void*)map.data, map.size);
+#endif
+	map.copy.clear();
+	map.data = NULL;
+	map.size = 0;
+}
+
+inline const FrameCacheHeader* frameCacheHeader(const FrameCache& c)
+{
+	return (const FrameCacheHeader*)c.map.data;
+}
+
+inline const uint64_t* frameCacheOffsets(const FrameCache& c)
+{
+	return (const uint64_t*)(c.map.data + sizeof(FrameCacheHeader));
+}
+
+/*
+* check that a mapped file is a complete recording of this clip
+*/
+inline bool frameCacheValid(const FrameCache& c)
+{
+	if (c.map.size < sizeof(FrameCacheHeader)) return false;
+	const FrameCacheHeader* h = frameCacheHeader(c);
+	if (memcmp(h->magic, "DFC1", 4) != 0 || h->version != FRAME_CACHE_VERSION || h->key != c.key) return false;
+	if (h->width != c.width || h->height != c.height || h->frames != c.frames || h->keyInterval != FRAME_CACHE_KEY_INTERVAL) return false;
+	size_t table = sizeof(FrameCacheHeader) + (c.frames + 1) * sizeof(uint64_t);
+	if (c.map.size < table) return false;
+	const uint64_t* offsets = frameCacheOffsets(c);
+	for (int n = 0; n < c.frames; n++) {
+		if (offsets[n] < table || offsets[n + 1] < offsets[n]) return false;
+	}
+	return offsets[c.frames] <= c.map.size;
+}
+
+/*
+* drop the current clip. an unfinished recording is thrown away
+*/
+inline void frameCacheEnd(FrameCache& c)
+{
+	frameCacheUnmap(c.map);
+	c.clip = -1;
+	c.hit = false;
+	c.recording = false;
+	c.blocks.clear();
+	c.offsets.clear();
+}
+
+/*
+* start a clip: play it from dir if it was recorded with the same params,
+* otherwise record it (only possible when starting at its first frame)
+*/
+inline void frameCacheBegin(FrameCache& c, const char* dir, const char* params, int clip, int width, int height, int frames, bool fromStart)
+{
+	frameCacheEnd(c);
+	c.clip = clip;
+	c.width = width;
+	c.height = height;
+	c.frames = frames;
+	char text[512];
+	snprintf(text, sizeof(text), "%s/%dx%d/%d/v%d", params, width, height, frames, FRAME_CACHE_VERSION);
+	c.key = frameCacheHash(text);
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.dfc", (unsigned long long)c.key);
+	c.path = std::string(dir) + name;
+	c.prev.assign((size_t)width * height, 0);
+	c.packed.resize((size_t)width * height);
+	c.scratch.resize(lz4CompressBound(width * height * 4));
+	c.decoded = -1;
+
+	if (frameCacheMapFile(c.map, c.path.c_str()) && frameCacheValid(c)) {
+		c.hit = true;
+		frameCacheStats.clipHits++;
+		return;
+	}
+	frameCacheUnmap(c.map);
+	frameCacheStats.clipMisses++;
+	c.recording = fromStart;
+	c.recorded = 0;
+}
+
+inline void frameCacheDecode(FrameCache& c, int index)
+{
+	const uint64_t* offsets = frameCacheOffsets(c);
+	const unsigned char* block = c.map.data + offsets[index];
+	int size = (int)(offsets[index + 1] - offsets[index]);
+	int bytes = c.width * c.height * 4;
+	if (lz4Decompress(block, size, (unsigned char*)&c.packed[0], bytes) != bytes) {
+		// corrupt, fall back to rendering from here on
+		c.hit = false;
+		return;
+	}
+	if (index % FRAME_CACHE_KEY_INTERVAL == 0) {
+		c.prev.swap(c.packed);
+	}
+	else {
+		for (size_t n = 0; n < c.prev.size(); n++) c.prev[n] ^= c.packed[n];
+	}
+	c.decoded = index;
+	frameCacheStats.compressedBytes += size;
+	frameCacheStats.decompressedBytes += bytes;
+}
+
+/*
+* copy frame index of the clip into pixels. false if the clip is not
+* cached, then the caller renders it
+*/
+inline bool frameCacheFetch(FrameCache& c, int index, void* pixels, int pitch)
+{
+	if (!c.hit || index < 0 || index >= c.frames) return false;
+	auto start = std::chrono::steady_clock::now();
+	if (c.decoded != index - 1 || index % FRAME_CACHE_KEY_INTERVAL == 0) {
+		// jump: start again from the key frame
+		int key = index - index % FRAME_CACHE_KEY_INTERVAL;
+		for (int n = key; n < index && c.hit; n++) frameCacheDecode(c, n);
+	}
+	if (c.hit) frameCacheDecode(c, index);
+	if (!c.hit) return false;
+	for (int j = 0; j < c.height; j++) {
+		memcpy((unsigned char*)pixels + j * pitch, &c.prev[(size_t)j * c.width], c.width * 4);
+	}
+	frameCacheStats.decodeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	frameCacheStats.framesFetched++;
+	return true;
+}
+
+inline bool frameCacheWrite(FrameCache& c)
+{
+	FrameCacheHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "DFC1", 4);
+	h.version = FRAME_CACHE_VERSION;
+	h.key = c.key;
+	h.width = c.width;
+	h.height = c.height;
+	h.frames = c.frames;
+	h.keyInterval = FRAME_CACHE_KEY_INTERVAL;
+	uint64_t base = sizeof(h) + (c.frames + 1) * sizeof(uint64_t);
+	for (size_t n = 0; n < c.offsets.size(); n++) c.offsets[n] += base;
+	c.offsets.push_back(base + c.blocks.size());
+
+	// written aside and renamed, so a reader never maps half a file
+	std::string temp = c.path + ".tmp";
+	FILE* f = fopen(temp.c_str(), "wb");
+	if (f == NULL) return false;
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+		&& fwrite(&c.offsets[0], sizeof(uint64_t), c.offsets.size(), f) == c.offsets.size()
+		&& fwrite(&c.blocks[0], 1, c.blocks.size(), f) == c.blocks.size();
+	ok = (fclose(f) == 0) && ok;
+	if (ok) {
+		remove(c.path.c_str());
+		ok = rename(temp.c_str(), c.path.c_str()) == 0;
+	}
+	if (!ok) remove(temp.c_str());
+	else {
+		frameCacheStats.clipsWritten++;
+		frameCacheStats.bytesWritten += base + c.blocks.size();
+	}
+	return ok;
+}
+
+/*
+* hand a rendered frame to the cache. recorded when the clip is being
+* recorded from its start, written out after its last frame
+*/
+inline void frameCacheStore(FrameCache& c, int index, const void* pixels, int pitch)
+{
+	frameCacheStats.framesRendered++;
+	if (!c.recording) return;
+	if (index != c.recorded) {
+		// frames missing, this recording would be incomplete
+		c.recording = false;
+		return;
+	}
+	for (int j = 0; j < c.height; j++) {
+		memcpy(&c.packed[(size_t)j * c.width], (const unsigned char*)pixels + j * pitch, c.width * 4);
+	}
+	if (index % FRAME_CACHE_KEY_INTERVAL == 0) {
+		c.prev = c.packed;
+	}
+	else {
+		// delta against the previous frame, and keep this one for the next
+		for (size_t n = 0; n < c.prev.size(); n++) {
+			uint32_t p = c.packed[n];
+			c.packed[n] ^= c.prev[n];
+			c.prev[n] = p;
+		}
+	}
+	int size = lz4Compress((const unsigned char*)&c.packed[0], c.width * c.height * 4, &c.scratch[0]);
+	c.offsets.push_back(c.blocks.size());
+	c.blocks.insert(c.blocks.end(), c.scratch.begin(), c.scratch.begin() + size);
+	c.recorded++;
+	if (c.recorded == c.frames) {
+		if (!frameCacheWrite(c)) printf("Unable to write frame cache %s!\n", c.path.c_str());
+		c.recording = false;
+		c.blocks.clear();
+		c.offsets.clear();
+	}
+}
+
+inline void frameCacheMakeDir(const char* dir)
+{
+#ifdef __linux__
+	mkdir(dir, 0755);
+#elif defined(_WIN32)
+	_mkdir(dir);
+#endif
+}
+
+inline void frameCacheReport(FILE* out)
+{
+	const FrameCacheStats& s = frameCacheStats;
+	fprintf(out, "frame cache: clips %d hit, %d missed, %d recorded (%.1f MB written)\n", s.clipHits, s.clipMisses,
+		s.clipsWritten, s.bytesWritten / (1024.0 * 1024.0));
+	fprintf(out, "frame cache: frames %d from cache, %d rendered", s.framesFetched, s.framesRendered);
+	if (s.decompressedBytes > 0 && s.decodeSeconds > 0) {
+		fprintf(out, ", ratio %.1f:1, decompression %.0f MB/s, %.3f ms/frame", (double)s.decompressedBytes / s.compressedBytes,
+			s.decompressedBytes / (1024.0 * 1024.0) / s.decodeSeconds, 1000.0 * s.decodeSeconds / s.framesFetched);
+	}
+	fprintf(out, "\n");
+}
+
+#endif
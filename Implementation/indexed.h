@@ -0,0 +1,88 @@
+#ifndef __INDEXED_H_
+#define __INDEXED_H_
+
+// Palette indexed rendering.
+// The 8 bit effects (plasma, fire, the fractal zoom) only write palette
+// indices into an IndexedFrame; one shared pass then resolves the whole
+// frame into 32 bit pixels through a packed 256 entry palette, with the
+// paletteResolve kernel. Animating the colours rewrites the 1 KB palette
+// and nothing else, and a frame of indices can be resolved again through
+// another palette (cycling, fades) without drawing it again.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "kernels.h"
+#include "memtrack.h"
+
+struct IndexedFrame {
+	unsigned char* pixels;
+	int width, height;
+	int pitch;              // in bytes
+};
+
+inline uint32_t palettePack(int r, int g, int b)
+{
+	return 0xFF000000u | ((uint32_t)r << 16) | ((uint32_t)g << 8) | (uint32_t)b;
+}
+
+/*
+* a frame of width x height indices, reallocated only when the size changes.
+* it is rewritten in full every frame, so it is a plain block: no zeroing,
+* and no huge page table slot
+*/
+inline void indexedEnsure(IndexedFrame& frame, const char* owner, int width, int height)
+{
+	if (frame.pixels != NULL && frame.width == width && frame.height == height) return;
+	memFree(frame.pixels);
+	frame.pixels = (unsigned char*)memAlloc(owner, (size_t)width * height);
+	frame.width = width;
+	frame.height = height;
+	frame.pitch = width;
+}
+
+inline void indexedFree(IndexedFrame& frame)
+{
+	memFree(frame.pixels);
+	frame.pixels = NULL;
+	frame.width = frame.height = frame.pitch = 0;
+}
+
+/*
+* the frame through the palette into dst, pitch in pixels
+*/
+inline void indexedResolve(const IndexedFrame& frame, const uint32_t* palette, uint32_t* dst, int pitch)
+{
+	for (int j = 0; j < frame.height; j++) {
+		kernels.paletteResolve(dst + (size_t)j * pitch, frame.pixels + (size_t)j * frame.pitch, palette, frame.width);
+	}
+}
+
+/*
+* dst[i] = a[i] + b[i] wrapping at 256, eight indices at a time: the low
+* seven bits of each byte are added apart and the top bits put back with
+* a xor, so no carry crosses into the next index
+*/
+inline void indexedAdd(unsigned char* dst, const unsigned char* a, const unsigned char* b, int count)
+{
+	const uint64_t low = 0x7F7F7F7F7F7F7F7Full;
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		uint64_t x, y;
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + i, 8);
+		const uint64_t r = ((x & low) + (y & low)) ^ ((x ^ y) & ~low);
+		memcpy(dst + i, &r, 8);
+	}
+	for (; i < count; i++) dst[i] = (unsigned char)(a[i] + b[i]);
+}
+
+/*
+* palette cycling: entry i of dst is entry (i + shift) & 255 of src
+*/
+inline void paletteCycle(const uint32_t* src, uint32_t* dst, int shift)
+{
+	for (int i = 0; i < 256; i++) dst[i] = src[(i + shift) & 255];
+}
+
+#endif
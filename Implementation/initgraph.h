@@ -0,0 +1,170 @@
+#ifndef __INITGRAPH_H_
+#define __INITGRAPH_H_
+
+// Startup task graph.
+// Every task names the tasks it needs. A task is started as soon as the last
+// of them finishes: on the thread pool, or on the thread calling initRun()
+// for the ones that must stay there (SDL video, audio). That thread also
+// runs pool tasks while it has nothing of its own. A task that fails skips
+// everything depending on it. Start and end of every task are kept for the
+// startup breakdown.
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include <stdio.h>
+
+#include "threadpool.h"
+#include "trace.h"
+
+enum InitState {
+	INIT_WAITING,
+	INIT_DONE,
+	INIT_FAILED,
+	INIT_SKIPPED            // something it needs failed
+};
+
+struct InitTask {
+	const char* name;       // a string literal, it ends up in the trace
+	std::vector<int> after;
+	std::function<bool()> run;
+	bool mainThread;
+	InitState state;
+	double startMs, endMs;  // since initRun() started
+	int thread;             // 0 the calling thread, n pool worker n
+};
+
+struct InitGraph {
+	std::vector<InitTask> tasks;
+	double wallMs = 0;
+};
+
+/*
+* add a task that runs after the given ones, returns its index
+*/
+inline int initAdd(InitGraph& g, const char* name, std::vector<int> after, std::function<bool()> run, bool mainThread = false)
+{
+	InitTask t;
+	t.name = name;
+	t.after = after;
+	t.run = run;
+	t.mainThread = mainThread;
+	t.state = INIT_WAITING;
+	t.startMs = t.endMs = 0;
+	t.thread = 0;
+	g.tasks.push_back(t);
+	return (int)g.tasks.size() - 1;
+}
+
+/*
+* run the whole graph. true when every task succeeded
+*/
+inline bool initRun(InitGraph& g, ThreadPool& pool)
+{
+	typedef std::chrono::steady_clock Clock;
+	const Clock::time_point start = Clock::now();
+	const int count = (int)g.tasks.size();
+	std::vector<int> waitingFor(count);
+	std::vector<std::vector<int> > dependents(count);
+	for (int n = 0; n < count; n++) {
+		waitingFor[n] = (int)g.tasks[n].after.size();
+		for (size_t d = 0; d < g.tasks[n].after.size(); d++) dependents[g.tasks[n].after[d]].push_back(n);
+	}
+
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<int> mainReady;
+	int unfinished = count;
+
+	std::function<void(int)> release;
+	// run a task and release the ones waiting for it
+	auto execute = [&](int n) {
+		InitTask& t = g.tasks[n];
+		t.thread = poolThreadIndex;
+		t.startMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		bool ok;
+		{
+			TraceZone zone(t.name);
+			ok = t.run();
+		}
+		t.endMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		std::lock_guard<std::mutex> guard(lock);
+		t.state = ok ? INIT_DONE : INIT_FAILED;
+		release(n);
+	};
+	// with the lock held: a task finished, start whatever it unblocked
+	release = [&](int n) {
+		unfinished--;
+		for (size_t d = 0; d < dependents[n].size(); d++) {
+			int next = dependents[n][d];
+			if (g.tasks[n].state != INIT_DONE) g.tasks[next].state = INIT_SKIPPED;
+			if (--waitingFor[next] > 0) continue;
+			if (g.tasks[next].state == INIT_SKIPPED) release(next);
+			else if (g.tasks[next].mainThread) mainReady.push_back(next);
+			else poolSubmit(pool, [&execute, next]() { execute(next); });
+		}
+		changed.notify_all();
+	};
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (int n = 0; n < count; n++) {
+			if (waitingFor[n] > 0) continue;
+			if (g.tasks[n].mainThread) mainReady.push_back(n);
+			else poolSubmit(pool, [&execute, n]() { execute(n); });
+		}
+	}
+	std::unique_lock<std::mutex> guard(lock);
+	while (unfinished > 0) {
+		if (!mainReady.empty()) {
+			int n = mainReady.front();
+			mainReady.pop_front();
+			guard.unlock();
+			execute(n);
+			guard.lock();
+			continue;
+		}
+		guard.unlock();
+		bool helped = poolTryRunOne(pool);
+		guard.lock();
+		// a worker may finish a task right after the check, do not sleep long
+		if (!helped && unfinished > 0 && mainReady.empty()) changed.wait_for(guard, std::chrono::milliseconds(1));
+	}
+	guard.unlock();
+	poolWait(pool);
+
+	g.wallMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	for (int n = 0; n < count; n++) {
+		if (g.tasks[n].state != INIT_DONE) return false;
+	}
+	return true;
+}
+
+/*
+* per task breakdown, in order of start
+*/
+inline void initReport(const InitGraph& g)
+{
+	std::vector<int> order;
+	for (int n = 0; n < (int)g.tasks.size(); n++) order.push_back(n);
+	for (size_t i = 1; i < order.size(); i++) {
+		for (size_t k = i; k > 0 && g.tasks[order[k]].startMs < g.tasks[order[k - 1]].startMs; k--) {
+			std::swap(order[k], order[k - 1]);
+		}
+	}
+	const char* states[] = { "waiting", "ok", "FAILED", "skipped" };
+	double work = 0;
+	printf("\n%-20s %7s %10s %10s %8s\n", "startup task", "thread", "start ms", "ms", "");
+	for (size_t i = 0; i < order.size(); i++) {
+		const InitTask& t = g.tasks[order[i]];
+		double ms = t.endMs - t.startMs;
+		work += ms;
+		printf("%-20s %7d %10.1f %10.1f %8s\n", t.name, t.thread, t.startMs, ms, states[t.state]);
+	}
+	printf("startup: %.1f ms for %.1f ms of work (%.2fx)\n", g.wallMs, work, g.wallMs > 0 ? work / g.wallMs : 0.0);
+}
+
+#endif
@@ -0,0 +1,1045 @@
+#ifndef __KERNELS_H_
+#define __KERNELS_H_
+
+// Hot inner loops of the effects, with one implementation per instruction
+// set. The CPU is probed once at startup (kernelsInit) and every entry of
+// the kernels table is bound to the best variant the CPU can run, so one
+// binary runs everywhere. The scalar variants are the reference code the
+// effects used to have inline.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fixed.h"
+#include "rng.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define KERNELS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// msvc compiles any intrinsic anywhere, gcc and clang need the function to
+// be built for the instruction set it uses
+#if defined(KERNELS_X86) && (defined(__GNUC__) || defined(__clang__))
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define KERNEL_TARGET(isa)
+#endif
+
+enum KernelIsa {
+	ISA_SCALAR,
+	ISA_SSE2,
+	ISA_AVX2,
+	ISA_AVX512,
+	ISA_COUNT
+};
+
+const char* isaNames[ISA_COUNT] = { "scalar", "sse2", "avx2", "avx512" };
+
+// interpolants of one horizontal span of the textured torus. the span is
+// already clipped to the screen
+struct SpanSetup {
+	int count;
+	FixedDepth z, dz;
+	Fixed16_16 tx, dtx, ty, dty;    // static texture
+	Fixed16_16 px, dpx, py, dpy;    // light map
+};
+
+// how the texels of a sampler texture are stored: rows of pitch texels;
+// 4x4 tiles of one 64 byte cache line each, a row of tiles every 4 rows of
+// pitch texels; or Morton order, x and y bits interleaved, for square power
+// of two textures
+enum SamplerLayout { SAMPLER_LINEAR, SAMPLER_TILED, SAMPLER_MORTON, SAMPLER_LAYOUT_COUNT };
+
+const char* samplerLayoutNames[SAMPLER_LAYOUT_COUNT] = { "linear", "tiled", "morton" };
+
+// a packed ARGB texture for the sampler, pitch in pixels. wrapping needs
+// power of two sizes, tiles sizes that are multiples of 4
+struct SamplerTexture {
+	const uint32_t* pixels;
+	int width, height, pitch;
+	SamplerLayout layout;
+};
+
+enum SamplerFilter { SAMPLER_NEAREST, SAMPLER_BILINEAR };
+// what the texels outside the texture are: the texture repeated, the
+// nearest texel of the border, or transparent black
+enum SamplerAddress { SAMPLER_WRAP, SAMPLER_CLAMP, SAMPLER_BORDER };
+
+typedef void (*PlasmaRowFn)(uint32_t* dst, const unsigned char* src1, const unsigned char* src2, const uint32_t* palette, int count);
+typedef void (*FireBlurFn)(const unsigned char* src, unsigned char* dst, int width, int height);
+typedef void (*SampleRowFn)(uint32_t* dst, const SamplerTexture& texture, const FixedTexel* u, const FixedTexel* v,
+	int count, SamplerFilter filter, SamplerAddress address);
+typedef void (*MandelbrotRowFn)(unsigned char* dst, double pr, double dr, double pi, int count);
+typedef void (*SpanFillFn)(uint32_t* dst, unsigned short* zbuffer, const SpanSetup& span,
+	const uint32_t* texture, int texturePitch, const unsigned char* light);
+typedef void (*RngFillFn)(uint32_t* dst, int count, RngLanes& lanes);
+typedef void (*TransformSoaFn)(const float* m, const float* x, const float* y, const float* z,
+	float* ox, float* oy, float* oz, int count);
+typedef void (*PaletteResolveFn)(uint32_t* dst, const unsigned char* src, const uint32_t* palette, int count);
+
+// the table the effects call through
+struct KernelTable {
+	PlasmaRowFn plasmaRow;
+	FireBlurFn fireBlur;
+	SampleRowFn sampleRow;
+	MandelbrotRowFn mandelbrotRow;
+	SpanFillFn spanFill;
+	RngFillFn rngFill;
+	TransformSoaFn transformSoa;
+	PaletteResolveFn paletteResolve;
+};
+
+KernelTable kernels;
+
+// instruction set each kernel ended up with, for the reports
+enum KernelId { KERNEL_PLASMA_ROW, KERNEL_FIRE_BLUR, KERNEL_SAMPLE_ROW, KERNEL_MANDELBROT_ROW, KERNEL_SPAN_FILL, KERNEL_RNG_FILL, KERNEL_TRANSFORM_SOA, KERNEL_PALETTE_RESOLVE, KERNEL_COUNT };
+const char* kernelNames[KERNEL_COUNT] = { "plasmaRow", "fireBlur", "sampleRow", "mandelbrotRow", "spanFill", "rngFill", "transformSoa", "paletteResolve" };
+KernelIsa kernelBoundIsa[KERNEL_COUNT];
+
+// instruction set the table was bound for
+KernelIsa kernelsIsa = ISA_SCALAR;
+
+
+// SCALAR REFERENCE KERNELS
+
+/*
+* plasma: sum the two plasma functions and look the colour up
+*/
+inline void plasmaRowScalar(uint32_t* dst, const unsigned char* src1, const unsigned char* src2, const uint32_t* palette, int count)
+{
+	for (int i = 0; i < count; i++) {
+		dst[i] = palette[(src1[i] + src2[i]) % 256];
+	}
+}
+
+/*
+* fire: smooth a buffer upwards, make sure not to read pixels that are
+* outside of the buffer!
+*/
+inline void fireBlurScalar(const unsigned char* src, unsigned char* dst, int width, int height)
+{
+	int offs = 0;
+	for (int j = 0; j < (height - 2); j++)
+	{
+		// set first pixel of the line to 0
+		dst[offs] = 0; offs++;
+		// calculate the filter for all the other pixels
+		for (int i = 1; i < (width - 1); i++)
+		{
+			// calculate the average
+			dst[offs] = (unsigned char)((src[offs - 1] + src[offs + 1]
+				+ src[offs + (width - 1)] + src[offs + width] + src[offs + (width + 1)]
+				+ src[offs + ((width * 2) - 1)] + src[offs + (width * 2)] + src[offs + ((width * 2) + 1)]) / 8);
+			offs++;
+		}
+		// set last pixel of the line to 0
+		dst[offs] = 0; offs++;
+	}
+	// clear the last 2 lines
+	memset(dst + offs, 0, width * 2);
+}
+
+/*
+* sampler: lerp two packed ARGB texels with an 8 bit weight f, two channels
+* per 32 bit lane. a channel times a weight of at most 256 stays under 16
+* bits, so 0x00RR00BB and 0x00AA00GG are each lerped with one multiply
+*/
+inline uint32_t samplerLerp(uint32_t a, uint32_t b, int f)
+{
+	uint32_t rb = ((a & 0x00FF00FF) * (256 - f) + (b & 0x00FF00FF) * f) >> 8;
+	uint32_t ag = (((a >> 8) & 0x00FF00FF) * (256 - f) + ((b >> 8) & 0x00FF00FF) * f) >> 8;
+	return (rb & 0x00FF00FF) | ((ag & 0x00FF00FF) << 8);
+}
+
+// the bits of x, below 65536, spread to the even bits
+inline uint32_t samplerSpread(uint32_t x)
+{
+	x = (x | (x << 8)) & 0x00FF00FF;
+	x = (x | (x << 4)) & 0x0F0F0F0F;
+	x = (x | (x << 2)) & 0x33333333;
+	return (x | (x << 1)) & 0x55555555;
+}
+
+/*
+* sampler: where texel (x, y), inside the texture, is stored
+*/
+template <SamplerLayout L>
+inline int samplerOffset(const SamplerTexture& t, int x, int y)
+{
+	if (L == SAMPLER_TILED) return (y & ~3) * t.pitch + ((x & ~3) << 2) + ((y & 3) << 2) + (x & 3);
+	if (L == SAMPLER_MORTON) return (int)(samplerSpread(x) | (samplerSpread(y) << 1));
+	return y * t.pitch + x;
+}
+
+/*
+* sampler: whether a width x height texture can be stored in layout
+*/
+inline bool samplerLayoutFits(int width, int height, SamplerLayout layout)
+{
+	if (layout == SAMPLER_TILED) return width % 4 == 0 && height % 4 == 0;
+	if (layout == SAMPLER_MORTON) return width == height && (width & (width - 1)) == 0 && width <= 65536;
+	return true;
+}
+
+template <SamplerLayout L>
+inline void samplerSwizzleT(const SamplerTexture& t, uint32_t* dst, const uint32_t* src, int srcPitch)
+{
+	for (int y = 0; y < t.height; y++) {
+		for (int x = 0; x < t.width; x++) dst[samplerOffset<L>(t, x, y)] = src[y * srcPitch + x];
+	}
+}
+
+/*
+* sampler: copy the rows of src, srcPitch pixels apart, into dst in layout.
+* dst holds width * height texels, the texture over it is returned. the
+* layout must fit, see samplerLayoutFits()
+*/
+inline SamplerTexture samplerSwizzle(uint32_t* dst, const uint32_t* src, int width, int height, int srcPitch, SamplerLayout layout)
+{
+	SamplerTexture t = { dst, width, height, width, layout };
+	if (layout == SAMPLER_TILED) samplerSwizzleT<SAMPLER_TILED>(t, dst, src, srcPitch);
+	else if (layout == SAMPLER_MORTON) samplerSwizzleT<SAMPLER_MORTON>(t, dst, src, srcPitch);
+	else samplerSwizzleT<SAMPLER_LINEAR>(t, dst, src, srcPitch);
+	return t;
+}
+
+template <SamplerAddress A, SamplerLayout L>
+inline uint32_t samplerFetch(const SamplerTexture& t, int x, int y)
+{
+	if (A == SAMPLER_WRAP) {
+		x &= t.width - 1;
+		y &= t.height - 1;
+	}
+	else if (A == SAMPLER_CLAMP) {
+		x = x < 0 ? 0 : (x >= t.width ? t.width - 1 : x);
+		y = y < 0 ? 0 : (y >= t.height ? t.height - 1 : y);
+	}
+	else if (x < 0 || x >= t.width || y < 0 || y >= t.height) {
+		return 0;
+	}
+	return t.pixels[samplerOffset<L>(t, x, y)];
+}
+
+template <SamplerFilter F, SamplerAddress A, SamplerLayout L>
+inline void sampleRowScalarT(uint32_t* dst, const SamplerTexture& t, const FixedTexel* u, const FixedTexel* v, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		// the integer part gives the texel, the fraction the weights
+		int x = u[i].toInt(), y = v[i].toInt();
+		if (F == SAMPLER_NEAREST) {
+			dst[i] = samplerFetch<A, L>(t, x, y);
+			continue;
+		}
+		int fx = u[i].frac(), fy = v[i].frac();
+		uint32_t top = samplerLerp(samplerFetch<A, L>(t, x, y), samplerFetch<A, L>(t, x + 1, y), fx);
+		uint32_t bottom = samplerLerp(samplerFetch<A, L>(t, x, y + 1), samplerFetch<A, L>(t, x + 1, y + 1), fx);
+		dst[i] = samplerLerp(top, bottom, fy);
+	}
+}
+
+template <SamplerLayout L>
+inline void sampleRowScalarL(uint32_t* dst, const SamplerTexture& texture, const FixedTexel* u, const FixedTexel* v,
+	int count, SamplerFilter filter, SamplerAddress address)
+{
+	if (filter == SAMPLER_NEAREST) {
+		if (address == SAMPLER_WRAP) sampleRowScalarT<SAMPLER_NEAREST, SAMPLER_WRAP, L>(dst, texture, u, v, count);
+		else if (address == SAMPLER_CLAMP) sampleRowScalarT<SAMPLER_NEAREST, SAMPLER_CLAMP, L>(dst, texture, u, v, count);
+		else sampleRowScalarT<SAMPLER_NEAREST, SAMPLER_BORDER, L>(dst, texture, u, v, count);
+	}
+	else {
+		if (address == SAMPLER_WRAP) sampleRowScalarT<SAMPLER_BILINEAR, SAMPLER_WRAP, L>(dst, texture, u, v, count);
+		else if (address == SAMPLER_CLAMP) sampleRowScalarT<SAMPLER_BILINEAR, SAMPLER_CLAMP, L>(dst, texture, u, v, count);
+		else sampleRowScalarT<SAMPLER_BILINEAR, SAMPLER_BORDER, L>(dst, texture, u, v, count);
+	}
+}
+
+/*
+* sampler: count texels of texture at the coordinates u[i], v[i]
+*/
+inline void sampleRowScalar(uint32_t* dst, const SamplerTexture& texture, const FixedTexel* u, const FixedTexel* v,
+	int count, SamplerFilter filter, SamplerAddress address)
+{
+	if (texture.layout == SAMPLER_TILED) sampleRowScalarL<SAMPLER_TILED>(dst, texture, u, v, count, filter, address);
+	else if (texture.layout == SAMPLER_MORTON) sampleRowScalarL<SAMPLER_MORTON>(dst, texture, u, v, count, filter, address);
+	else sampleRowScalarL<SAMPLER_LINEAR>(dst, texture, u, v, count, filter, address);
+}
+
+/*
+* fractal: iteration counts of one line of the Mandelbrot set, starting at
+* (pr, pi) and stepping dr along the real axis
+*/
+inline void mandelbrotRowScalar(unsigned char* dst, double pr, double dr, double pi, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		unsigned char c = 0;
+		double vi = pi, vr = pr, nvi, nvr;
+		// loop until distance is above 2, or counter hits limit
+		while ((vr * vr + vi * vi < 4) && (c < 255))
+		{
+			// compute Z(n+1) given Z(n)
+			nvr = vr * vr - vi * vi + pr;
+			nvi = 2 * vi * vr + pi;
+			vi = nvi;
+			vr = nvr;
+			c++;
+		}
+		dst[i] = c;
+		// interpolate X
+		pr += dr;
+	}
+}
+
+/*
+* torus: z buffered span with the static texture added to the light map
+*/
+inline void spanFillScalar(uint32_t* dst, unsigned short* zbuffer, const SpanSetup& span,
+	const uint32_t* texture, int texturePitch, const unsigned char* light)
+{
+	FixedDepth z = span.z;
+	Fixed16_16 tx = span.tx, ty = span.ty, px = span.px, py = span.py;
+	for (int i = 0; i < span.count; i++)
+	{
+		if (z.raw < zbuffer[i])
+		{
+			uint32_t texel = texture[(ty.toInt() & 0xff) * texturePitch + (tx.toInt() & 0xff)];
+			int l = light[((py.toInt() & 0xff) << 8) + (px.toInt() & 0xff)];
+			int r = (int)((texel >> 16) & 0xff) + l;
+			int g = (int)((texel >> 8) & 0xff) + l;
+			int b = (int)(texel & 0xff) + l;
+			if (r > 255) r = 255;
+			if (g > 255) g = 255;
+			if (b > 255) b = 255;
+			dst[i] = 0xFF000000 | (r << 16) | (g << 8) | b;
+			zbuffer[i] = (unsigned short)z.raw;
+		}
+		px += span.dpx;
+		py += span.dpy;
+		tx += span.dtx;
+		ty += span.dty;
+		z += span.dz;
+	}
+}
+
+/*
+* one number from every lane
+*/
+inline void rngBlockScalar(uint32_t* dst, RngLanes& lanes)
+{
+	for (int k = 0; k < RNG_LANES; k++) {
+		uint32_t s0 = lanes.s[0][k], s1 = lanes.s[1][k], s2 = lanes.s[2][k], s3 = lanes.s[3][k];
+		dst[k] = rngRotl(s0 + s3, 7) + s0;
+		uint32_t t = s1 << 9;
+		s2 ^= s0;
+		s3 ^= s1;
+		s1 ^= s2;
+		s0 ^= s3;
+		s2 ^= t;
+		lanes.s[0][k] = s0;
+		lanes.s[1][k] = s1;
+		lanes.s[2][k] = s2;
+		lanes.s[3][k] = rngRotl(s3, 11);
+	}
+}
+
+/*
+* random numbers: number n comes from lane n % RNG_LANES. a tail shorter
+* than the lanes still advances all of them, like the vector variants do
+*/
+inline void rngFillScalar(uint32_t* dst, int count, RngLanes& lanes)
+{
+	int i = 0;
+	for (; i + RNG_LANES <= count; i += RNG_LANES) {
+		rngBlockScalar(dst + i, lanes);
+	}
+	if (i < count) {
+		uint32_t tail[RNG_LANES];
+		rngBlockScalar(tail, lanes);
+		memcpy(dst + i, tail, (count - i) * sizeof(uint32_t));
+	}
+}
+
+/*
+* points: count points of separate x, y, z arrays times the 3x3 matrix m
+* (rows of three floats), as VECTOR * MATRIX. the output may be the input
+*/
+inline void transformSoaScalar(const float* m, const float* x, const float* y, const float* z,
+	float* ox, float* oy, float* oz, int count)
+{
+	for (int i = 0; i < count; i++) {
+		float px = x[i], py = y[i], pz = z[i];
+		ox[i] = px * m[0] + py * m[3] + pz * m[6];
+		oy[i] = px * m[1] + py * m[4] + pz * m[7];
+		oz[i] = px * m[2] + py * m[5] + pz * m[8];
+	}
+}
+
+/*
+* palette: 8 bit indices to the packed colours of a 256 entry palette
+*/
+inline void paletteResolveScalar(uint32_t* dst, const unsigned char* src, const uint32_t* palette, int count)
+{
+	for (int i = 0; i < count; i++) {
+		dst[i] = palette[src[i]];
+	}
+}
+
+
+#ifdef KERNELS_X86
+
+// SSE2 KERNELS
+
+KERNEL_TARGET("sse2")
+inline void plasmaRowSse2(uint32_t* dst, const unsigned char* src1, const unsigned char* src2, const uint32_t* palette, int count)
+{
+	// the byte add wraps exactly like the % 256, sixteen at a time
+	unsigned char index[16];
+	int i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i sum = _mm_add_epi8(_mm_loadu_si128((const __m128i*)(src1 + i)), _mm_loadu_si128((const __m128i*)(src2 + i)));
+		_mm_storeu_si128((__m128i*)index, sum);
+		for (int k = 0; k < 16; k++) dst[i + k] = palette[index[k]];
+	}
+	plasmaRowScalar(dst + i, src1 + i, src2 + i, palette, count - i);
+}
+
+KERNEL_TARGET("sse2")
+inline void fireBlurSse2(const unsigned char* src, unsigned char* dst, int width, int height)
+{
+	const __m128i zero = _mm_setzero_si128();
+	for (int j = 0; j < (height - 2); j++)
+	{
+		int offs = j * width;
+		dst[offs] = 0;
+		int i = 1;
+		// sixteen pixels at a time, the eight neighbours added in 16 bits
+		for (; i + 16 <= width - 1; i += 16) {
+			const unsigned char* s = src + offs + i;
+			const unsigned char* n[8] = { s - 1, s + 1, s + width - 1, s + width, s + width + 1, s + 2 * width - 1, s + 2 * width, s + 2 * width + 1 };
+			__m128i lo = zero, hi = zero;
+			for (int k = 0; k < 8; k++) {
+				__m128i v = _mm_loadu_si128((const __m128i*)n[k]);
+				lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+				hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+			}
+			_mm_storeu_si128((__m128i*)(dst + offs + i), _mm_packus_epi16(_mm_srli_epi16(lo, 3), _mm_srli_epi16(hi, 3)));
+		}
+		for (; i < width - 1; i++) {
+			int o = offs + i;
+			dst[o] = (unsigned char)((src[o - 1] + src[o + 1] + src[o + width - 1] + src[o + width] + src[o + width + 1]
+				+ src[o + 2 * width - 1] + src[o + 2 * width] + src[o + 2 * width + 1]) / 8);
+		}
+		dst[offs + width - 1] = 0;
+	}
+	memset(dst + (height - 2) * width, 0, width * 2);
+}
+
+/*
+* fills pr[0..count) exactly like the scalar code does (repeated adds, not
+* pr0 + i * dr) so every lane sees the same coordinates
+*/
+inline void mandelbrotCoords(double* prs, double pr, double dr, int count)
+{
+	for (int i = 0; i < count; i++) {
+		prs[i] = pr;
+		pr += dr;
+	}
+}
+
+KERNEL_TARGET("sse2")
+inline void mandelbrotRowSse2(unsigned char* dst, double pr, double dr, double pi, int count)
+{
+	double prs[2];
+	const __m128d four = _mm_set1_pd(4.0), limit = _mm_set1_pd(255.0), one = _mm_set1_pd(1.0), two = _mm_set1_pd(2.0);
+	const __m128d ci = _mm_set1_pd(pi);
+	int i = 0;
+	for (; i + 2 <= count; i += 2) {
+		mandelbrotCoords(prs, pr, dr, 2);
+		pr = prs[1] + dr;
+		__m128d cr = _mm_loadu_pd(prs);
+		__m128d vr = cr, vi = ci, c = _mm_setzero_pd();
+		for (;;) {
+			__m128d rr = _mm_mul_pd(vr, vr), ii = _mm_mul_pd(vi, vi);
+			__m128d active = _mm_and_pd(_mm_cmplt_pd(_mm_add_pd(rr, ii), four), _mm_cmplt_pd(c, limit));
+			if (_mm_movemask_pd(active) == 0) break;
+			__m128d nvr = _mm_add_pd(_mm_sub_pd(rr, ii), cr);
+			__m128d nvi = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(two, vi), vr), ci);
+			vr = _mm_or_pd(_mm_and_pd(active, nvr), _mm_andnot_pd(active, vr));
+			vi = _mm_or_pd(_mm_and_pd(active, nvi), _mm_andnot_pd(active, vi));
+			c = _mm_add_pd(c, _mm_and_pd(active, one));
+		}
+		dst[i] = (unsigned char)_mm_cvtsd_si32(c);
+		dst[i + 1] = (unsigned char)_mm_cvtsd_si32(_mm_unpackhi_pd(c, c));
+	}
+	mandelbrotRowScalar(dst + i, pr, dr, pi, count - i);
+}
+
+// one xoshiro128++ step of four lanes
+KERNEL_TARGET("sse2")
+inline __m128i rngStepSse2(__m128i& s0, __m128i& s1, __m128i& s2, __m128i& s3)
+{
+	__m128i sum = _mm_add_epi32(s0, s3);
+	__m128i result = _mm_add_epi32(_mm_or_si128(_mm_slli_epi32(sum, 7), _mm_srli_epi32(sum, 25)), s0);
+	__m128i t = _mm_slli_epi32(s1, 9);
+	s2 = _mm_xor_si128(s2, s0);
+	s3 = _mm_xor_si128(s3, s1);
+	s1 = _mm_xor_si128(s1, s2);
+	s0 = _mm_xor_si128(s0, s3);
+	s2 = _mm_xor_si128(s2, t);
+	s3 = _mm_or_si128(_mm_slli_epi32(s3, 11), _mm_srli_epi32(s3, 21));
+	return result;
+}
+
+KERNEL_TARGET("sse2")
+inline void rngFillSse2(uint32_t* dst, int count, RngLanes& lanes)
+{
+	// lanes 0-3 in a*, 4-7 in b*
+	__m128i a0 = _mm_loadu_si128((const __m128i*)lanes.s[0]), b0 = _mm_loadu_si128((const __m128i*)(lanes.s[0] + 4));
+	__m128i a1 = _mm_loadu_si128((const __m128i*)lanes.s[1]), b1 = _mm_loadu_si128((const __m128i*)(lanes.s[1] + 4));
+	__m128i a2 = _mm_loadu_si128((const __m128i*)lanes.s[2]), b2 = _mm_loadu_si128((const __m128i*)(lanes.s[2] + 4));
+	__m128i a3 = _mm_loadu_si128((const __m128i*)lanes.s[3]), b3 = _mm_loadu_si128((const __m128i*)(lanes.s[3] + 4));
+	int i = 0;
+	for (; i + RNG_LANES <= count; i += RNG_LANES) {
+		_mm_storeu_si128((__m128i*)(dst + i), rngStepSse2(a0, a1, a2, a3));
+		_mm_storeu_si128((__m128i*)(dst + i + 4), rngStepSse2(b0, b1, b2, b3));
+	}
+	_mm_storeu_si128((__m128i*)lanes.s[0], a0); _mm_storeu_si128((__m128i*)(lanes.s[0] + 4), b0);
+	_mm_storeu_si128((__m128i*)lanes.s[1], a1); _mm_storeu_si128((__m128i*)(lanes.s[1] + 4), b1);
+	_mm_storeu_si128((__m128i*)lanes.s[2], a2); _mm_storeu_si128((__m128i*)(lanes.s[2] + 4), b2);
+	_mm_storeu_si128((__m128i*)lanes.s[3], a3); _mm_storeu_si128((__m128i*)(lanes.s[3] + 4), b3);
+	rngFillScalar(dst + i, count - i, lanes);
+}
+
+/*
+* four points a step, multiplies and adds in the order of the scalar code
+* (no fused multiply-add) so the results are the same to the bit
+*/
+KERNEL_TARGET("sse2")
+inline void transformSoaSse2(const float* m, const float* x, const float* y, const float* z,
+	float* ox, float* oy, float* oz, int count)
+{
+	__m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]), m2 = _mm_set1_ps(m[2]);
+	__m128 m3 = _mm_set1_ps(m[3]), m4 = _mm_set1_ps(m[4]), m5 = _mm_set1_ps(m[5]);
+	__m128 m6 = _mm_set1_ps(m[6]), m7 = _mm_set1_ps(m[7]), m8 = _mm_set1_ps(m[8]);
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i), pz = _mm_loadu_ps(z + i);
+		_mm_storeu_ps(ox + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, m0), _mm_mul_ps(py, m3)), _mm_mul_ps(pz, m6)));
+		_mm_storeu_ps(oy + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, m1), _mm_mul_ps(py, m4)), _mm_mul_ps(pz, m7)));
+		_mm_storeu_ps(oz + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, m2), _mm_mul_ps(py, m5)), _mm_mul_ps(pz, m8)));
+	}
+	transformSoaScalar(m, x + i, y + i, z + i, ox + i, oy + i, oz + i, count - i);
+}
+
+/*
+* no gathers before AVX2: sixteen indices in a register, taken four bytes
+* at a time out of it, and four colours stored together
+*/
+KERNEL_TARGET("sse2")
+inline void paletteResolveSse2(uint32_t* dst, const unsigned char* src, const uint32_t* palette, int count)
+{
+	int i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i index = _mm_loadu_si128((const __m128i*)(src + i));
+		for (int k = 0; k < 16; k += 4) {
+			uint32_t w = (uint32_t)_mm_cvtsi128_si32(index);
+			index = _mm_srli_si128(index, 4);
+			_mm_storeu_si128((__m128i*)(dst + i + k), _mm_set_epi32((int)palette[w >> 24], (int)palette[(w >> 16) & 0xff],
+				(int)palette[(w >> 8) & 0xff], (int)palette[w & 0xff]));
+		}
+	}
+	paletteResolveScalar(dst + i, src + i, palette, count - i);
+}
+
+
+// samplerLerp() on four texels, f holds each weight in both 16 bit halves
+// of its lane
+KERNEL_TARGET("sse2")
+inline __m128i samplerLerpSse2(__m128i a, __m128i b, __m128i f)
+{
+	const __m128i mask = _mm_set1_epi32(0x00FF00FF);
+	__m128i g = _mm_sub_epi16(_mm_set1_epi16(256), f);
+	__m128i rb = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(a, mask), g), _mm_mullo_epi16(_mm_and_si128(b, mask), f));
+	__m128i ag = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(a, 8), mask), g),
+		_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(b, 8), mask), f));
+	// the high byte of every 16 bit product is the lerped channel
+	return _mm_or_si128(_mm_srli_epi16(rb, 8), _mm_andnot_si128(mask, ag));
+}
+
+// four pixels at a time: sse2 has no gather, the texels are fetched one by
+// one and blended together
+template <SamplerFilter F, SamplerAddress A, SamplerLayout L>
+KERNEL_TARGET("sse2")
+inline void sampleRowSse2T(uint32_t* dst, const SamplerTexture& t, const FixedTexel* u, const FixedTexel* v, int count)
+{
+	int i = 0;
+	for (; F == SAMPLER_BILINEAR && i + 4 <= count; i += 4) {
+		__m128i cu = _mm_loadu_si128((const __m128i*)(u + i));
+		__m128i cv = _mm_loadu_si128((const __m128i*)(v + i));
+		int x[4], y[4];
+		_mm_storeu_si128((__m128i*)x, _mm_srai_epi32(cu, 8));
+		_mm_storeu_si128((__m128i*)y, _mm_srai_epi32(cv, 8));
+		__m128i c00 = _mm_set_epi32(samplerFetch<A, L>(t, x[3], y[3]), samplerFetch<A, L>(t, x[2], y[2]),
+			samplerFetch<A, L>(t, x[1], y[1]), samplerFetch<A, L>(t, x[0], y[0]));
+		__m128i c10 = _mm_set_epi32(samplerFetch<A, L>(t, x[3] + 1, y[3]), samplerFetch<A, L>(t, x[2] + 1, y[2]),
+			samplerFetch<A, L>(t, x[1] + 1, y[1]), samplerFetch<A, L>(t, x[0] + 1, y[0]));
+		__m128i c01 = _mm_set_epi32(samplerFetch<A, L>(t, x[3], y[3] + 1), samplerFetch<A, L>(t, x[2], y[2] + 1),
+			samplerFetch<A, L>(t, x[1], y[1] + 1), samplerFetch<A, L>(t, x[0], y[0] + 1));
+		__m128i c11 = _mm_set_epi32(samplerFetch<A, L>(t, x[3] + 1, y[3] + 1), samplerFetch<A, L>(t, x[2] + 1, y[2] + 1),
+			samplerFetch<A, L>(t, x[1] + 1, y[1] + 1), samplerFetch<A, L>(t, x[0] + 1, y[0] + 1));
+		__m128i fx = _mm_and_si128(cu, _mm_set1_epi32(255));
+		__m128i fy = _mm_and_si128(cv, _mm_set1_epi32(255));
+		fx = _mm_or_si128(fx, _mm_slli_epi32(fx, 16));
+		fy = _mm_or_si128(fy, _mm_slli_epi32(fy, 16));
+		__m128i top = samplerLerpSse2(c00, c10, fx), bottom = samplerLerpSse2(c01, c11, fx);
+		_mm_storeu_si128((__m128i*)(dst + i), samplerLerpSse2(top, bottom, fy));
+	}
+	// nearest is only fetches, nothing to blend
+	sampleRowScalarT<F, A, L>(dst + i, t, u + i, v + i, count - i);
+}
+
+template <SamplerLayout L>
+KERNEL_TARGET("sse2")
+inline void sampleRowSse2L(uint32_t* dst, const SamplerTexture& texture, const FixedTexel* u, const FixedTexel* v,
+	int count, SamplerAddress address)
+{
+	if (address == SAMPLER_WRAP) sampleRowSse2T<SAMPLER_BILINEAR, SAMPLER_WRAP, L>(dst, texture, u, v, count);
+	else if (address == SAMPLER_CLAMP) sampleRowSse2T<SAMPLER_BILINEAR, SAMPLER_CLAMP, L>(dst, texture, u, v, count);
+	else sampleRowSse2T<SAMPLER_BILINEAR, SAMPLER_BORDER, L>(dst, texture, u, v, count);
+}
+
+KERNEL_TARGET("sse2")
+inline void sampleRowSse2(uint32_t* dst, const SamplerTexture& texture, const FixedTexel* u, const FixedTexel* v,
+	int count, SamplerFilter filter, SamplerAddress address)
+{
+	if (filter == SAMPLER_NEAREST) sampleRowScalar(dst, texture, u, v, count, filter, address);
+	else if (texture.layout == SAMPLER_TILED) sampleRowSse2L<SAMPLER_TILED>(dst, texture, u, v, count, address);
+	else if (texture.layout == SAMPLER_MORTON) sampleRowSse2L<SAMPLER_MORTON>(dst, texture, u, v, count, address);
+	else sampleRowSse2L<SAMPLER_LINEAR>(dst, texture, u, v, count, address);
+}
+
+// AVX2 KERNELS
+
+KERNEL_TARGET("avx2")
+inline void plasmaRowAvx2(uint32_t* dst, const unsigned char* src1, const unsigned char* src2, const uint32_t* palette, int count)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i sum = _mm_add_epi8(_mm_loadl_epi64((const __m128i*)(src1 + i)), _mm_loadl_epi64((const __m128i*)(src2 + i)));
+		__m256i index = _mm256_cvtepu8_epi32(sum);
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_i32gather_epi32((const int*)palette, index, 4));
+	}
+	plasmaRowScalar(dst + i, src1 + i, src2 + i, palette, count - i);
+}
+
+KERNEL_TARGET("avx2")
+inline void fireBlurAvx2(const unsigned char* src, unsigned char* dst, int width, int height)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	for (int j = 0; j < (height - 2); j++)
+	{
+		int offs = j * width;
+		dst[offs] = 0;
+		int i = 1;
+		for (; i + 32 <= width - 1; i += 32) {
+			const unsigned char* s = src + offs + i;
+			const unsigned char* n[8] = { s - 1, s + 1, s + width - 1, s + width, s + width + 1, s + 2 * width - 1, s + 2 * width, s + 2 * width + 1 };
+			__m256i lo = zero, hi = zero;
+			for (int k = 0; k < 8; k++) {
+				__m256i v = _mm256_loadu_si256((const __m256i*)n[k]);
+				lo = _mm256_add_epi16(lo, _mm256_unpacklo_epi8(v, zero));
+				hi = _mm256_add_epi16(hi, _mm256_unpackhi_epi8(v, zero));
+			}
+			// unpack and pack work per 128 bit lane, so the order comes back as it was
+			_mm256_storeu_si256((__m256i*)(dst + offs + i), _mm256_packus_epi16(_mm256_srli_epi16(lo, 3), _mm256_srli_epi16(hi, 3)));
+		}
+		for (; i < width - 1; i++) {
+			int o = offs + i;
+			dst[o] = (unsigned char)((src[o - 1] + src[o + 1] + src[o + width - 1] + src[o + width] + src[o + width + 1]
+				+ src[o + 2 * width - 1] + src[o + 2 * width] + src[o + 2 * width + 1]) / 8);
+		}
+		dst[offs + width - 1] = 0;
+	}
+	memset(dst + (height - 2) * width, 0, width * 2);
+}
+
+// "avx2" without "fma" on purpose: fused multiply-adds would round
+// differently from the scalar code and change the iteration counts
+KERNEL_TARGET("avx2")
+inline void mandelbrotRowAvx2(unsigned char* dst, double pr, double dr, double pi, int count)
+{
+	double prs[4];
+	const __m256d four = _mm256_set1_pd(4.0), limit = _mm256_set1_pd(255.0), one = _mm256_set1_pd(1.0), two = _mm256_set1_pd(2.0);
+	const __m256d ci = _mm256_set1_pd(pi);
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		mandelbrotCoords(prs, pr, dr, 4);
+		pr = prs[3] + dr;
+		__m256d cr = _mm256_loadu_pd(prs);
+		__m256d vr = cr, vi = ci, c = _mm256_setzero_pd();
+		for (;;) {
+			__m256d rr = _mm256_mul_pd(vr, vr), ii = _mm256_mul_pd(vi, vi);
+			__m256d active = _mm256_and_pd(_mm256_cmp_pd(_mm256_add_pd(rr, ii), four, _CMP_LT_OQ), _mm256_cmp_pd(c, limit, _CMP_LT_OQ));
+			if (_mm256_movemask_pd(active) == 0) break;
+			__m256d nvr = _mm256_add_pd(_mm256_sub_pd(rr, ii), cr);
+			__m256d nvi = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(two, vi), vr), ci);
+			vr = _mm256_blendv_pd(vr, nvr, active);
+			vi = _mm256_blendv_pd(vi, nvi, active);
+			c = _mm256_add_pd(c, _mm256_and_pd(active, one));
+		}
+		__m128i counts = _mm256_cvtpd_epi32(c);
+		dst[i] = (unsigned char)_mm_cvtsi128_si32(counts);
+		dst[i + 1] = (unsigned char)_mm_extract_epi16(counts, 2);
+		dst[i + 2] = (unsigned char)_mm_extract_epi16(counts, 4);
+		dst[i + 3] = (unsigned char)_mm_extract_epi16(counts, 6);
+	}
+	mandelbrotRowScalar(dst + i, pr, dr, pi, count - i);
+}
+
+// one xoshiro128++ step of all the lanes
+KERNEL_TARGET("avx2")
+inline __m256i rngStepAvx2(__m256i& s0, __m256i& s1, __m256i& s2, __m256i& s3)
+{
+	__m256i sum = _mm256_add_epi32(s0, s3);
+	__m256i result = _mm256_add_epi32(_mm256_or_si256(_mm256_slli_epi32(sum, 7), _mm256_srli_epi32(sum, 25)), s0);
+	__m256i t = _mm256_slli_epi32(s1, 9);
+	s2 = _mm256_xor_si256(s2, s0);
+	s3 = _mm256_xor_si256(s3, s1);
+	s1 = _mm256_xor_si256(s1, s2);
+	s0 = _mm256_xor_si256(s0, s3);
+	s2 = _mm256_xor_si256(s2, t);
+	s3 = _mm256_or_si256(_mm256_slli_epi32(s3, 11), _mm256_srli_epi32(s3, 21));
+	return result;
+}
+
+KERNEL_TARGET("avx2")
+inline void rngFillAvx2(uint32_t* dst, int count, RngLanes& lanes)
+{
+	__m256i s0 = _mm256_loadu_si256((const __m256i*)lanes.s[0]);
+	__m256i s1 = _mm256_loadu_si256((const __m256i*)lanes.s[1]);
+	__m256i s2 = _mm256_loadu_si256((const __m256i*)lanes.s[2]);
+	__m256i s3 = _mm256_loadu_si256((const __m256i*)lanes.s[3]);
+	int i = 0;
+	for (; i + RNG_LANES <= count; i += RNG_LANES) {
+		_mm256_storeu_si256((__m256i*)(dst + i), rngStepAvx2(s0, s1, s2, s3));
+	}
+	_mm256_storeu_si256((__m256i*)lanes.s[0], s0);
+	_mm256_storeu_si256((__m256i*)lanes.s[1], s1);
+	_mm256_storeu_si256((__m256i*)lanes.s[2], s2);
+	_mm256_storeu_si256((__m256i*)lanes.s[3], s3);
+	rngFillScalar(dst + i, count - i, lanes);
+}
+
+KERNEL_TARGET("avx2")
+inline void transformSoaAvx2(const float* m, const float* x, const float* y, const float* z,
+	float* ox, float* oy, float* oz, int count)
+{
+	__m256 m0 = _mm256_set1_ps(m[0]), m1 = _mm256_set1_ps(m[1]), m2 = _mm256_set1_ps(m[2]);
+	__m256 m3 = _mm256_set1_ps(m[3]), m4 = _mm256_set1_ps(m[4]), m5 = _mm256_set1_ps(m[5]);
+	__m256 m6 = _mm256_set1_ps(m[6]), m7 = _mm256_set1_ps(m[7]), m8 = _mm256_set1_ps(m[8]);
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i), pz = _mm256_loadu_ps(z + i);
+		_mm256_storeu_ps(ox + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, m0), _mm256_mul_ps(py, m3)), _mm256_mul_ps(pz, m6)));
+		_mm256_storeu_ps(oy + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, m1), _mm256_mul_ps(py, m4)), _mm256_mul_ps(pz, m7)));
+		_mm256_storeu_ps(oz + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, m2), _mm256_mul_ps(py, m5)), _mm256_mul_ps(pz, m8)));
+	}
+	transformSoaSse2(m, x + i, y + i, z + i, ox + i, oy + i, oz + i, count - i);
+}
+
+KERNEL_TARGET("avx2")
+inline void paletteResolveAvx2(uint32_t* dst, const unsigned char* src, const uint32_t* palette, int count)
+{
+	int i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(src + i));
+		__m256i lo = _mm256_cvtepu8_epi32(bytes), hi = _mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_i32gather_epi32((const int*)palette, lo, 4));
+		_mm256_storeu_si256((__m256i*)(dst + i + 8), _mm256_i32gather_epi32((const int*)palette, hi, 4));
+	}
+	paletteResolveScalar(dst + i, src + i, palette, count - i);
+}
+
+
+KERNEL_TARGET("avx2")
+inline __m256i samplerLerpAvx2(__m256i a, __m256i b, __m256i f)
+{
+	const __m256i mask = _mm256_set1_epi32(0x00FF00FF);
+	__m256i g = _mm256_sub_epi16(_mm256_set1_epi16(256), f);
+	__m256i rb = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_and_si256(a, mask), g), _mm256_mullo_epi16(_mm256_and_si256(b, mask), f));
+	__m256i ag = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_and_si256(_mm256_srli_epi32(a, 8), mask), g),
+		_mm256_mullo_epi16(_mm256_and_si256(_mm256_srli_epi32(b, 8), mask), f));
+	return _mm256_or_si256(_mm256_srli_epi16(rb, 8), _mm256_andnot_si256(mask, ag));
+}
+
+// samplerSpread() on eight lanes
+KERNEL_TARGET("avx2")
+inline __m256i samplerSpreadAvx2(__m256i x)
+{
+	x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi32(x, 8)), _mm256_set1_epi32(0x00FF00FF));
+	x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi32(x, 4)), _mm256_set1_epi32(0x0F0F0F0F));
+	x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi32(x, 2)), _mm256_set1_epi32(0x33333333));
+	return _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi32(x, 1)), _mm256_set1_epi32(0x55555555));
+}
+
+// eight texels, addressed like samplerFetch(). the border texels are masked
+// out of the gather and never read
+template <SamplerAddress A, SamplerLayout L>
+KERNEL_TARGET("avx2")
+inline __m256i samplerGatherAvx2(const SamplerTexture& t, __m256i x, __m256i y)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i width = _mm256_set1_epi32(t.width), height = _mm256_set1_epi32(t.height);
+	if (A == SAMPLER_WRAP) {
+		x = _mm256_and_si256(x, _mm256_set1_epi32(t.width - 1));
+		y = _mm256_and_si256(y, _mm256_set1_epi32(t.height - 1));
+	}
+	else if (A == SAMPLER_CLAMP) {
+		x = _mm256_min_epi32(_mm256_max_epi32(x, zero), _mm256_set1_epi32(t.width - 1));
+		y = _mm256_min_epi32(_mm256_max_epi32(y, zero), _mm256_set1_epi32(t.height - 1));
+	}
+	__m256i offset;
+	if (L == SAMPLER_TILED) {
+		const __m256i low = _mm256_set1_epi32(3), high = _mm256_set1_epi32(~3);
+		offset = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_and_si256(y, high), _mm256_set1_epi32(t.pitch)),
+			_mm256_slli_epi32(_mm256_and_si256(x, high), 2));
+		offset = _mm256_add_epi32(offset, _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(y, low), 2), _mm256_and_si256(x, low)));
+	}
+	else if (L == SAMPLER_MORTON) {
+		// border coordinates are outside 0 .. 65535, they are masked anyway
+		offset = _mm256_or_si256(samplerSpreadAvx2(x), _mm256_slli_epi32(samplerSpreadAvx2(y), 1));
+	}
+	else {
+		offset = _mm256_add_epi32(_mm256_mullo_epi32(y, _mm256_set1_epi32(t.pitch)), x);
+	}
+	if (A == SAMPLER_BORDER) {
+		const __m256i minus = _mm256_set1_epi32(-1);
+		__m256i inside = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(x, minus), _mm256_cmpgt_epi32(width, x)),
+			_mm256_and_si256(_mm256_cmpgt_epi32(y, minus), _mm256_cmpgt_epi32(height, y)));
+		return _mm256_mask_i32gather_epi32(zero, (const int*)t.pixels, offset, inside, 4);
+	}
+	return _mm256_i32gather_epi32((const int*)t.pixels, offset, 4);
+}
+
+template <SamplerFilter F, SamplerAddress A, SamplerLayout L>
+KERNEL_TARGET("avx2")
+inline void sampleRowAvx2T(uint32_t* dst, const SamplerTexture& t, const FixedTexel* u, const FixedTexel* v, int count)
+{
+	const __m256i one = _mm256_set1_epi32(1), low = _mm256_set1_epi32(255);
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i cu = _mm256_loadu_si256((const __m256i*)(u + i));
+		__m256i cv = _mm256_loadu_si256((const __m256i*)(v + i));
+		__m256i x = _mm256_srai_epi32(cu, 8), y = _mm256_srai_epi32(cv, 8);
+		if (F == SAMPLER_NEAREST) {
+			_mm256_storeu_si256((__m256i*)(dst + i), samplerGatherAvx2<A, L>(t, x, y));
+			continue;
+		}
+		__m256i x1 = _mm256_add_epi32(x, one), y1 = _mm256_add_epi32(y, one);
+		__m256i fx = _mm256_and_si256(cu, low), fy = _mm256_and_si256(cv, low);
+		fx = _mm256_or_si256(fx, _mm256_slli_epi32(fx, 16));
+		fy = _mm256_or_si256(fy, _mm256_slli_epi32(fy, 16));
+		__m256i top = samplerLerpAvx2(samplerGatherAvx2<A, L>(t, x, y), samplerGatherAvx2<A, L>(t, x1, y), fx);
+		__m256i bottom = samplerLerpAvx2(samplerGatherAvx2<A, L>(t, x, y1), samplerGatherAvx2<A, L>(t, x1, y1), fx);
+		_mm256_storeu_si256((__m256i*)(dst + i), samplerLerpAvx2(top, bottom, fy));
+	}
+	sampleRowScalarT<F, A, L>(dst + i, t, u + i, v + i, count - i);
+}
+
+template <SamplerLayout L>
+KERNEL_TARGET("avx2")
+inline void sampleRowAvx2L(uint32_t* dst, const SamplerTexture& texture, const FixedTexel* u, const FixedTexel* v,
+	int count, SamplerFilter filter, SamplerAddress address)
+{
+	if (filter == SAMPLER_NEAREST) {
+		if (address == SAMPLER_WRAP) sampleRowAvx2T<SAMPLER_NEAREST, SAMPLER_WRAP, L>(dst, texture, u, v, count);
+		else if (address == SAMPLER_CLAMP) sampleRowAvx2T<SAMPLER_NEAREST, SAMPLER_CLAMP, L>(dst, texture, u, v, count);
+		else sampleRowAvx2T<SAMPLER_NEAREST, SAMPLER_BORDER, L>(dst, texture, u, v, count);
+	}
+	else {
+		if (address == SAMPLER_WRAP) sampleRowAvx2T<SAMPLER_BILINEAR, SAMPLER_WRAP, L>(dst, texture, u, v, count);
+		else if (address == SAMPLER_CLAMP) sampleRowAvx2T<SAMPLER_BILINEAR, SAMPLER_CLAMP, L>(dst, texture, u, v, count);
+		else sampleRowAvx2T<SAMPLER_BILINEAR, SAMPLER_BORDER, L>(dst, texture, u, v, count);
+	}
+}
+
+KERNEL_TARGET("avx2")
+inline void sampleRowAvx2(uint32_t* dst, const SamplerTexture& texture, const FixedTexel* u, const FixedTexel* v,
+	int count, SamplerFilter filter, SamplerAddress address)
+{
+	if (texture.layout == SAMPLER_TILED) sampleRowAvx2L<SAMPLER_TILED>(dst, texture, u, v, count, filter, address);
+	else if (texture.layout == SAMPLER_MORTON) sampleRowAvx2L<SAMPLER_MORTON>(dst, texture, u, v, count, filter, address);
+	else sampleRowAvx2L<SAMPLER_LINEAR>(dst, texture, u, v, count, filter, address);
+}
+
+// AVX-512 KERNELS
+
+KERNEL_TARGET("avx512f")
+inline void plasmaRowAvx512(uint32_t* dst, const unsigned char* src1, const unsigned char* src2, const uint32_t* palette, int count)
+{
+	int i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i sum = _mm_add_epi8(_mm_loadu_si128((const __m128i*)(src1 + i)), _mm_loadu_si128((const __m128i*)(src2 + i)));
+		// the masked forms, the plain ones trip gcc's uninitialized warnings
+		__m512i index = _mm512_maskz_cvtepu8_epi32(0xFFFF, sum);
+		__m512i colors = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), 0xFFFF, index, (const void*)palette, 4);
+		_mm512_storeu_si512((void*)(dst + i), colors);
+	}
+	plasmaRowScalar(dst + i, src1 + i, src2 + i, palette, count - i);
+}
+
+KERNEL_TARGET("avx512f")
+inline void paletteResolveAvx512(uint32_t* dst, const unsigned char* src, const uint32_t* palette, int count)
+{
+	int i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m512i index = _mm512_maskz_cvtepu8_epi32(0xFFFF, _mm_loadu_si128((const __m128i*)(src + i)));
+		__m512i colors = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), 0xFFFF, index, (const void*)palette, 4);
+		_mm512_storeu_si512((void*)(dst + i), colors);
+	}
+	paletteResolveScalar(dst + i, src + i, palette, count - i);
+}
+
+#endif
+
+
+// VARIANTS, indexed by instruction set. NULL means "use the one below"
+
+PlasmaRowFn plasmaRowVariants[ISA_COUNT];
+FireBlurFn fireBlurVariants[ISA_COUNT];
+SampleRowFn sampleRowVariants[ISA_COUNT];
+MandelbrotRowFn mandelbrotRowVariants[ISA_COUNT];
+SpanFillFn spanFillVariants[ISA_COUNT];
+RngFillFn rngFillVariants[ISA_COUNT];
+TransformSoaFn transformSoaVariants[ISA_COUNT];
+PaletteResolveFn paletteResolveVariants[ISA_COUNT];
+
+inline void kernelsRegisterVariants()
+{
+	plasmaRowVariants[ISA_SCALAR] = plasmaRowScalar;
+	fireBlurVariants[ISA_SCALAR] = fireBlurScalar;
+	sampleRowVariants[ISA_SCALAR] = sampleRowScalar;
+	mandelbrotRowVariants[ISA_SCALAR] = mandelbrotRowScalar;
+	spanFillVariants[ISA_SCALAR] = spanFillScalar;
+	rngFillVariants[ISA_SCALAR] = rngFillScalar;
+	transformSoaVariants[ISA_SCALAR] = transformSoaScalar;
+	paletteResolveVariants[ISA_SCALAR] = paletteResolveScalar;
+#ifdef KERNELS_X86
+	plasmaRowVariants[ISA_SSE2] = plasmaRowSse2;
+	fireBlurVariants[ISA_SSE2] = fireBlurSse2;
+	mandelbrotRowVariants[ISA_SSE2] = mandelbrotRowSse2;
+	rngFillVariants[ISA_SSE2] = rngFillSse2;
+	transformSoaVariants[ISA_SSE2] = transformSoaSse2;
+	paletteResolveVariants[ISA_SSE2] = paletteResolveSse2;
+	sampleRowVariants[ISA_SSE2] = sampleRowSse2;
+	plasmaRowVariants[ISA_AVX2] = plasmaRowAvx2;
+	fireBlurVariants[ISA_AVX2] = fireBlurAvx2;
+	mandelbrotRowVariants[ISA_AVX2] = mandelbrotRowAvx2;
+	rngFillVariants[ISA_AVX2] = rngFillAvx2;
+	transformSoaVariants[ISA_AVX2] = transformSoaAvx2;
+	paletteResolveVariants[ISA_AVX2] = paletteResolveAvx2;
+	sampleRowVariants[ISA_AVX2] = sampleRowAvx2;
+	plasmaRowVariants[ISA_AVX512] = plasmaRowAvx512;
+	paletteResolveVariants[ISA_AVX512] = paletteResolveAvx512;
+#endif
+}
+
+/*
+* best instruction set supported by this CPU and operating system
+*/
+inline KernelIsa cpuDetectIsa()
+{
+#if defined(KERNELS_X86) && (defined(__GNUC__) || defined(__clang__))
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return ISA_AVX512;
+	if (__builtin_cpu_supports("avx2")) return ISA_AVX2;
+	if (__builtin_cpu_supports("sse2")) return ISA_SSE2;
+	return ISA_SCALAR;
+#elif defined(KERNELS_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!sse2) return ISA_SCALAR;
+	if (!osxsave || !avx || maxLeaf < 7) return ISA_SSE2;
+	// the OS must save the ymm (and zmm) registers on context switches
+	unsigned long long xcr0 = _xgetbv(0);
+	__cpuidex(info, 7, 0);
+	bool avx2 = (info[1] & (1 << 5)) != 0;
+	bool avx512f = (info[1] & (1 << 16)) != 0;
+	if (avx512f && (xcr0 & 0xE6) == 0xE6) return ISA_AVX512;
+	if (avx2 && (xcr0 & 0x6) == 0x6) return ISA_AVX2;
+	return ISA_SSE2;
+#else
+	return ISA_SCALAR;
+#endif
+}
+
+/*
+* parse "--isa=avx2" style arguments. returns the instruction set, or
+* ISA_COUNT if arg is not a valid --isa option
+*/
+inline KernelIsa kernelsParseIsa(const char* arg)
+{
+	if (strncmp(arg, "--isa=", 6) != 0) return ISA_COUNT;
+	for (int n = 0; n < ISA_COUNT; n++) {
+		if (strcmp(arg + 6, isaNames[n]) == 0) return (KernelIsa)n;
+	}
+	return ISA_COUNT;
+}
+
+template <class Fn> Fn kernelsPick(Fn* variants, KernelIsa isa, KernelId id)
+{
+	int n = isa;
+	while (variants[n] == NULL) n--;
+	kernelBoundIsa[id] = (KernelIsa)n;
+	return variants[n];
+}
+
+/*
+* bind the kernels table. pass ISA_COUNT to use the best the CPU supports,
+* or a given instruction set to force it (it is lowered if the CPU lacks it)
+*/
+inline void kernelsInit(KernelIsa forced)
+{
+	kernelsRegisterVariants();
+	KernelIsa detected = cpuDetectIsa();
+	kernelsIsa = detected;
+	if (forced != ISA_COUNT) {
+		if (forced > detected) {
+			printf("This CPU does not support %s, using %s\n", isaNames[forced], isaNames[detected]);
+		}
+		else {
+			kernelsIsa = forced;
+		}
+	}
+
+	kernels.plasmaRow = kernelsPick(plasmaRowVariants, kernelsIsa, KERNEL_PLASMA_ROW);
+	kernels.fireBlur = kernelsPick(fireBlurVariants, kernelsIsa, KERNEL_FIRE_BLUR);
+	kernels.sampleRow = kernelsPick(sampleRowVariants, kernelsIsa, KERNEL_SAMPLE_ROW);
+	kernels.mandelbrotRow = kernelsPick(mandelbrotRowVariants, kernelsIsa, KERNEL_MANDELBROT_ROW);
+	kernels.spanFill = kernelsPick(spanFillVariants, kernelsIsa, KERNEL_SPAN_FILL);
+	kernels.rngFill = kernelsPick(rngFillVariants, kernelsIsa, KERNEL_RNG_FILL);
+	kernels.transformSoa = kernelsPick(transformSoaVariants, kernelsIsa, KERNEL_TRANSFORM_SOA);
+	kernels.paletteResolve = kernelsPick(paletteResolveVariants, kernelsIsa, KERNEL_PALETTE_RESOLVE);
+}
+
+inline void kernelsReport()
+{
+	printf("Kernels bound for %s (cpu supports %s):", isaNames[kernelsIsa], isaNames[cpuDetectIsa()]);
+	for (int n = 0; n < KERNEL_COUNT; n++) {
+		printf(" %s=%s", kernelNames[n], isaNames[kernelBoundIsa[n]]);
+	}
+	printf("\n");
+}
+
+#endif
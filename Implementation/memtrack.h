@@ -0,0 +1,388 @@
+#ifndef __MEMTRACK_H_
+#define __MEMTRACK_H_
+
+// Memory accounting per owner effect.
+// Every effect allocates its buffers and loads its images through these
+// helpers, tagging them with its name, so we can report what each effect
+// holds right now, its peak, and how many blocks it has, next to the
+// resident size of the process.
+
+#include <SDL.h>
+#include <SDL_image.h>
+#include <mutex>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+#define MEM_MAX_OWNERS 32
+#define MEM_MAX_SURFACES 256
+#define MEM_MAX_TABLES 64
+#define MEM_HUGE_PAGE (2 * 1024 * 1024)
+
+struct MemOwner {
+	const char* name;
+	size_t current;     // bytes held right now
+	size_t peak;        // highest value of current
+	int blocks;         // live allocations (buffers and surfaces)
+	int allocations;    // allocations ever made
+	int surfaces;       // live SDL surfaces
+};
+
+MemOwner memOwners[MEM_MAX_OWNERS];
+int memNumOwners = 0;
+// the startup tasks allocate from several threads
+std::recursive_mutex memLock;
+
+// every block starts with this header, padded so the data stays 16 byte aligned
+struct MemHeader {
+	size_t size;
+	int owner;
+	int pad[(16 - sizeof(size_t) - sizeof(int)) / sizeof(int)];
+};
+
+// surfaces we are tracking and the owner / size they were charged with
+struct MemSurface {
+	SDL_Surface* surface;
+	int owner;
+	size_t size;
+};
+MemSurface memSurfaces[MEM_MAX_SURFACES];
+int memNumSurfaces = 0;
+
+// pages backing a table from memAllocTable()
+enum MemPages {
+	MEM_PAGES_SMALL,        // 4 KB pages
+	MEM_PAGES_THP,          // transparent huge pages requested with madvise()
+	MEM_PAGES_HUGETLB,      // reserved 2 MB pages (MAP_HUGETLB)
+	MEM_PAGES_HEAP          // plain memAlloc(), no control over the pages
+};
+const char* memPagesNames[] = { "4 KB pages", "transparent huge pages", "hugetlb pages", "heap" };
+
+// large precomputed tables, mapped on their own so they can use huge pages
+struct MemTable {
+	void* pointer;
+	size_t size;
+	size_t mapped;
+	int owner;
+	MemPages pages;
+};
+MemTable memTables[MEM_MAX_TABLES];
+int memNumTables = 0;
+// off maps the tables on 4 KB pages, to measure what the huge pages bring
+bool memHugePages = true;
+// print memReport() when the program closes (--memreport)
+bool memReportOnExit = false;
+
+/*
+* find the slot of an owner, creating it the first time the name is seen
+*/
+inline int memOwnerIndex(const char* owner)
+{
+	for (int n = 0; n < memNumOwners; n++) {
+		if (memOwners[n].name == owner || strcmp(memOwners[n].name, owner) == 0) return n;
+	}
+	if (memNumOwners == MEM_MAX_OWNERS) return MEM_MAX_OWNERS - 1;
+	MemOwner& o = memOwners[memNumOwners];
+	memset(&o, 0, sizeof(o));
+	o.name = owner;
+	return memNumOwners++;
+}
+
+inline void memCharge(int owner, size_t size)
+{
+	MemOwner& o = memOwners[owner];
+	o.current += size;
+	if (o.current > o.peak) o.peak = o.current;
+	o.blocks++;
+	o.allocations++;
+}
+
+inline void memRelease(int owner, size_t size)
+{
+	MemOwner& o = memOwners[owner];
+	o.current -= size;
+	o.blocks--;
+}
+
+/*
+* malloc replacement, the block is charged to owner until memFree()
+*/
+inline void* memAlloc(const char* owner, size_t size)
+{
+	MemHeader* h = (MemHeader*)malloc(sizeof(MemHeader) + size);
+	if (h == NULL) return NULL;
+	std::lock_guard<std::recursive_mutex> guard(memLock);
+	h->size = size;
+	h->owner = memOwnerIndex(owner);
+	memCharge(h->owner, size);
+	return h + 1;
+}
+
+inline void* memCalloc(const char* owner, size_t size)
+{
+	void* p = memAlloc(owner, size);
+	if (p != NULL) memset(p, 0, size);
+	return p;
+}
+
+/*
+* free a block from memAlloc(), NULL is ignored
+*/
+inline void memFree(void* p)
+{
+	if (p == NULL) return;
+	MemHeader* h = (MemHeader*)p - 1;
+	{
+		std::lock_guard<std::recursive_mutex> guard(memLock);
+		memRelease(h->owner, h->size);
+	}
+	free(h);
+}
+
+/*
+* memAlloc() aligned to align bytes, a power of two from 16 up, for data
+* that should start on a cache line. free it with memFreeAligned()
+*/
+inline void* memAllocAligned(const char* owner, size_t size, size_t align)
+{
+	char* raw = (char*)memAlloc(owner, size + align);
+	if (raw == NULL) return NULL;
+	// at least 16 bytes in, room for the block it came from
+	char* p = (char*)(((uintptr_t)raw + align) & ~(uintptr_t)(align - 1));
+	((void**)p)[-1] = raw;
+	return p;
+}
+
+inline void memFreeAligned(void* p)
+{
+	if (p != NULL) memFree(((void**)p)[-1]);
+}
+
+/*
+* allocate a large table that is read every frame, charged to owner until
+* memFreeTable(). it is backed by 2 MB pages when the system has them:
+* reserved hugetlb pages first, otherwise transparent huge pages on a 2 MB
+* aligned mapping. the memory starts zeroed on Linux
+*/
+inline void* memAllocTable(const char* owner, size_t size)
+{
+	std::lock_guard<std::recursive_mutex> guard(memLock);
+	if (memNumTables == MEM_MAX_TABLES) return memAlloc(owner, size);
+	MemTable& t = memTables[memNumTables];
+	t.size = size;
+	t.owner = memOwnerIndex(owner);
+#ifdef __linux__
+	t.mapped = (size + MEM_HUGE_PAGE - 1) & ~(size_t)(MEM_HUGE_PAGE - 1);
+	void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	if (memHugePages) {
+		// fails unless the administrator reserved pages in vm.nr_hugepages
+		p = mmap(NULL, t.mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		t.pages = MEM_PAGES_HUGETLB;
+	}
+#endif
+	if (p == MAP_FAILED) {
+		// map one page more and trim it, so the table starts on a 2 MB boundary
+		size_t extra = memHugePages ? MEM_HUGE_PAGE : 0;
+		char* raw = (char*)mmap(NULL, t.mapped + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (raw == MAP_FAILED) return NULL;
+		char* aligned = raw;
+		if (extra > 0) {
+			aligned = (char*)(((uintptr_t)raw + MEM_HUGE_PAGE - 1) & ~(uintptr_t)(MEM_HUGE_PAGE - 1));
+			if (aligned > raw) munmap(raw, aligned - raw);
+			if (raw + extra > aligned) munmap(aligned + t.mapped, raw + extra - aligned);
+		}
+		p = aligned;
+		t.pages = MEM_PAGES_SMALL;
+#ifdef MADV_HUGEPAGE
+		if (memHugePages && madvise(p, t.mapped, MADV_HUGEPAGE) == 0) t.pages = MEM_PAGES_THP;
+		// with THP set to "always" the kernel would use huge pages anyway
+		if (!memHugePages) madvise(p, t.mapped, MADV_NOHUGEPAGE);
+#endif
+	}
+	t.pointer = p;
+#else
+	t.pointer = malloc(size);
+	if (t.pointer == NULL) return NULL;
+	t.mapped = size;
+	t.pages = MEM_PAGES_HEAP;
+#endif
+	memCharge(t.owner, size);
+	memNumTables++;
+	return t.pointer;
+}
+
+/*
+* free a table from memAllocTable(), NULL is ignored
+*/
+inline void memFreeTable(void* p)
+{
+	if (p == NULL) return;
+	std::lock_guard<std::recursive_mutex> guard(memLock);
+	for (int n = 0; n < memNumTables; n++) {
+		MemTable& t = memTables[n];
+		if (t.pointer != p) continue;
+		memRelease(t.owner, t.size);
+#ifdef __linux__
+		munmap(p, t.mapped);
+#else
+		free(p);
+#endif
+		t = memTables[--memNumTables];
+		return;
+	}
+	// the table list was full, it came from memAlloc()
+	memFree(p);
+}
+
+/*
+* new[] replacement for classes such as VECTOR, release with memDeleteArray()
+*/
+template <class T> T* memNewArray(const char* owner, size_t count)
+{
+	T* p = (T*)memAlloc(owner, count * sizeof(T));
+	if (p == NULL) return NULL;
+	for (size_t n = 0; n < count; n++) new (p + n) T();
+	return p;
+}
+
+template <class T> void memDeleteArray(T* p)
+{
+	if (p == NULL) return;
+	size_t count = ((MemHeader*)p - 1)->size / sizeof(T);
+	for (size_t n = 0; n < count; n++) p[n].~T();
+	memFree(p);
+}
+
+/*
+* charge an SDL surface to owner, it stays charged until memFreeSurface()
+*/
+inline SDL_Surface* memTrackSurface(const char* owner, SDL_Surface* surface)
+{
+	std::lock_guard<std::recursive_mutex> guard(memLock);
+	if (surface == NULL || memNumSurfaces == MEM_MAX_SURFACES) return surface;
+	MemSurface& s = memSurfaces[memNumSurfaces++];
+	s.surface = surface;
+	s.owner = memOwnerIndex(owner);
+	s.size = (size_t)surface->h * surface->pitch;
+	memCharge(s.owner, s.size);
+	memOwners[s.owner].surfaces++;
+	return surface;
+}
+
+/*
+* free a surface, releasing it from its owner if it was tracked
+*/
+inline void memFreeSurface(SDL_Surface* surface)
+{
+	if (surface == NULL) return;
+	std::lock_guard<std::recursive_mutex> guard(memLock);
+	for (int n = 0; n < memNumSurfaces; n++) {
+		if (memSurfaces[n].surface == surface) {
+			memRelease(memSurfaces[n].owner, memSurfaces[n].size);
+			memOwners[memSurfaces[n].owner].surfaces--;
+			memSurfaces[n] = memSurfaces[--memNumSurfaces];
+			break;
+		}
+	}
+	SDL_FreeSurface(surface);
+}
+
+/*
+* load an image and convert it to the given pixel format, charging the result
+* to owner. the decoded temporary surface is freed here. NULL on failure
+*/
+inline SDL_Surface* memLoadImage(const char* owner, const char* path, Uint32 format)
+{
+	SDL_Surface* temp = IMG_Load(path);
+	if (temp == NULL) {
+		printf("Unable to load image %s! SDL_image Error: %s\n", path, IMG_GetError());
+		return NULL;
+	}
+	SDL_Surface* converted = SDL_ConvertSurfaceFormat(temp, format, 0);
+	SDL_FreeSurface(temp);
+	return memTrackSurface(owner, converted);
+}
+
+/*
+* bytes currently held by all owners
+*/
+inline size_t memTrackedBytes()
+{
+	size_t total = 0;
+	for (int n = 0; n < memNumOwners; n++) total += memOwners[n].current;
+	return total;
+}
+
+/*
+* resident set size of the whole process in bytes, 0 if unknown
+*/
+inline size_t residentBytes()
+{
+#ifdef __linux__
+	long pages = 0, resident = 0;
+	FILE* f = fopen("/proc/self/statm", "r");
+	if (f == NULL) return 0;
+	if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+	fclose(f);
+	return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+#elif defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.WorkingSetSize;
+#else
+	return 0;
+#endif
+}
+
+/*
+* highest resident set size the process has reached, 0 if unknown
+*/
+inline size_t peakResidentBytes()
+{
+#ifdef __linux__
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	return (size_t)usage.ru_maxrss * 1024;
+#elif defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	return 0;
+#endif
+}
+
+/*
+* print the per owner table and the process totals
+*/
+inline void memReport()
+{
+	printf("\n%-14s %12s %12s %7s %9s %9s\n", "owner", "current KB", "peak KB", "blocks", "surfaces", "allocs");
+	for (int n = 0; n < memNumOwners; n++) {
+		const MemOwner& o = memOwners[n];
+		printf("%-14s %12.1f %12.1f %7d %9d %9d\n", o.name, o.current / 1024.0, o.peak / 1024.0,
+			o.blocks, o.surfaces, o.allocations);
+	}
+	printf("tracked %.1f KB, resident %.1f KB, peak resident %.1f KB\n",
+		memTrackedBytes() / 1024.0, residentBytes() / 1024.0, peakResidentBytes() / 1024.0);
+	for (int n = 0; n < memNumTables; n++) {
+		const MemTable& t = memTables[n];
+		printf("table of %-14s %9.1f KB on %s\n", memOwners[t.owner].name, t.size / 1024.0, memPagesNames[t.pages]);
+	}
+}
+
+#endif
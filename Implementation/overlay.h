@@ -0,0 +1,311 @@
+#ifndef __OVERLAY_H_
+#define __OVERLAY_H_
+
+// On-screen performance HUD.
+// Drawn straight into the 32 bit framebuffer after the effect has rendered,
+// with an embedded 5x7 bitmap font, so it needs no texture, renderer or
+// font file.
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "memtrack.h"
+
+// sse2 is part of every x86-64 cpu, no dispatch needed
+#if defined(__SSE2__) || defined(_M_X64)
+#define HUD_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define HUD_GLYPH_W 5
+#define HUD_GLYPH_H 7
+// frame times kept for the graph
+#define HUD_GRAPH_SAMPLES 120
+// frame time mapped to the full height of the graph
+#define HUD_GRAPH_MAX_MS 50.0f
+// largest font scale, a scaled glyph row must fit in 64 bits
+#define HUD_MAX_SCALE 12
+
+// glyphs for ASCII 32 to 95, one byte per row, bit 4 is the leftmost pixel.
+// lowercase letters are drawn with the uppercase glyphs
+const unsigned char hudFont[64][HUD_GLYPH_H] = {
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // space
+	{ 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04 }, // !
+	{ 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00, 0x00 }, // "
+	{ 0x0A, 0x1F, 0x0A, 0x0A, 0x0A, 0x1F, 0x0A }, // #
+	{ 0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04 }, // $
+	{ 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 }, // %
+	{ 0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D }, // &
+	{ 0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00 }, // quote
+	{ 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 }, // (
+	{ 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 }, // )
+	{ 0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00 }, // *
+	{ 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 }, // +
+	{ 0x00, 0x00, 0x00, 0x00, 0x06, 0x04, 0x08 }, // ,
+	{ 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 }, // -
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C }, // .
+	{ 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 }, // /
+	{ 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E }, // 0
+	{ 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E }, // 1
+	{ 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F }, // 2
+	{ 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E }, // 3
+	{ 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 }, // 4
+	{ 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E }, // 5
+	{ 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E }, // 6
+	{ 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 }, // 7
+	{ 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E }, // 8
+	{ 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C }, // 9
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 }, // :
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08 }, // ;
+	{ 0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02 }, // <
+	{ 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00 }, // =
+	{ 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08 }, // >
+	{ 0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04 }, // ?
+	{ 0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E }, // @
+	{ 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 }, // A
+	{ 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E }, // B
+	{ 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E }, // C
+	{ 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C }, // D
+	{ 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F }, // E
+	{ 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 }, // F
+	{ 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F }, // G
+	{ 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 }, // H
+	{ 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E }, // I
+	{ 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C }, // J
+	{ 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 }, // K
+	{ 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F }, // L
+	{ 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 }, // M
+	{ 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 }, // N
+	{ 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, // O
+	{ 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 }, // P
+	{ 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D }, // Q
+	{ 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 }, // R
+	{ 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E }, // S
+	{ 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 }, // T
+	{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, // U
+	{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 }, // V
+	{ 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A }, // W
+	{ 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 }, // X
+	{ 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x04 }, // Y
+	{ 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F }, // Z
+	{ 0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E }, // [
+	{ 0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00 }, // backslash
+	{ 0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E }, // ]
+	{ 0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00 }, // ^
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F }, // _
+};
+
+bool hudVisible = false;
+
+// the glyphs rasterized at hudGlyphScale: every font row as a mask of
+// HUD_GLYPH_W * scale pixels, bit 0 the leftmost
+uint64_t hudGlyphRows[64][HUD_GLYPH_H];
+int hudGlyphScale = 0;
+
+// frame history, in milliseconds
+float hudFrameMs[HUD_GRAPH_SAMPLES];
+float hudWorkMs[HUD_GRAPH_SAMPLES];
+int hudFrameCount = 0;
+
+// cost of drawing the HUD itself, measured on the previous frame
+float hudCostMs = 0;
+
+// resident memory, refreshed every HUD_MEMORY_PERIOD frames
+#define HUD_MEMORY_PERIOD 30
+size_t hudResident = 0;
+
+/*
+* remember the duration of the last frame: the whole frame interval and the
+* part of it spent updating and rendering
+*/
+inline void hudAddFrame(float frameMs, float workMs)
+{
+	hudFrameMs[hudFrameCount % HUD_GRAPH_SAMPLES] = frameMs;
+	hudWorkMs[hudFrameCount % HUD_GRAPH_SAMPLES] = workMs;
+	if (hudFrameCount % HUD_MEMORY_PERIOD == 0) hudResident = residentBytes();
+	hudFrameCount++;
+}
+
+/*
+* darken a rectangle so the text stays readable on any effect, four pixels
+* at a time with sse2, two otherwise
+*/
+inline void hudDarken(SDL_Surface* surface, int x, int y, int w, int h)
+{
+	if (x < 0) {
+		w += x;
+		x = 0;
+	}
+	if (y < 0) {
+		h += y;
+		y = 0;
+	}
+	if (x + w > surface->w) w = surface->w - x;
+	if (y + h > surface->h) h = surface->h - y;
+	const uint64_t mask = 0x003F3F3F003F3F3Full, alpha = 0xFF000000FF000000ull;
+	for (int j = y; j < y + h; j++) {
+		Uint32* p = (Uint32*)((Uint8*)surface->pixels + j * surface->pitch) + x;
+		int i = 0;
+#ifdef HUD_SSE2
+		const __m128i mask4 = _mm_set1_epi32(0x3F3F3F), alpha4 = _mm_set1_epi32((int)0xFF000000);
+		for (; i + 4 <= w; i += 4) {
+			__m128i four = _mm_loadu_si128((const __m128i*)(p + i));
+			four = _mm_or_si128(alpha4, _mm_and_si128(_mm_srli_epi32(four, 2), mask4));
+			_mm_storeu_si128((__m128i*)(p + i), four);
+		}
+#endif
+		for (; i + 2 <= w; i += 2) {
+			uint64_t two;
+			memcpy(&two, p + i, 8);
+			two = alpha | ((two >> 2) & mask);
+			memcpy(p + i, &two, 8);
+		}
+		if (i < w) p[i] = 0xFF000000 | ((p[i] >> 2) & 0x3F3F3F);
+	}
+}
+
+/*
+* rasterize the font rows for scale, once per change of scale
+*/
+inline void hudScaleGlyphs(int scale)
+{
+	if (scale == hudGlyphScale) return;
+	uint64_t block = ((uint64_t)1 << scale) - 1;
+	for (int c = 0; c < 64; c++) {
+		for (int row = 0; row < HUD_GLYPH_H; row++) {
+			uint64_t mask = 0;
+			for (int col = 0; col < HUD_GLYPH_W; col++) {
+				if (hudFont[c][row] & (0x10 >> col)) mask |= block << (col * scale);
+			}
+			hudGlyphRows[c][row] = mask;
+		}
+	}
+	hudGlyphScale = scale;
+}
+
+/*
+* fill a solid rectangle, already clipped by the caller
+*/
+inline void hudFill(SDL_Surface* surface, int x, int y, int w, int h, Uint32 color)
+{
+	for (int j = y; j < y + h; j++) {
+		Uint32* p = (Uint32*)((Uint8*)surface->pixels + j * surface->pitch) + x;
+		for (int i = 0; i < w; i++) p[i] = color;
+	}
+}
+
+/*
+* blit a string with the embedded font, every font pixel becomes a
+* scale x scale block. characters falling outside the surface are skipped
+*/
+inline void hudDrawText(SDL_Surface* surface, int x, int y, const char* text, Uint32 color, int scale)
+{
+	if (scale > HUD_MAX_SCALE) scale = HUD_MAX_SCALE;
+	if (y < 0 || y + HUD_GLYPH_H * scale > surface->h) return;
+	hudScaleGlyphs(scale);
+	for (; *text; text++, x += (HUD_GLYPH_W + 1) * scale) {
+		int c = (unsigned char)*text;
+		if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+		if (c < 32 || c > 95) c = '?';
+		if (c == ' ') continue;
+		if (x < 0 || x + HUD_GLYPH_W * scale > surface->w) continue;
+
+		const uint64_t* glyph = hudGlyphRows[c - 32];
+		Uint8* line = (Uint8*)surface->pixels + y * surface->pitch + x * 4;
+		for (int row = 0; row < HUD_GLYPH_H; row++, line += scale * surface->pitch) {
+			uint64_t bits = glyph[row];
+			// every run of set bits is a horizontal line of pixels, the
+			// same on the scale rows of the font row
+			for (int i = 0; bits != 0; ) {
+				while ((bits & 1) == 0) {
+					bits >>= 1;
+					i++;
+				}
+				int start = i;
+				while (bits & 1) {
+					bits >>= 1;
+					i++;
+				}
+				Uint8* l = line;
+				for (int s = 0; s < scale; s++, l += surface->pitch) {
+					Uint32* p = (Uint32*)l;
+					for (int k = start; k < i; k++) p[k] = color;
+				}
+			}
+		}
+	}
+}
+
+/*
+* draw the whole HUD in the top left corner. the surface must be 32 bpp
+*/
+inline void hudRender(SDL_Surface* surface, const char* effect, int beat)
+{
+	if (!hudVisible || hudFrameCount == 0) return;
+	Uint64 start = SDL_GetPerformanceCounter();
+
+	// 2x font at 480 lines, 4x at 1080
+	int scale = surface->h / 240;
+	if (scale < 1) scale = 1;
+	if (scale > HUD_MAX_SCALE) scale = HUD_MAX_SCALE;
+	int lineH = (HUD_GLYPH_H + 2) * scale;
+	int margin = 4 * scale;
+
+	// averages over the frames we have
+	int samples = hudFrameCount < HUD_GRAPH_SAMPLES ? hudFrameCount : HUD_GRAPH_SAMPLES;
+	float frameSum = 0, workSum = 0;
+	for (int n = 0; n < samples; n++) {
+		frameSum += hudFrameMs[n];
+		workSum += hudWorkMs[n];
+	}
+	float frameAvg = frameSum / samples;
+	float fps = frameAvg > 0 ? 1000.0f / frameAvg : 0;
+
+	char lines[4][64];
+	snprintf(lines[0], sizeof(lines[0]), "FPS %5.1f FRAME %5.2f MS CPU %5.2f MS", fps, frameAvg, workSum / samples);
+	snprintf(lines[1], sizeof(lines[1]), "EFFECT %s BEAT %d", effect, beat);
+	snprintf(lines[2], sizeof(lines[2]), "MEM %.1f MB TRACKED %.1f MB", hudResident / (1024.0 * 1024.0),
+		memTrackedBytes() / (1024.0 * 1024.0));
+	snprintf(lines[3], sizeof(lines[3]), "HUD %.3f MS", hudCostMs);
+
+	int graphH = 10 * scale;
+	int panelW = 37 * (HUD_GLYPH_W + 1) * scale + 2 * margin;
+	if (panelW > surface->w) panelW = surface->w;
+	int panelH = 4 * lineH + graphH + 3 * margin;
+	if (panelH > surface->h) return;
+
+	SDL_LockSurface(surface);
+	// only the pixels under the text and the graph are darkened, the rest
+	// of the panel shows the effect
+	for (int n = 0; n < 4; n++) {
+		int textW = (int)strlen(lines[n]) * (HUD_GLYPH_W + 1) * scale;
+		if (textW > panelW - 2 * margin) textW = panelW - 2 * margin;
+		hudDarken(surface, margin - scale, margin + n * lineH - scale, textW + scale, lineH);
+		hudDrawText(surface, margin, margin + n * lineH, lines[n], 0xFFFFFFFF, scale);
+	}
+
+	// frame time graph, oldest sample on the left: green within the 60 fps
+	// budget, yellow within 30 fps, red above
+	int graphY = 2 * margin + 4 * lineH;
+	int barW = (panelW - 2 * margin) / HUD_GRAPH_SAMPLES;
+	if (barW < 1) barW = 1;
+	int graphW = samples * barW < panelW - 2 * margin ? samples * barW : panelW - 2 * margin;
+	hudDarken(surface, margin - scale, graphY - scale, graphW + 2 * scale, graphH + 2 * scale);
+	for (int n = 0; n < samples; n++) {
+		int index = (hudFrameCount - samples + n) % HUD_GRAPH_SAMPLES;
+		float ms = hudFrameMs[index];
+		int h = (int)(graphH * (ms > HUD_GRAPH_MAX_MS ? 1.0f : ms / HUD_GRAPH_MAX_MS));
+		if (h < 1) h = 1;
+		Uint32 color = ms <= 1000.0f / 60 + 1 ? 0xFF40FF40 : (ms <= 1000.0f / 30 + 1 ? 0xFFFFFF40 : 0xFFFF4040);
+		int x = margin + n * barW;
+		if (x + barW > panelW) break;
+		hudFill(surface, x, graphY + graphH - h, barW, h, color);
+	}
+	SDL_UnlockSurface(surface);
+
+	hudCostMs = (float)(1000.0 * (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency());
+}
+
+#endif
@@ -0,0 +1,362 @@
+#ifndef __PATH_H_
+#define __PATH_H_
+
+// Keyframed camera and object paths.
+// A key gives a position and an orientation at a time of the timeline (in
+// ms). Positions follow a cubic Bezier between consecutive keys, with the
+// handles of the keys or, for Catmull-Rom paths, handles derived from the
+// neighbouring keys. Between two keys the position moves at constant speed
+// along the curve: every segment is measured once into an arc length table.
+// Orientations are unit quaternions, interpolated with slerp or squad.
+// pathBuild() samples the whole path every PATH_STEP_MS ms, so pathEval()
+// is O(1) per frame: two table entries blended, no trig, no searching.
+
+#include <math.h>
+#include <vector>
+
+#include "vector.h"
+#include "matrix.h"
+
+#define PATH_STEP_MS 5.0        // time between the samples of the table
+#define PATH_ARC_STEPS 64       // chords measuring the length of a segment
+
+// w + xi + yj + zk
+struct Quat {
+	float w, x, y, z;
+};
+
+enum PathCurve {
+	PATH_CATMULL_ROM,           // handles from the neighbouring keys
+	PATH_BEZIER                 // handles of the keys
+};
+
+enum PathRotation {
+	PATH_SLERP,                 // constant angular speed between keys
+	PATH_SQUAD                  // smooth through the keys
+};
+
+struct PathKey {
+	double time;                // ms, increasing
+	VECTOR position;
+	VECTOR in, out;             // Bezier handles, relative to position
+	Quat rotation;
+};
+
+struct PathSample {
+	VECTOR position;
+	Quat rotation;
+};
+
+struct Path {
+	std::vector<PathKey> keys;
+	bool loop;                  // wraps the time, the last key should match the first
+	std::vector<PathSample> table;
+	double start, duration;
+};
+
+
+// QUATERNIONS
+
+inline Quat quat(float w, float x, float y, float z)
+{
+	Quat q = { w, x, y, z };
+	return q;
+}
+
+inline Quat quatMul(const Quat& a, const Quat& b)
+{
+	return quat(a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+		a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+		a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+		a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w);
+}
+
+inline float quatDot(const Quat& a, const Quat& b)
+{
+	return a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline Quat quatConjugate(const Quat& q)
+{
+	return quat(q.w, -q.x, -q.y, -q.z);
+}
+
+inline Quat quatNormalize(const Quat& q)
+{
+	float n = 1 / sqrtf(quatDot(q, q));
+	return quat(q.w * n, q.x * n, q.y * n, q.z * n);
+}
+
+/*
+* rotation of angle radians around axis (of any length)
+*/
+inline Quat quatAxisAngle(const VECTOR& axis, double angle)
+{
+	VECTOR a = normalize(axis);
+	float s = (float)sin(angle / 2);
+	return quat((float)cos(angle / 2), a[0] * s, a[1] * s, a[2] * s);
+}
+
+/*
+* the same rotation as rotX(ax) * rotY(ay) * rotZ(az): around X first
+*/
+inline Quat quatFromEuler(double ax, double ay, double az)
+{
+	Quat qx = quatAxisAngle(VECTOR(1, 0, 0), ax);
+	Quat qy = quatAxisAngle(VECTOR(0, 1, 0), ay);
+	Quat qz = quatAxisAngle(VECTOR(0, 0, 1), az);
+	return quatMul(qz, quatMul(qy, qx));
+}
+
+/*
+* the MATRIX of a unit quaternion, for VECTOR * MATRIX: its rows are the
+* rotated axes
+*/
+inline MATRIX quatToMatrix(const Quat& q)
+{
+	float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+	float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+	float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+	return MATRIX(1 - 2 * (yy + zz), 2 * (xy + wz), 2 * (xz - wy),
+		2 * (xy - wz), 1 - 2 * (xx + zz), 2 * (yz + wx),
+		2 * (xz + wy), 2 * (yz - wx), 1 - 2 * (xx + yy));
+}
+
+/*
+* the part of q turning around axis (unit length), what is left of it
+* without any tilt away from the axis
+*/
+inline Quat quatTwist(const Quat& q, const VECTOR& axis)
+{
+	float d = q.x * axis[0] + q.y * axis[1] + q.z * axis[2];
+	// a half turn around a perpendicular axis has no twist at all
+	if (q.w * q.w + d * d < 1e-12f) return quat(1, 0, 0, 0);
+	return quatNormalize(quat(q.w, axis[0] * d, axis[1] * d, axis[2] * d));
+}
+
+/*
+* log and exp of unit quaternions, for the squad tangents
+*/
+inline Quat quatLog(const Quat& q)
+{
+	float s = sqrtf(q.x * q.x + q.y * q.y + q.z * q.z);
+	if (s < 1e-6f) return quat(0, q.x, q.y, q.z);
+	float k = atan2f(s, q.w) / s;
+	return quat(0, q.x * k, q.y * k, q.z * k);
+}
+
+inline Quat quatExp(const Quat& q)
+{
+	float a = sqrtf(q.x * q.x + q.y * q.y + q.z * q.z);
+	if (a < 1e-6f) return quatNormalize(quat(1, q.x, q.y, q.z));
+	float k = sinf(a) / a;
+	return quat(cosf(a), q.x * k, q.y * k, q.z * k);
+}
+
+/*
+* shortest arc from a to b, t in [0, 1]
+*/
+inline Quat quatSlerp(const Quat& a, Quat b, float t)
+{
+	float d = quatDot(a, b);
+	if (d < 0) {
+		d = -d;
+		b = quat(-b.w, -b.x, -b.y, -b.z);
+	}
+	float ka, kb;
+	if (d > 0.9995f) {
+		// nearly the same: lerp, normalized below
+		ka = 1 - t;
+		kb = t;
+	}
+	else {
+		float angle = acosf(d), s = 1 / sinf(angle);
+		ka = sinf((1 - t) * angle) * s;
+		kb = sinf(t * angle) * s;
+	}
+	return quatNormalize(quat(ka * a.w + kb * b.w, ka * a.x + kb * b.x, ka * a.y + kb * b.y, ka * a.z + kb * b.z));
+}
+
+/*
+* inner control point of key q between prev and next
+*/
+inline Quat quatSquadTangent(const Quat& prev, const Quat& q, const Quat& next)
+{
+	Quat inv = quatConjugate(q);
+	Quat a = quatLog(quatMul(inv, next)), b = quatLog(quatMul(inv, prev));
+	return quatMul(q, quatExp(quat(0, -(a.x + b.x) / 4, -(a.y + b.y) / 4, -(a.z + b.z) / 4)));
+}
+
+/*
+* from q0 to q1 with the tangents s0, s1 of quatSquadTangent()
+*/
+inline Quat quatSquad(const Quat& q0, const Quat& q1, const Quat& s0, const Quat& s1, float t)
+{
+	return quatSlerp(quatSlerp(q0, q1, t), quatSlerp(s0, s1, t), 2 * t * (1 - t));
+}
+
+
+// PATHS
+
+/*
+* add a key, in time order. the handles only matter for PATH_BEZIER
+*/
+inline void pathAddKey(Path& p, double time, const VECTOR& position, const Quat& rotation,
+	const VECTOR& in = VECTOR(), const VECTOR& out = VECTOR())
+{
+	PathKey k;
+	k.time = time;
+	k.position = position;
+	k.in = in;
+	k.out = out;
+	k.rotation = quatNormalize(rotation);
+	p.keys.push_back(k);
+}
+
+inline VECTOR pathBezier(const VECTOR& p0, const VECTOR& p1, const VECTOR& p2, const VECTOR& p3, float u)
+{
+	float v = 1 - u;
+	float b0 = v * v * v, b1 = 3 * v * v * u, b2 = 3 * v * u * u, b3 = u * u * u;
+	return VECTOR(b0 * p0[0] + b1 * p1[0] + b2 * p2[0] + b3 * p3[0],
+		b0 * p0[1] + b1 * p1[1] + b2 * p2[1] + b3 * p3[1],
+		b0 * p0[2] + b1 * p1[2] + b2 * p2[2] + b3 * p3[2]);
+}
+
+inline float pathDistance(const VECTOR& a, const VECTOR& b)
+{
+	VECTOR d = a - b;
+	return sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+}
+
+/*
+* neighbour n of key k, wrapping over the closing key of a loop or
+* clamped at the ends
+*/
+inline int pathNeighbour(const Path& p, int k, int n)
+{
+	int count = (int)p.keys.size();
+	int i = k + n;
+	if (p.loop) {
+		// the last key is the first one again
+		if (i < 0) i += count - 1;
+		if (i > count - 1) i -= count - 1;
+	}
+	if (i < 0) i = 0;
+	if (i > count - 1) i = count - 1;
+	return i;
+}
+
+/*
+* precompute the table. needs two keys or more
+*/
+inline void pathBuild(Path& p, PathCurve curve, PathRotation rotation)
+{
+	int count = (int)p.keys.size();
+	p.table.clear();
+	p.start = count > 0 ? p.keys[0].time : 0;
+	p.duration = count > 1 ? p.keys[count - 1].time - p.start : 0;
+	if (count < 2) return;
+
+	// every key in the hemisphere of the previous one, so nothing spins the long way
+	for (int k = 1; k < count; k++) {
+		Quat& q = p.keys[k].rotation;
+		if (quatDot(p.keys[k - 1].rotation, q) < 0) q = quat(-q.w, -q.x, -q.y, -q.z);
+	}
+	// Catmull-Rom as Bezier: the handles are a sixth of the chord around the key
+	if (curve == PATH_CATMULL_ROM) {
+		for (int k = 0; k < count; k++) {
+			VECTOR chord = p.keys[pathNeighbour(p, k, 1)].position - p.keys[pathNeighbour(p, k, -1)].position;
+			VECTOR out(chord[0] / 6, chord[1] / 6, chord[2] / 6);
+			p.keys[k].out = out;
+			p.keys[k].in = VECTOR() - out;
+		}
+	}
+	std::vector<Quat> tangents(count);
+	for (int k = 0; k < count; k++) {
+		const Quat& q = p.keys[k].rotation;
+		Quat prev = p.keys[pathNeighbour(p, k, -1)].rotation, next = p.keys[pathNeighbour(p, k, 1)].rotation;
+		if (quatDot(prev, q) < 0) prev = quat(-prev.w, -prev.x, -prev.y, -prev.z);
+		if (quatDot(next, q) < 0) next = quat(-next.w, -next.x, -next.y, -next.z);
+		tangents[k] = quatSquadTangent(prev, q, next);
+	}
+
+	int samples = (int)ceil(p.duration / PATH_STEP_MS) + 1;
+	p.table.resize(samples);
+	int segment = -1;
+	VECTOR c0, c1, c2, c3;
+	float arc[PATH_ARC_STEPS + 1];
+	for (int n = 0; n < samples; n++) {
+		double t = p.start + n * PATH_STEP_MS;
+		if (t > p.keys[count - 1].time) t = p.keys[count - 1].time;
+		// the table goes forward, so does the segment
+		bool changed = false;
+		while (segment < count - 2 && (segment < 0 || t > p.keys[segment + 1].time)) {
+			segment++;
+			changed = true;
+		}
+		const PathKey& k0 = p.keys[segment];
+		const PathKey& k1 = p.keys[segment + 1];
+		if (changed) {
+			c0 = k0.position;
+			c1 = k0.position + k0.out;
+			c2 = k1.position + k1.in;
+			c3 = k1.position;
+			arc[0] = 0;
+			VECTOR last = c0;
+			for (int a = 1; a <= PATH_ARC_STEPS; a++) {
+				VECTOR here = pathBezier(c0, c1, c2, c3, (float)a / PATH_ARC_STEPS);
+				arc[a] = arc[a - 1] + pathDistance(last, here);
+				last = here;
+			}
+		}
+		double span = k1.time - k0.time;
+		float s = span > 0 ? (float)((t - k0.time) / span) : 1.0f;
+		if (s < 0) s = 0;
+		if (s > 1) s = 1;
+		// the share s of the time is the share s of the length
+		float target = s * arc[PATH_ARC_STEPS];
+		int a = 0;
+		while (a < PATH_ARC_STEPS - 1 && arc[a + 1] < target) a++;
+		float chord = arc[a + 1] - arc[a];
+		float u = (a + (chord > 0 ? (target - arc[a]) / chord : 0)) / PATH_ARC_STEPS;
+		p.table[n].position = pathBezier(c0, c1, c2, c3, u);
+		p.table[n].rotation = rotation == PATH_SQUAD ?
+			quatSquad(k0.rotation, k1.rotation, tangents[segment], tangents[segment + 1], s) :
+			quatSlerp(k0.rotation, k1.rotation, s);
+	}
+}
+
+/*
+* position and orientation at time ms of the timeline. loops wrap, other
+* paths hold their first and last keys outside of them
+*/
+inline void pathEval(const Path& p, double time, VECTOR& position, Quat& rotation)
+{
+	if (p.table.empty()) {
+		position = p.keys.empty() ? VECTOR() : p.keys[0].position;
+		rotation = p.keys.empty() ? quat(1, 0, 0, 0) : p.keys[0].rotation;
+		return;
+	}
+	double t = time - p.start;
+	if (p.loop && p.duration > 0) t -= floor(t / p.duration) * p.duration;
+	double f = t / PATH_STEP_MS;
+	int last = (int)p.table.size() - 1;
+	if (f <= 0) f = 0;
+	if (f >= last) f = last;
+	int n = (int)f;
+	if (n == last) n = last - (last > 0 ? 1 : 0);
+	float w = (float)(f - n);
+	const PathSample& a = p.table[n];
+	const PathSample& b = p.table[n + (last > 0 ? 1 : 0)];
+	position = VECTOR(a.position[0] + (b.position[0] - a.position[0]) * w,
+		a.position[1] + (b.position[1] - a.position[1]) * w,
+		a.position[2] + (b.position[2] - a.position[2]) * w);
+	// samples this close together: the normalized lerp is as good as a slerp
+	float sign = quatDot(a.rotation, b.rotation) < 0 ? -1.0f : 1.0f;
+	rotation = quatNormalize(quat(a.rotation.w + (sign * b.rotation.w - a.rotation.w) * w,
+		a.rotation.x + (sign * b.rotation.x - a.rotation.x) * w,
+		a.rotation.y + (sign * b.rotation.y - a.rotation.y) * w,
+		a.rotation.z + (sign * b.rotation.z - a.rotation.z) * w));
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef __PERFCOUNTERS_H_
+#define __PERFCOUNTERS_H_
+
+// Hardware performance counters (Linux perf_event_open).
+// Counters are opened per process/thread and read around a block of code;
+// on other systems, or when the kernel refuses (perf_event_paranoid, VMs
+// without a PMU), every counter simply reports as unavailable.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+enum PerfCounterId {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_L1D_MISSES,
+	PERF_LLC_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_DTLB_MISSES,
+	PERF_NUM_COUNTERS
+};
+
+const char* perfCounterNames[PERF_NUM_COUNTERS] = {
+	"cycles", "instructions", "L1D-load-misses", "LLC-misses", "branch-misses", "dTLB-load-misses"
+};
+
+// one snapshot of all counters
+struct PerfSample {
+	uint64_t value[PERF_NUM_COUNTERS];
+};
+
+// file descriptors of the opened counters, -1 if not available
+int perfFds[PERF_NUM_COUNTERS] = { -1, -1, -1, -1, -1, -1 };
+
+#ifdef __linux__
+inline int perfOpen(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	// the counters may be multiplexed, ask for the times to scale them back
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	// pid 0, cpu -1: this thread on whatever cpu it runs
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+/*
+* open all the counters we know about. returns how many could be opened
+*/
+inline int perfInit()
+{
+	int opened = 0;
+#ifdef __linux__
+	perfFds[PERF_CYCLES] = perfOpen(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	perfFds[PERF_INSTRUCTIONS] = perfOpen(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	perfFds[PERF_L1D_MISSES] = perfOpen(PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	perfFds[PERF_LLC_MISSES] = perfOpen(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	perfFds[PERF_BRANCH_MISSES] = perfOpen(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+	perfFds[PERF_DTLB_MISSES] = perfOpen(PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+#endif
+	for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+		if (perfFds[c] >= 0) opened++;
+		else printf("Performance counter %s not available\n", perfCounterNames[c]);
+	}
+	return opened;
+}
+
+inline bool perfAvailable(int counter)
+{
+	return perfFds[counter] >= 0;
+}
+
+/*
+* read all counters, scaled up when the kernel had to multiplex them
+*/
+inline void perfRead(PerfSample* sample)
+{
+	for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+		sample->value[c] = 0;
+#ifdef __linux__
+		if (perfFds[c] < 0) continue;
+		uint64_t data[3]; // value, time enabled, time running
+		if (read(perfFds[c], data, sizeof(data)) != sizeof(data)) continue;
+		if (data[2] != 0 && data[2] < data[1])
+			sample->value[c] = (uint64_t)((double)data[0] * data[1] / data[2]);
+		else
+			sample->value[c] = data[0];
+#endif
+	}
+}
+
+/*
+* accumulate the difference between two samples into total
+*/
+inline void perfAccumulate(PerfSample* total, const PerfSample& before, const PerfSample& after)
+{
+	for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+		total->value[c] += after.value[c] - before.value[c];
+	}
+}
+
+inline void perfClose()
+{
+	for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+#ifdef __linux__
+		if (perfFds[c] >= 0) close(perfFds[c]);
+#endif
+		perfFds[c] = -1;
+	}
+}
+
+#endif
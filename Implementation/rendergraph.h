@@ -0,0 +1,279 @@
+#ifndef __RENDERGRAPH_H_
+#define __RENDERGRAPH_H_
+
+// Frame render graph.
+// Every node declares the buffers it reads and writes. Compiling the graph
+// orders the nodes into levels (nodes of one level do not depend on each
+// other and run in parallel on the thread pool) and works out in which
+// levels every transient buffer is alive. Transients whose lifetimes do not
+// overlap share the same memory, so the memory of a graph depends on how
+// many buffers are alive at once, not on how many nodes it has.
+// Nodes are scheduled as late as possible, which keeps the lifetimes short.
+
+#include <functional>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+#include "memtrack.h"
+#include "threadpool.h"
+#include "trace.h"
+
+typedef int GraphBuffer;
+
+struct GraphBufferDesc {
+	const char* name;
+	int width, height;
+	bool external;          // imported, never aliased nor freed
+	uint32_t* pixels;
+	int pitch;              // in pixels
+	int first, last;        // levels where it is alive
+	int slot;               // pool slot of a transient
+};
+
+struct GraphNode {
+	const char* name;       // a string literal, it ends up in the trace
+	std::vector<GraphBuffer> inputs, outputs;
+	std::function<void()> execute;
+	int level;
+};
+
+// shared memory of the transients
+struct GraphSlot {
+	size_t bytes;
+	int last;               // last level using it while assigning
+	uint32_t* memory;
+};
+
+struct RenderGraph {
+	std::vector<GraphBufferDesc> buffers;
+	std::vector<GraphNode> nodes;
+	std::vector<GraphSlot> slots;
+	int levels = 0;
+	bool aliasing = true;   // off gives every transient its own memory, to compare
+};
+
+inline GraphBuffer graphCreateTransient(RenderGraph& g, const char* name, int width, int height)
+{
+	GraphBufferDesc b;
+	b.name = name;
+	b.width = width;
+	b.height = height;
+	b.external = false;
+	b.pixels = NULL;
+	b.pitch = width;
+	b.first = -1;
+	b.last = -1;
+	b.slot = -1;
+	g.buffers.push_back(b);
+	return (GraphBuffer)g.buffers.size() - 1;
+}
+
+/*
+* use memory owned by someone else (the screen) as a graph buffer
+*/
+inline GraphBuffer graphImport(RenderGraph& g, const char* name, int width, int height, uint32_t* pixels, int pitch)
+{
+	GraphBuffer b = graphCreateTransient(g, name, width, height);
+	g.buffers[b].external = true;
+	g.buffers[b].pixels = pixels;
+	g.buffers[b].pitch = pitch;
+	return b;
+}
+
+/*
+* add a node. nodes must be added in an order that works when run one
+* after the other, the graph finds what can run in parallel
+*/
+inline void graphAddNode(RenderGraph& g, const char* name, std::vector<GraphBuffer> inputs, std::vector<GraphBuffer> outputs,
+	std::function<void()> execute)
+{
+	GraphNode n;
+	n.name = name;
+	n.inputs = inputs;
+	n.outputs = outputs;
+	n.execute = execute;
+	n.level = 0;
+	g.nodes.push_back(n);
+}
+
+inline uint32_t* graphPixels(const RenderGraph& g, GraphBuffer b)
+{
+	return g.buffers[b].pixels;
+}
+
+inline int graphPitch(const RenderGraph& g, GraphBuffer b)
+{
+	return g.buffers[b].pitch;
+}
+
+inline size_t graphBufferBytes(const GraphBufferDesc& b)
+{
+	return (size_t)b.width * b.height * sizeof(uint32_t);
+}
+
+inline void graphRelease(RenderGraph& g)
+{
+	for (size_t s = 0; s < g.slots.size(); s++) memFree(g.slots[s].memory);
+	g.slots.clear();
+}
+
+/*
+* levels, lifetimes and memory. call again after adding nodes
+*/
+inline void graphCompile(RenderGraph& g)
+{
+	graphRelease(g);
+	const int count = (int)g.nodes.size();
+
+	// dependencies: a node runs after the last writer of every buffer it
+	// touches, and a writer after everyone who read the previous contents
+	std::vector<std::vector<int> > after(count);
+	std::vector<int> lastWriter(g.buffers.size(), -1);
+	std::vector<std::vector<int> > readers(g.buffers.size());
+	for (int n = 0; n < count; n++) {
+		GraphNode& node = g.nodes[n];
+		for (size_t i = 0; i < node.inputs.size(); i++) {
+			GraphBuffer b = node.inputs[i];
+			if (lastWriter[b] >= 0) after[n].push_back(lastWriter[b]);
+		}
+		for (size_t o = 0; o < node.outputs.size(); o++) {
+			GraphBuffer b = node.outputs[o];
+			if (lastWriter[b] >= 0) after[n].push_back(lastWriter[b]);
+			for (size_t r = 0; r < readers[b].size(); r++) {
+				if (readers[b][r] != n) after[n].push_back(readers[b][r]);
+			}
+		}
+		for (size_t i = 0; i < node.inputs.size(); i++) readers[node.inputs[i]].push_back(n);
+		for (size_t o = 0; o < node.outputs.size(); o++) {
+			lastWriter[node.outputs[o]] = n;
+			readers[node.outputs[o]].clear();
+		}
+	}
+
+	// as soon as possible gives the number of levels...
+	g.levels = 0;
+	for (int n = 0; n < count; n++) {
+		int level = 0;
+		for (size_t d = 0; d < after[n].size(); d++) {
+			if (g.nodes[after[n][d]].level + 1 > level) level = g.nodes[after[n][d]].level + 1;
+		}
+		g.nodes[n].level = level;
+		if (level + 1 > g.levels) g.levels = level + 1;
+	}
+	// ...then as late as possible, so buffers are produced right before use
+	std::vector<int> latest(count, g.levels - 1);
+	for (int n = count - 1; n >= 0; n--) {
+		g.nodes[n].level = latest[n];
+		for (size_t d = 0; d < after[n].size(); d++) {
+			int dep = after[n][d];
+			if (latest[n] - 1 < latest[dep]) latest[dep] = latest[n] - 1;
+		}
+	}
+
+	// lifetimes
+	for (size_t b = 0; b < g.buffers.size(); b++) {
+		g.buffers[b].first = -1;
+		g.buffers[b].last = -1;
+	}
+	for (int n = 0; n < count; n++) {
+		const GraphNode& node = g.nodes[n];
+		for (int pass = 0; pass < 2; pass++) {
+			const std::vector<GraphBuffer>& list = pass ? node.outputs : node.inputs;
+			for (size_t k = 0; k < list.size(); k++) {
+				GraphBufferDesc& b = g.buffers[list[k]];
+				if (b.first < 0 || node.level < b.first) b.first = node.level;
+				if (node.level > b.last) b.last = node.level;
+			}
+		}
+	}
+
+	// give the transients memory, in order of first use, reusing any slot
+	// whose previous user is dead by then
+	std::vector<int> order;
+	for (size_t b = 0; b < g.buffers.size(); b++) {
+		if (!g.buffers[b].external && g.buffers[b].first >= 0) order.push_back((int)b);
+	}
+	for (size_t i = 1; i < order.size(); i++) {
+		for (size_t k = i; k > 0 && g.buffers[order[k]].first < g.buffers[order[k - 1]].first; k--) {
+			std::swap(order[k], order[k - 1]);
+		}
+	}
+	for (size_t i = 0; i < order.size(); i++) {
+		GraphBufferDesc& b = g.buffers[order[i]];
+		b.slot = -1;
+		if (g.aliasing) {
+			for (size_t s = 0; s < g.slots.size(); s++) {
+				if (g.slots[s].last < b.first) {
+					b.slot = (int)s;
+					break;
+				}
+			}
+		}
+		if (b.slot < 0) {
+			GraphSlot slot;
+			slot.bytes = 0;
+			slot.memory = NULL;
+			g.slots.push_back(slot);
+			b.slot = (int)g.slots.size() - 1;
+		}
+		GraphSlot& slot = g.slots[b.slot];
+		slot.last = b.last;
+		if (graphBufferBytes(b) > slot.bytes) slot.bytes = graphBufferBytes(b);
+	}
+	for (size_t s = 0; s < g.slots.size(); s++) {
+		g.slots[s].memory = (uint32_t*)memAlloc("rendergraph", g.slots[s].bytes);
+	}
+	for (size_t i = 0; i < order.size(); i++) {
+		GraphBufferDesc& b = g.buffers[order[i]];
+		b.pixels = g.slots[b.slot].memory;
+		b.pitch = b.width;
+	}
+}
+
+/*
+* run the nodes level after level, the nodes of a level in parallel when
+* a pool is given
+*/
+inline void graphExecute(RenderGraph& g, ThreadPool* pool)
+{
+	TRACE_ZONE("graph");
+	for (int level = 0; level < g.levels; level++) {
+		for (size_t n = 0; n < g.nodes.size(); n++) {
+			GraphNode& node = g.nodes[n];
+			if (node.level != level) continue;
+			if (pool != NULL) {
+				poolSubmit(*pool, [&node]() {
+					TraceZone zone(node.name);
+					node.execute();
+				});
+			}
+			else {
+				TraceZone zone(node.name);
+				node.execute();
+			}
+		}
+		if (pool != NULL) poolWait(*pool);
+	}
+}
+
+/*
+* memory of the transients as allocated, and as it would be without aliasing
+*/
+inline size_t graphPooledBytes(const RenderGraph& g)
+{
+	size_t total = 0;
+	for (size_t s = 0; s < g.slots.size(); s++) total += g.slots[s].bytes;
+	return total;
+}
+
+inline size_t graphNaiveBytes(const RenderGraph& g)
+{
+	size_t total = 0;
+	for (size_t b = 0; b < g.buffers.size(); b++) {
+		if (!g.buffers[b].external) total += graphBufferBytes(g.buffers[b]);
+	}
+	return total;
+}
+
+#endif
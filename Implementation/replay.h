@@ -0,0 +1,275 @@
+#ifndef __REPLAY_H_
+#define __REPLAY_H_
+
+// Input recording and deterministic replay.
+// A recording is a stream of fixed size records in frame order: every SDL
+// event with the simulation frame it was handled on, and after the events of
+// a frame the hash of the pixels it rendered. Replaying under the fixed clock
+// hands the events to the demo on the same frames, so the whole session runs
+// again headlessly and every frame can be compared with the recorded hash.
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#define REPLAY_VERSION 3            // the frame hashes change with the effects, bump with FRAME_CACHE_VERSION
+#define REPLAY_HASH 0u              // record type of a frame hash (SDL_FIRSTEVENT is never sent)
+#define REPLAY_END 0xFFFFFFFFu      // last record, its frame is the number of frames played
+
+struct ReplayHeader {
+	char magic[4];                  // "DEV1"
+	uint32_t version;
+	int32_t width, height;
+};
+
+// an event keeps the fields the demo can use, a hash keeps its two halves in a, b
+struct ReplayRecord {
+	uint32_t frame;
+	uint32_t type;
+	int32_t a, b, c;
+};
+
+struct Replay {
+	FILE* file;                     // open while recording
+	std::vector<ReplayRecord> records;
+	size_t next;                    // replay cursor
+	int frames;                     // frames in the recording
+	int compared, mismatches, firstMismatch;
+};
+
+/*
+* FNV-1a over the visible 32 bit pixels, a whole pixel at a time. the
+* padding at the end of the rows is skipped
+*/
+inline uint64_t replayHashFrame(const void* pixels, int pitch, int width, int height)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (int j = 0; j < height; j++) {
+		const uint32_t* p = (const uint32_t*)((const unsigned char*)pixels + (size_t)j * pitch);
+		for (int i = 0; i < width; i++) {
+			hash ^= p[i];
+			hash *= 1099511628211ull;
+		}
+	}
+	return hash;
+}
+
+inline ReplayRecord replayEncode(uint32_t frame, const SDL_Event& e)
+{
+	ReplayRecord r;
+	r.frame = frame;
+	r.type = e.type;
+	r.a = r.b = r.c = 0;
+	switch (e.type) {
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+		r.a = e.key.keysym.scancode;
+		r.b = e.key.keysym.sym;
+		r.c = e.key.keysym.mod | (e.key.repeat << 16) | (e.key.state << 24);
+		break;
+	case SDL_MOUSEMOTION:
+		r.a = e.motion.x;
+		r.b = e.motion.y;
+		r.c = (int32_t)e.motion.state;
+		break;
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+		r.a = e.button.x;
+		r.b = e.button.y;
+		r.c = e.button.button | (e.button.clicks << 8) | (e.button.state << 16);
+		break;
+	case SDL_MOUSEWHEEL:
+		r.a = e.wheel.x;
+		r.b = e.wheel.y;
+		r.c = (int32_t)e.wheel.direction;
+		break;
+	case SDL_WINDOWEVENT:
+		r.a = e.window.event;
+		r.b = e.window.data1;
+		r.c = e.window.data2;
+		break;
+	}
+	return r;
+}
+
+inline void replayDecode(const ReplayRecord& r, SDL_Event* e)
+{
+	memset(e, 0, sizeof(*e));
+	e->type = r.type;
+	switch (r.type) {
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+		e->key.keysym.scancode = (SDL_Scancode)r.a;
+		e->key.keysym.sym = r.b;
+		e->key.keysym.mod = (Uint16)r.c;
+		e->key.repeat = (Uint8)(r.c >> 16);
+		e->key.state = (Uint8)(r.c >> 24);
+		break;
+	case SDL_MOUSEMOTION:
+		e->motion.x = r.a;
+		e->motion.y = r.b;
+		e->motion.state = (Uint32)r.c;
+		break;
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+		e->button.x = r.a;
+		e->button.y = r.b;
+		e->button.button = (Uint8)r.c;
+		e->button.clicks = (Uint8)(r.c >> 8);
+		e->button.state = (Uint8)(r.c >> 16);
+		break;
+	case SDL_MOUSEWHEEL:
+		e->wheel.x = r.a;
+		e->wheel.y = r.b;
+		e->wheel.direction = (Uint32)r.c;
+		break;
+	case SDL_WINDOWEVENT:
+		e->window.event = (Uint8)r.a;
+		e->window.data1 = r.b;
+		e->window.data2 = r.c;
+		break;
+	}
+}
+
+inline void replayWrite(Replay& replay, const ReplayRecord& r)
+{
+	if (replay.file != NULL) fwrite(&r, sizeof(r), 1, replay.file);
+}
+
+inline bool replayRecordBegin(Replay& replay, const char* path, int width, int height)
+{
+	replay.file = fopen(path, "wb");
+	if (replay.file == NULL) {
+		printf("Unable to create the recording %s!\n", path);
+		return false;
+	}
+	ReplayHeader header;
+	memcpy(header.magic, "DEV1", 4);
+	header.version = REPLAY_VERSION;
+	header.width = width;
+	header.height = height;
+	fwrite(&header, sizeof(header), 1, replay.file);
+	replay.frames = 0;
+	return true;
+}
+
+inline void replayRecordEvent(Replay& replay, int frame, const SDL_Event& e)
+{
+	replayWrite(replay, replayEncode((uint32_t)frame, e));
+}
+
+inline void replayRecordFrame(Replay& replay, int frame, uint64_t hash)
+{
+	ReplayRecord r;
+	r.frame = (uint32_t)frame;
+	r.type = REPLAY_HASH;
+	r.a = (int32_t)(uint32_t)hash;
+	r.b = (int32_t)(uint32_t)(hash >> 32);
+	r.c = 0;
+	replayWrite(replay, r);
+	replay.frames = frame + 1;
+}
+
+inline void replayRecordEnd(Replay& replay, int frames)
+{
+	if (replay.file == NULL) return;
+	ReplayRecord r;
+	r.frame = (uint32_t)frames;
+	r.type = REPLAY_END;
+	r.a = r.b = r.c = 0;
+	replayWrite(replay, r);
+	fclose(replay.file);
+	replay.file = NULL;
+}
+
+/*
+* read a whole recording, it must have been made at the same resolution
+*/
+inline bool replayLoad(Replay& replay, const char* path, int width, int height)
+{
+	replay.file = NULL;
+	replay.records.clear();
+	replay.next = 0;
+	replay.frames = 0;
+	replay.compared = replay.mismatches = 0;
+	replay.firstMismatch = -1;
+
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) {
+		printf("Unable to open the recording %s!\n", path);
+		return false;
+	}
+	ReplayHeader header;
+	bool ok = fread(&header, sizeof(header), 1, f) == 1 && memcmp(header.magic, "DEV1", 4) == 0 &&
+		header.version == REPLAY_VERSION;
+	if (!ok) printf("%s is not a recording of this version\n", path);
+	else if (header.width != width || header.height != height) {
+		printf("%s was recorded at %dx%d\n", path, header.width, header.height);
+		ok = false;
+	}
+	ReplayRecord r;
+	bool ended = false;
+	while (ok && fread(&r, sizeof(r), 1, f) == 1) {
+		if (r.type == REPLAY_END) {
+			replay.frames = (int)r.frame;
+			ended = true;
+			break;
+		}
+		replay.records.push_back(r);
+	}
+	fclose(f);
+	if (ok && !ended) {
+		// the recording session crashed, keep what was written
+		printf("%s is truncated, replaying its %d records\n", path, (int)replay.records.size());
+		replay.frames = replay.records.empty() ? 0 : (int)replay.records.back().frame + 1;
+	}
+	return ok;
+}
+
+/*
+* next event handled on frame, false when there are no more for it
+*/
+inline bool replayNextEvent(Replay& replay, int frame, SDL_Event* e)
+{
+	if (replay.next >= replay.records.size()) return false;
+	const ReplayRecord& r = replay.records[replay.next];
+	if (r.frame != (uint32_t)frame || r.type == REPLAY_HASH) return false;
+	replayDecode(r, e);
+	replay.next++;
+	return true;
+}
+
+/*
+* compare a replayed frame with the recording. frames recorded without a
+* hash are not compared
+*/
+inline void replayCheckFrame(Replay& replay, int frame, uint64_t hash)
+{
+	// events that were not consumed belong to an earlier frame, skip them
+	while (replay.next < replay.records.size() && replay.records[replay.next].frame < (uint32_t)frame) replay.next++;
+	if (replay.next >= replay.records.size()) return;
+	const ReplayRecord& r = replay.records[replay.next];
+	if (r.frame != (uint32_t)frame || r.type != REPLAY_HASH) return;
+	replay.next++;
+	uint64_t recorded = (uint64_t)(uint32_t)r.a | ((uint64_t)(uint32_t)r.b << 32);
+	replay.compared++;
+	if (recorded != hash) {
+		if (replay.mismatches == 0) replay.firstMismatch = frame;
+		replay.mismatches++;
+	}
+}
+
+/*
+* print the result of a replay, true when every compared frame matched
+*/
+inline bool replayReport(const Replay& replay)
+{
+	printf("replay: %d frames, %d compared, %d different", replay.frames, replay.compared, replay.mismatches);
+	if (replay.mismatches > 0) printf(" (first at frame %d)", replay.firstMismatch);
+	printf("\n");
+	return replay.mismatches == 0;
+}
+
+#endif
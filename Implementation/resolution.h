@@ -0,0 +1,124 @@
+#ifndef __RESOLUTION_H_
+#define __RESOLUTION_H_
+
+// Per-pixel effects specialized on the screen size.
+// An effect kernel is a struct template on width and height with a static
+// run(). It is instantiated for the standard modes, where the size and the
+// row stride are constants the compiler folds into the loops, and for 0x0,
+// the generic fallback that reads them from the target. The mode is picked
+// once per frame from the surface; every kernel call after that is a table
+// lookup. Effects whose buffers are laid out for the screen size keep a
+// ModeBuffer per mode with a copy at the target size.
+
+#include <SDL.h>
+#include <stdint.h>
+
+#include "memtrack.h"
+
+enum ResolutionMode {
+	RES_640x480,
+	RES_1280x720,
+	RES_1920x1080,
+	RES_GENERIC,
+	RES_COUNT
+};
+
+const char* resolutionNames[RES_COUNT] = { "640x480", "1280x720", "1920x1080", "generic" };
+
+// a 32 bit surface as the kernels see it
+struct RenderTarget {
+	uint32_t* pixels;
+	int width, height;
+	int pitch;          // in pixels
+};
+
+// compile-time size of a kernel instantiation, 0 takes it from the target
+template<int W, int H>
+struct Resolution {
+	static int width(const RenderTarget& t) { return W ? W : t.width; }
+	static int height(const RenderTarget& t) { return H ? H : t.height; }
+	// the standard modes are only picked when the rows are packed
+	static int pitch(const RenderTarget& t) { return W ? W : t.pitch; }
+};
+
+/*
+* the mode of a surface. the specialized kernels write 32 bit pixels with
+* no padding between rows, anything else gets the generic ones
+*/
+inline ResolutionMode resolutionPick(const SDL_Surface* surface)
+{
+	if (surface->format->BytesPerPixel != 4 || surface->pitch != surface->w * 4) return RES_GENERIC;
+	if (surface->w == 640 && surface->h == 480) return RES_640x480;
+	if (surface->w == 1280 && surface->h == 720) return RES_1280x720;
+	if (surface->w == 1920 && surface->h == 1080) return RES_1920x1080;
+	return RES_GENERIC;
+}
+
+inline RenderTarget resolutionTarget(SDL_Surface* surface)
+{
+	RenderTarget t;
+	t.pixels = (uint32_t*)surface->pixels;
+	t.width = surface->w;
+	t.height = surface->h;
+	t.pitch = surface->pitch / 4;
+	return t;
+}
+
+// an effect buffer at the size of one mode, one byte per element
+struct ModeBuffer {
+	unsigned char* pixels;
+	int width, height;
+};
+
+/*
+* size b for width x height, returns true when it was (re)allocated and
+* needs to be filled
+*/
+inline bool modeBufferEnsure(ModeBuffer& b, const char* owner, int width, int height)
+{
+	if (b.pixels != NULL && b.width == width && b.height == height) return false;
+	memFree(b.pixels);
+	b.pixels = (unsigned char*)memAlloc(owner, (size_t)width * height);
+	b.width = width;
+	b.height = height;
+	return true;
+}
+
+/*
+* fill b from a buffer of srcWidth x srcHeight, nearest neighbour
+*/
+inline void modeBufferResample(ModeBuffer& b, const unsigned char* src, int srcWidth, int srcHeight)
+{
+	for (int j = 0; j < b.height; j++) {
+		const unsigned char* line = src + (size_t)(j * srcHeight / b.height) * srcWidth;
+		unsigned char* out = b.pixels + (size_t)j * b.width;
+		for (int i = 0; i < b.width; i++) {
+			out[i] = line[i * srcWidth / b.width];
+		}
+	}
+}
+
+inline void modeBufferFree(ModeBuffer& b)
+{
+	memFree(b.pixels);
+	b.pixels = NULL;
+	b.width = b.height = 0;
+}
+
+/*
+* the instantiation of Kernel for a mode
+*/
+template<template<int, int> class Kernel>
+inline void (*resolutionKernel(ResolutionMode mode))(const RenderTarget&)
+{
+	typedef void (*Fn)(const RenderTarget&);
+	static const Fn table[RES_COUNT] = {
+		&Kernel<640, 480>::run,
+		&Kernel<1280, 720>::run,
+		&Kernel<1920, 1080>::run,
+		&Kernel<0, 0>::run
+	};
+	return table[mode];
+}
+
+#endif
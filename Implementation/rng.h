@@ -0,0 +1,98 @@
+#ifndef __RNG_H_
+#define __RNG_H_
+
+// Seeded random numbers for the effects.
+// xoshiro128++: four words of state, a handful of adds, xors and rotates
+// per number, and the same sequence on every compiler and libc. Nothing is
+// shared: every effect owns its stream, derived from the demo seed, a stream
+// id and an index (the showing of the module, or the thread drawing from
+// it), so what one effect draws never changes what another one gets.
+// RngLanes keeps RNG_LANES interleaved generators for the rngFill kernel,
+// which produces the same numbers on every instruction set.
+
+#include <stdint.h>
+
+#define RNG_LANES 8
+
+struct Rng {
+	uint32_t s[4];
+};
+
+// the state of lane k is s[0][k] .. s[3][k]
+struct RngLanes {
+	uint32_t s[4][RNG_LANES];
+};
+
+inline uint32_t rngRotl(uint32_t x, int k)
+{
+	return (x << k) | (x >> (32 - k));
+}
+
+/*
+* splitmix64, only used to expand a seed into a state
+*/
+inline uint64_t rngSplitMix(uint64_t& x)
+{
+	uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+/*
+* stream index of stream id of a seed
+*/
+inline Rng rngSeed(uint64_t seed, uint32_t stream, uint32_t index)
+{
+	uint64_t x = seed ^ ((((uint64_t)stream << 32) | index) * 0xD1B54A32D192ED03ull);
+	uint64_t a = rngSplitMix(x), b = rngSplitMix(x);
+	Rng r;
+	r.s[0] = (uint32_t)a;
+	r.s[1] = (uint32_t)(a >> 32);
+	r.s[2] = (uint32_t)b;
+	r.s[3] = (uint32_t)(b >> 32);
+	// the all zero state would only ever give zeros
+	if ((r.s[0] | r.s[1] | r.s[2] | r.s[3]) == 0) r.s[0] = 1;
+	return r;
+}
+
+inline uint32_t rngNext(Rng& r)
+{
+	uint32_t result = rngRotl(r.s[0] + r.s[3], 7) + r.s[0];
+	uint32_t t = r.s[1] << 9;
+	r.s[2] ^= r.s[0];
+	r.s[3] ^= r.s[1];
+	r.s[1] ^= r.s[2];
+	r.s[0] ^= r.s[3];
+	r.s[2] ^= t;
+	r.s[3] = rngRotl(r.s[3], 11);
+	return result;
+}
+
+/*
+* a number in [0, n), by multiplying instead of the biased and slow modulo
+*/
+inline uint32_t rngRange(uint32_t x, uint32_t n)
+{
+	return (uint32_t)(((uint64_t)x * n) >> 32);
+}
+
+inline uint32_t rngBelow(Rng& r, uint32_t n)
+{
+	return rngRange(rngNext(r), n);
+}
+
+/*
+* the lanes of a bulk stream, seeded apart from the single streams
+*/
+inline RngLanes rngSeedLanes(uint64_t seed, uint32_t stream, uint32_t index)
+{
+	RngLanes lanes;
+	for (int k = 0; k < RNG_LANES; k++) {
+		Rng r = rngSeed(seed, stream | 0x80000000u, index * RNG_LANES + k);
+		for (int w = 0; w < 4; w++) lanes.s[w][k] = r.s[w];
+	}
+	return lanes;
+}
+
+#endif
@@ -0,0 +1,304 @@
+#ifndef __SAMPLER_H_
+#define __SAMPLER_H_
+
+// Texture sampling shared by the effects.
+// Textures are packed ARGB8888 surfaces, coordinates are FixedTexel (24.8):
+// the integer part is the texel, the 8 bit fraction the bilinear weights.
+// Rows of coordinates go through the sampleRow kernel (nearest or bilinear,
+// wrapped, clamped or black outside), textureSpan() walks a straight line
+// of them for the affine mappers. The 8 bit variant samples buffers of
+// palette indices, interpolating the indices themselves.
+// A texture walked at an angle touches a new row, so a new cache line, at
+// almost every pixel. samplerLoadTexture() copies a surface into 4x4 tiles
+// or Morton order instead, where the texels around any texel are a few
+// cache lines away whatever the direction of the walk.
+
+#include <SDL.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "fixed.h"
+#include "kernels.h"
+#include "memtrack.h"
+#include "perfcounters.h"
+
+#if defined(KERNELS_X86) && !defined(_MSC_VER)
+#include <x86intrin.h>
+#endif
+
+// coordinates built on the stack at a time
+#define SAMPLER_CHUNK 256
+
+/*
+* the texture of a 32 bit surface, lock it first if it needs locking
+*/
+inline SamplerTexture samplerTexture(const SDL_Surface* surface)
+{
+	SamplerTexture t = { (const uint32_t*)surface->pixels, surface->w, surface->h, surface->pitch / 4, SAMPLER_LINEAR };
+	return t;
+}
+
+/*
+* the layout of a --layout=linear|tiled|morton argument, SAMPLER_LAYOUT_COUNT
+* if arg is something else
+*/
+inline SamplerLayout samplerParseLayout(const char* arg)
+{
+	if (strncmp(arg, "--layout=", 9) != 0) return SAMPLER_LAYOUT_COUNT;
+	for (int n = 0; n < SAMPLER_LAYOUT_COUNT; n++) {
+		if (strcmp(arg + 9, samplerLayoutNames[n]) == 0) return (SamplerLayout)n;
+	}
+	return SAMPLER_LAYOUT_COUNT;
+}
+
+/*
+* the texels of a 32 bit surface copied into layout, charged to owner. the
+* surface itself, still linear, when layout is linear, does not fit the size
+* or there is no memory. release it with samplerFreeTexture()
+*/
+inline SamplerTexture samplerLoadTexture(const char* owner, SDL_Surface* surface, SamplerLayout layout)
+{
+	SamplerTexture t = samplerTexture(surface);
+	if (layout == SAMPLER_LINEAR) return t;
+	if (!samplerLayoutFits(t.width, t.height, layout)) {
+		printf("A %dx%d texture can not be stored %s, keeping it linear\n", t.width, t.height, samplerLayoutNames[layout]);
+		return t;
+	}
+	// a plain block on cache lines: a texture is far smaller than a huge page
+	uint32_t* pixels = (uint32_t*)memAllocAligned(owner, (size_t)t.width * t.height * sizeof(uint32_t), 64);
+	if (pixels == NULL) return t;
+	SDL_LockSurface(surface);
+	t = samplerSwizzle(pixels, (const uint32_t*)surface->pixels, t.width, t.height, surface->pitch / 4, layout);
+	SDL_UnlockSurface(surface);
+	return t;
+}
+
+inline void samplerFreeTexture(const SamplerTexture& texture)
+{
+	// the linear ones are the surface
+	if (texture.layout != SAMPLER_LINEAR) memFreeAligned((void*)texture.pixels);
+}
+
+/*
+* count texels along the line from (u, v) stepping (du, dv) per pixel. the
+* position is kept in 16.16 so long spans do not drift
+*/
+inline void textureSpan(uint32_t* dst, const SamplerTexture& texture, Fixed16_16 u, Fixed16_16 v,
+	Fixed16_16 du, Fixed16_16 dv, int count, SamplerFilter filter, SamplerAddress address)
+{
+	FixedTexel cu[SAMPLER_CHUNK], cv[SAMPLER_CHUNK];
+	for (int i = 0; i < count; i += SAMPLER_CHUNK) {
+		int n = count - i < SAMPLER_CHUNK ? count - i : SAMPLER_CHUNK;
+		for (int k = 0; k < n; k++) {
+			cu[k] = FixedTexel::from(u);
+			cv[k] = FixedTexel::from(v);
+			u += du;
+			v += dv;
+		}
+		kernels.sampleRow(dst + i, texture, cu, cv, n, filter, address);
+	}
+}
+
+// a buffer of palette indices, pitch in bytes
+struct SamplerTexture8 {
+	const unsigned char* pixels;
+	int width, height, pitch;
+};
+
+template <SamplerAddress A>
+inline int samplerFetch8(const SamplerTexture8& t, int x, int y)
+{
+	if (A == SAMPLER_WRAP) {
+		x &= t.width - 1;
+		y &= t.height - 1;
+	}
+	else if (A == SAMPLER_CLAMP) {
+		x = x < 0 ? 0 : (x >= t.width ? t.width - 1 : x);
+		y = y < 0 ? 0 : (y >= t.height ? t.height - 1 : y);
+	}
+	else if (x < 0 || x >= t.width || y < 0 || y >= t.height) {
+		return 0;
+	}
+	return t.pixels[y * t.pitch + x];
+}
+
+template <SamplerFilter F, SamplerAddress A>
+inline void sampleRow8T(unsigned char* dst, const SamplerTexture8& t, const FixedTexel* u, const FixedTexel* v, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		int x = u[i].toInt(), y = v[i].toInt();
+		if (F == SAMPLER_NEAREST) {
+			dst[i] = (unsigned char)samplerFetch8<A>(t, x, y);
+			continue;
+		}
+		// the same weights as the packed texels
+		int fx = u[i].frac(), fy = v[i].frac();
+		int top = (samplerFetch8<A>(t, x, y) * (256 - fx) + samplerFetch8<A>(t, x + 1, y) * fx) >> 8;
+		int bottom = (samplerFetch8<A>(t, x, y + 1) * (256 - fx) + samplerFetch8<A>(t, x + 1, y + 1) * fx) >> 8;
+		dst[i] = (unsigned char)((top * (256 - fy) + bottom * fy) >> 8);
+	}
+}
+
+/*
+* sampleRow for 8 bit textures, scalar: the indices still have to go
+* through a palette afterwards
+*/
+inline void sampleRow8(unsigned char* dst, const SamplerTexture8& texture, const FixedTexel* u, const FixedTexel* v,
+	int count, SamplerFilter filter, SamplerAddress address)
+{
+	if (filter == SAMPLER_NEAREST) {
+		if (address == SAMPLER_WRAP) sampleRow8T<SAMPLER_NEAREST, SAMPLER_WRAP>(dst, texture, u, v, count);
+		else if (address == SAMPLER_CLAMP) sampleRow8T<SAMPLER_NEAREST, SAMPLER_CLAMP>(dst, texture, u, v, count);
+		else sampleRow8T<SAMPLER_NEAREST, SAMPLER_BORDER>(dst, texture, u, v, count);
+	}
+	else {
+		if (address == SAMPLER_WRAP) sampleRow8T<SAMPLER_BILINEAR, SAMPLER_WRAP>(dst, texture, u, v, count);
+		else if (address == SAMPLER_CLAMP) sampleRow8T<SAMPLER_BILINEAR, SAMPLER_CLAMP>(dst, texture, u, v, count);
+		else sampleRow8T<SAMPLER_BILINEAR, SAMPLER_BORDER>(dst, texture, u, v, count);
+	}
+}
+
+inline void textureSpan8(unsigned char* dst, const SamplerTexture8& texture, Fixed16_16 u, Fixed16_16 v,
+	Fixed16_16 du, Fixed16_16 dv, int count, SamplerFilter filter, SamplerAddress address)
+{
+	FixedTexel cu[SAMPLER_CHUNK], cv[SAMPLER_CHUNK];
+	for (int i = 0; i < count; i += SAMPLER_CHUNK) {
+		int n = count - i < SAMPLER_CHUNK ? count - i : SAMPLER_CHUNK;
+		for (int k = 0; k < n; k++) {
+			cu[k] = FixedTexel::from(u);
+			cv[k] = FixedTexel::from(v);
+			u += du;
+			v += dv;
+		}
+		sampleRow8(dst + i, texture, cu, cv, n, filter, address);
+	}
+}
+
+/*
+* cost of bilinear against nearest: a rotated and scaled 640x480 screen out
+* of a 256x256 texture, as the rotozoomer draws it, in every addressing mode
+*/
+inline void samplerBenchmark(int frames)
+{
+	const int width = 640, height = 480, size = 256;
+	std::vector<uint32_t> pixels(size * size), screen(width * height);
+	for (int n = 0; n < size * size; n++) pixels[n] = 0xFF000000u | (n * 2654435761u >> 8);
+	SamplerTexture texture = { &pixels[0], size, size, size, SAMPLER_LINEAR };
+	const char* filters[] = { "nearest", "bilinear" };
+	const char* addresses[] = { "wrap", "clamp", "border" };
+	double nearest[3] = { 0, 0, 0 };
+	printf("\nsampler with %s, %dx%d texture, %dx%d screen:\n", isaNames[kernelBoundIsa[KERNEL_SAMPLE_ROW]], size, size, width, height);
+	for (int filter = 0; filter < 2; filter++) {
+		for (int address = 0; address < 3; address++) {
+			auto start = std::chrono::steady_clock::now();
+			for (int frame = 0; frame < frames; frame++) {
+				// about 0.7 texels per pixel, turning a little every frame
+				double angle = frame * 0.01;
+				Fixed16_16 du = Fixed16_16::fromDouble(0.7 * cos(angle)), dv = Fixed16_16::fromDouble(0.7 * sin(angle));
+				Fixed16_16 u = Fixed16_16::fromInt(-64), v = Fixed16_16::fromInt(-64);
+				for (int j = 0; j < height; j++) {
+					textureSpan(&screen[j * width], texture, u, v, du, dv, width, (SamplerFilter)filter, (SamplerAddress)address);
+					u -= dv;
+					v += du;
+				}
+			}
+			double ms = 1000.0 * std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / frames;
+			if (filter == SAMPLER_NEAREST) nearest[address] = ms;
+			printf("%-8s %-6s %8.3f ms/frame %8.1f Mtexels/s", filters[filter], addresses[address], ms, width * height / ms / 1000.0);
+			if (filter == SAMPLER_BILINEAR) printf("  %.2fx nearest", ms / nearest[address]);
+			printf("\n");
+		}
+	}
+}
+
+/*
+* cycles from the performance counters when they are open (--counters),
+* otherwise ticks of the time stamp counter, which runs at the nominal
+* frequency, or nanoseconds where there is none
+*/
+inline uint64_t samplerCycles(const char** unit)
+{
+	if (perfAvailable(PERF_CYCLES)) {
+		PerfSample sample;
+		perfRead(&sample);
+		*unit = "cycles";
+		return sample.value[PERF_CYCLES];
+	}
+#ifdef KERNELS_X86
+	*unit = "TSC ticks";
+	return __rdtsc();
+#else
+	*unit = "ns";
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/*
+* the cost of each layout as the direction of the walk turns: a screen of
+* one texel per pixel out of a size x size texture, every 30 degrees from 0
+* to 360, nearest and bilinear, wrapped. per pixel, and the mean of the turn
+*/
+inline void samplerSweep(int size, int frames)
+{
+	const int width = 640, height = 480, step = 30, angles = 360 / step + 1;
+	std::vector<uint32_t> pixels((size_t)size * size), screen(width * height);
+	for (size_t n = 0; n < pixels.size(); n++) pixels[n] = 0xFF000000u | ((uint32_t)n * 2654435761u >> 8);
+	std::vector<uint32_t> swizzled[SAMPLER_LAYOUT_COUNT];
+	SamplerTexture textures[SAMPLER_LAYOUT_COUNT];
+	for (int l = 0; l < SAMPLER_LAYOUT_COUNT; l++) {
+		swizzled[l].resize(pixels.size());
+		textures[l] = samplerSwizzle(&swizzled[l][0], &pixels[0], size, size, size, (SamplerLayout)l);
+	}
+
+	const char* unit = "";
+	double sum[2][SAMPLER_LAYOUT_COUNT] = { { 0 } };
+	samplerCycles(&unit);
+	printf("\n%s per pixel, %dx%d texture, one texel per pixel:\n%-7s", unit, size, size, "angle");
+	for (int filter = 0; filter < 2; filter++) {
+		for (int l = 0; l < SAMPLER_LAYOUT_COUNT; l++) {
+			char name[32];
+			snprintf(name, sizeof(name), "%s %s", filter == SAMPLER_NEAREST ? "near" : "bili", samplerLayoutNames[l]);
+			printf(" %12s", name);
+		}
+	}
+	printf("\n");
+	for (int a = 0; a < angles; a++) {
+		double angle = a * step * M_PI / 180;
+		Fixed16_16 du = Fixed16_16::fromDouble(cos(angle)), dv = Fixed16_16::fromDouble(sin(angle));
+		printf("%-7d", a * step);
+		for (int filter = 0; filter < 2; filter++) {
+			for (int l = 0; l < SAMPLER_LAYOUT_COUNT; l++) {
+				// the first frame brings the texture into the cache
+				uint64_t start = 0;
+				for (int frame = -1; frame < frames; frame++) {
+					if (frame == 0) start = samplerCycles(&unit);
+					// around the centre of the texture
+					Fixed16_16 u = Fixed16_16::fromInt(size / 2) - du * (width / 2) + dv * (height / 2),
+						v = Fixed16_16::fromInt(size / 2) - dv * (width / 2) - du * (height / 2);
+					for (int j = 0; j < height; j++) {
+						textureSpan(&screen[j * width], textures[l], u, v, du, dv, width, (SamplerFilter)filter, SAMPLER_WRAP);
+						u -= dv;
+						v += du;
+					}
+				}
+				double perPixel = (double)(samplerCycles(&unit) - start) / ((double)frames * width * height);
+				if (a < angles - 1) sum[filter][l] += perPixel;
+				printf(" %12.2f", perPixel);
+			}
+		}
+		printf("\n");
+	}
+	printf("%-7s", "mean");
+	for (int filter = 0; filter < 2; filter++) {
+		for (int l = 0; l < SAMPLER_LAYOUT_COUNT; l++) printf(" %12.2f", sum[filter][l] / (angles - 1));
+	}
+	printf("\n");
+}
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef __SPRITE_H_
+#define __SPRITE_H_
+
+// Software sprite blitter into the shared framebuffer.
+// Does what SDL_RenderCopyEx does for us: the source rectangle is scaled to
+// the destination rectangle, flipped, then rotated clockwise around a center.
+// Every destination pixel inside the rotated rectangle is mapped back to its
+// source texel (nearest, 16.16 fixed point stepped along the row), so there
+// are no holes at any angle. Color-keyed texels have alpha 0 and are skipped.
+
+#include <SDL.h>
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+
+#include "resolution.h"
+
+// a 32 bit ARGB image with its drawing state
+struct Sprite {
+	const uint32_t* pixels;
+	int width, height;
+	int pitch;              // in pixels
+	uint8_t r, g, b, a;     // color and alpha modulation
+	bool blend;             // alpha blending, otherwise texels are copied
+};
+
+/*
+* make every texel of the key color transparent, the blitter then skips it
+*/
+inline void spriteApplyColorKey(SDL_Surface* surface, uint32_t key)
+{
+	for (int j = 0; j < surface->h; j++) {
+		uint32_t* row = (uint32_t*)((uint8_t*)surface->pixels + j * surface->pitch);
+		for (int i = 0; i < surface->w; i++) {
+			if ((row[i] & 0x00FFFFFF) == (key & 0x00FFFFFF)) row[i] = 0;
+		}
+	}
+}
+
+/*
+* steps k of a row where 0 <= start + k * step < limit, as [first, last]
+*/
+inline void spriteSpan(int64_t start, int64_t step, int64_t limit, int64_t& first, int64_t& last)
+{
+	if (step == 0) {
+		if (start < 0 || start >= limit) last = -1;
+		return;
+	}
+	double lo = (double)-start / step, hi = (double)(limit - 1 - start) / step;
+	if (step < 0) std::swap(lo, hi);
+	if ((int64_t)ceil(lo) > first) first = (int64_t)ceil(lo);
+	if ((int64_t)floor(hi) < last) last = (int64_t)floor(hi);
+}
+
+inline uint32_t spriteShade(const Sprite& s, uint32_t texel, uint32_t under)
+{
+	uint32_t a = texel >> 24, r = (texel >> 16) & 0xFF, g = (texel >> 8) & 0xFF, b = texel & 0xFF;
+	if (s.r != 255 || s.g != 255 || s.b != 255 || s.a != 255) {
+		r = r * s.r / 255;
+		g = g * s.g / 255;
+		b = b * s.b / 255;
+		a = a * s.a / 255;
+	}
+	if (s.blend && a != 255) {
+		uint32_t ur = (under >> 16) & 0xFF, ug = (under >> 8) & 0xFF, ub = under & 0xFF;
+		r = (r * a + ur * (255 - a)) / 255;
+		g = (g * a + ug * (255 - a)) / 255;
+		b = (b * a + ub * (255 - a)) / 255;
+		a = 255;
+	}
+	return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+/*
+* draw the part clip of the sprite (all of it when NULL) into the rectangle
+* quad of the target, flipped, then rotated angle degrees clockwise around
+* center (relative to quad, its middle when NULL). returns the pixels written
+*/
+inline int spriteBlit(const RenderTarget& target, const Sprite& s, const SDL_Rect* clip, const SDL_Rect& quad,
+	double angle, const SDL_Point* center, SDL_RendererFlip flip)
+{
+	SDL_Rect src = { 0, 0, s.width, s.height };
+	if (clip != NULL) src = *clip;
+	if (quad.w <= 0 || quad.h <= 0 || src.w <= 0 || src.h <= 0) return 0;
+
+	// center of the rotation on the screen
+	double cx = center != NULL ? center->x : quad.w * 0.5;
+	double cy = center != NULL ? center->y : quad.h * 0.5;
+	double ox = quad.x + cx, oy = quad.y + cy;
+	double rad = angle * M_PI / 180.0;
+	double cs = cos(rad), sn = sin(rad);
+
+	// bounding box of the rotated quad, clipped to the target
+	double minX = 1e9, minY = 1e9, maxX = -1e9, maxY = -1e9;
+	for (int corner = 0; corner < 4; corner++) {
+		double qx = (corner & 1 ? quad.w : 0) - cx, qy = (corner & 2 ? quad.h : 0) - cy;
+		double x = ox + qx * cs - qy * sn, y = oy + qx * sn + qy * cs;
+		if (x < minX) minX = x;
+		if (x > maxX) maxX = x;
+		if (y < minY) minY = y;
+		if (y > maxY) maxY = y;
+	}
+	int x0 = (int)floor(minX), x1 = (int)ceil(maxX), y0 = (int)floor(minY), y1 = (int)ceil(maxY);
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (x1 > target.width) x1 = target.width;
+	if (y1 > target.height) y1 = target.height;
+	if (x0 >= x1 || y0 >= y1) return 0;
+
+	// rotating back maps a screen pixel into the quad, scaling into the source
+	double scaleX = (double)src.w / quad.w, scaleY = (double)src.h / quad.h;
+	const int64_t one = 65536;
+	int64_t dudx = (int64_t)(cs * scaleX * one), dvdx = (int64_t)(-sn * scaleY * one);
+	const int64_t limitU = (int64_t)src.w << 16, limitV = (int64_t)src.h << 16;
+	const bool flipH = (flip & SDL_FLIP_HORIZONTAL) != 0, flipV = (flip & SDL_FLIP_VERTICAL) != 0;
+	// no modulation: opaque texels are copied as they are
+	const bool opaque = s.r == 255 && s.g == 255 && s.b == 255 && s.a == 255;
+
+	int written = 0;
+	for (int y = y0; y < y1; y++) {
+		// source position of the center of the first pixel of the row
+		double ex = x0 + 0.5 - ox, ey = y + 0.5 - oy;
+		int64_t u = (int64_t)floor((cx + cs * ex + sn * ey) * scaleX * one);
+		int64_t v = (int64_t)floor((cy - sn * ex + cs * ey) * scaleY * one);
+		// only the part of the row that lands inside the source
+		int64_t first = 0, last = x1 - x0 - 1;
+		spriteSpan(u, dudx, limitU, first, last);
+		spriteSpan(v, dvdx, limitV, first, last);
+		u += first * dudx;
+		v += first * dvdx;
+		uint32_t* dst = target.pixels + y * target.pitch;
+		for (int x = x0 + (int)first; x <= x0 + last; x++, u += dudx, v += dvdx) {
+			int tu = (int)(u >> 16), tv = (int)(v >> 16);
+			if (flipH) tu = src.w - 1 - tu;
+			if (flipV) tv = src.h - 1 - tv;
+			uint32_t texel = s.pixels[(src.y + tv) * s.pitch + src.x + tu];
+			// color key
+			if ((texel >> 24) == 0) continue;
+			dst[x] = opaque && (texel >> 24) == 255 ? texel : spriteShade(s, texel, dst[x]);
+			written++;
+		}
+	}
+	return written;
+}
+
+#endif
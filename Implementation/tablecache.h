@@ -0,0 +1,201 @@
+#ifndef __TABLECACHE_H_
+#define __TABLECACHE_H_
+
+// Cache of the precomputed tables.
+// The plasma, distortion, tunnel and light tables come out the same on
+// every run, so instead of generating them at startup we generate them once
+// into a file keyed by the hash of the generator, its version, the
+// resolution and its parameters, and later runs map that file read only.
+// Startup then costs a page fault per page actually read, and processes
+// running at the same time share the pages of the file.
+// Without a directory (tableCacheDir NULL) the tables are generated in
+// memory every run, as before.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <utility>
+
+#include "framecache.h"
+#include "memtrack.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+// bump when the header changes, the generators have their own versions
+#define TABLE_CACHE_VERSION 1
+#define TABLE_CACHE_MAX 16
+
+struct TableCacheHeader {
+	char magic[4];          // "DTC1"
+	uint32_t version;
+	uint64_t key;
+	uint64_t size;
+	uint64_t pad;           // keeps the table 16 byte aligned in the file
+};
+
+// a table that came from a file, as opposed to memAllocTable()
+struct TableCacheEntry {
+	const void* table;
+	size_t size;
+	int owner;
+	FrameCacheMap map;
+};
+
+struct TableCacheStats {
+	int hits, misses, written;
+	uint64_t bytesMapped, bytesWritten;
+};
+
+// where the tables are kept, NULL to generate them every run
+const char* tableCacheDir = NULL;
+TableCacheEntry tableCacheEntries[TABLE_CACHE_MAX];
+int tableCacheNumEntries = 0;
+TableCacheStats tableCacheStats;
+
+inline std::string tableCachePath(uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.dtc", (unsigned long long)key);
+	return std::string(tableCacheDir) + name;
+}
+
+/*
+* map the file of a table, checking it is the one we asked for
+*/
+inline bool tableCacheMap(TableCacheEntry& e, const char* path, uint64_t key, size_t size)
+{
+	if (!frameCacheMapFile(e.map, path)) return false;
+	const TableCacheHeader* h = (const TableCacheHeader*)e.map.data;
+	if (e.map.size != sizeof(TableCacheHeader) + size || memcmp(h->magic, "DTC1", 4) != 0
+		|| h->version != TABLE_CACHE_VERSION || h->key != key || h->size != size) {
+		frameCacheUnmap(e.map);
+		return false;
+	}
+	e.table = e.map.data + sizeof(TableCacheHeader);
+	e.size = size;
+	return true;
+}
+
+/*
+* write a generated table, aside and renamed so another process never maps
+* half a file
+*/
+inline bool tableCacheWrite(const char* path, uint64_t key, const void* table, size_t size)
+{
+	TableCacheHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "DTC1", 4);
+	h.version = TABLE_CACHE_VERSION;
+	h.key = key;
+	h.size = size;
+
+	char temp[512];
+#ifdef __linux__
+	snprintf(temp, sizeof(temp), "%s.%d.tmp", path, (int)getpid());
+#else
+	snprintf(temp, sizeof(temp), "%s.tmp", path);
+#endif
+	FILE* f = fopen(temp, "wb");
+	if (f == NULL) return false;
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(table, 1, size, f) == size;
+	ok = (fclose(f) == 0) && ok;
+	if (ok) {
+		remove(path);
+		ok = rename(temp, path) == 0;
+	}
+	if (!ok) remove(temp);
+	return ok;
+}
+
+/*
+* the table of size bytes made by generate(void* table) for these params.
+* generator names the function and its version, bump it when the function
+* changes. the table is read only when it comes from the cache. release it
+* with tableCacheFree()
+*/
+template <class Generate>
+const void* tableCacheGet(const char* owner, const char* generator, const char* params, size_t size, Generate generate)
+{
+	if (tableCacheDir == NULL) {
+		void* table = memAllocTable(owner, size);
+		if (table != NULL) generate(table);
+		return table;
+	}
+
+	char text[512];
+	snprintf(text, sizeof(text), "%s/%s/%llu/v%d", generator, params, (unsigned long long)size, TABLE_CACHE_VERSION);
+	uint64_t key = frameCacheHash(text);
+	std::string path = tableCachePath(key);
+
+	// the startup tasks call this from several threads, the list is only
+	// touched under the lock
+	TableCacheEntry e;
+	e.map.data = NULL;
+	e.map.size = 0;
+	bool hit = tableCacheMap(e, path.c_str(), key, size);
+	if (!hit) {
+		void* table = memAllocTable(owner, size);
+		if (table == NULL) return NULL;
+		generate(table);
+		bool written = tableCacheWrite(path.c_str(), key, table, size);
+		{
+			std::lock_guard<std::recursive_mutex> guard(memLock);
+			tableCacheStats.misses++;
+			if (written) {
+				tableCacheStats.written++;
+				tableCacheStats.bytesWritten += sizeof(TableCacheHeader) + size;
+			}
+		}
+		// map what we wrote, so every run reads the tables the same way
+		if (!written || !tableCacheMap(e, path.c_str(), key, size)) return table;
+		memFreeTable(table);
+	}
+
+	std::lock_guard<std::recursive_mutex> guard(memLock);
+	if (hit) tableCacheStats.hits++;
+	if (tableCacheNumEntries == TABLE_CACHE_MAX) {
+		// no slot to remember the mapping, keep a copy instead
+		void* table = memAllocTable(owner, size);
+		if (table != NULL) memcpy(table, e.table, size);
+		frameCacheUnmap(e.map);
+		return table;
+	}
+	tableCacheStats.bytesMapped += size;
+	e.owner = memOwnerIndex(owner);
+	memCharge(e.owner, size);
+	// moved, so a copy read where there is no mmap keeps its address
+	const void* table = e.table;
+	tableCacheEntries[tableCacheNumEntries++] = std::move(e);
+	return table;
+}
+
+/*
+* release a table from tableCacheGet(), NULL is ignored
+*/
+inline void tableCacheFree(const void* table)
+{
+	if (table == NULL) return;
+	std::lock_guard<std::recursive_mutex> guard(memLock);
+	for (int n = 0; n < tableCacheNumEntries; n++) {
+		TableCacheEntry& e = tableCacheEntries[n];
+		if (e.table != table) continue;
+		memRelease(e.owner, e.size);
+		frameCacheUnmap(e.map);
+		e = std::move(tableCacheEntries[--tableCacheNumEntries]);
+		return;
+	}
+	// generated in memory
+	memFreeTable((void*)table);
+}
+
+inline void tableCacheReport(FILE* out)
+{
+	const TableCacheStats& s = tableCacheStats;
+	fprintf(out, "table cache: %d tables from the cache, %d generated (%.1f MB mapped, %.1f MB written)\n", s.hits, s.misses,
+		s.bytesMapped / (1024.0 * 1024.0), s.bytesWritten / (1024.0 * 1024.0));
+}
+
+#endif
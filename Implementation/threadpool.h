@@ -0,0 +1,119 @@
+#ifndef __THREADPOOL_H_
+#define __THREADPOOL_H_
+
+// Fixed pool of worker threads running queued tasks.
+// poolWait() blocks until everything submitted so far has finished; the
+// waiting thread runs queued tasks itself meanwhile, so a pool of N threads
+// keeps N + 1 cores busy. Tasks must not wait on the pool themselves.
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+
+#include "trace.h"
+
+struct ThreadPool {
+	std::vector<std::thread> threads;
+	std::mutex lock;
+	std::condition_variable wake;       // new task or stop
+	std::condition_variable idle;       // pending dropped to 0
+	std::deque<std::function<void()> > tasks;
+	int pending = 0;                    // submitted and not finished
+	bool stop = false;
+};
+
+/*
+* run one queued task, false if the queue was empty. lock must be held on
+* entry and is held again on return
+*/
+inline bool poolRunOne(ThreadPool& pool, std::unique_lock<std::mutex>& guard)
+{
+	if (pool.tasks.empty()) return false;
+	std::function<void()> task = std::move(pool.tasks.front());
+	pool.tasks.pop_front();
+	guard.unlock();
+	task();
+	guard.lock();
+	if (--pool.pending == 0) pool.idle.notify_all();
+	return true;
+}
+
+// 1..n on the pool's workers, 0 on any other thread
+thread_local int poolThreadIndex = 0;
+
+inline void poolWorker(ThreadPool* pool, int index)
+{
+	poolThreadIndex = index;
+	char name[32];
+	snprintf(name, sizeof(name), "worker %d", index);
+	traceThreadName(name);
+	std::unique_lock<std::mutex> guard(pool->lock);
+	for (;;) {
+		if (poolRunOne(*pool, guard)) continue;
+		if (pool->stop) return;
+		pool->wake.wait(guard);
+	}
+}
+
+/*
+* start count worker threads, 0 means one less than the cores (the thread
+* calling poolWait() is the last one)
+*/
+inline void poolStart(ThreadPool& pool, int count)
+{
+	if (count <= 0) {
+		count = (int)std::thread::hardware_concurrency() - 1;
+		if (count < 0) count = 0;
+	}
+	pool.stop = false;
+	for (int n = 0; n < count; n++) {
+		pool.threads.push_back(std::thread(poolWorker, &pool, n + 1));
+	}
+}
+
+inline void poolSubmit(ThreadPool& pool, std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> guard(pool.lock);
+		pool.tasks.push_back(std::move(task));
+		pool.pending++;
+	}
+	pool.wake.notify_one();
+}
+
+/*
+* run one queued task on the calling thread, false if there was none
+*/
+inline bool poolTryRunOne(ThreadPool& pool)
+{
+	std::unique_lock<std::mutex> guard(pool.lock);
+	return poolRunOne(pool, guard);
+}
+
+/*
+* wait for all submitted tasks, helping with them in the meantime
+*/
+inline void poolWait(ThreadPool& pool)
+{
+	std::unique_lock<std::mutex> guard(pool.lock);
+	while (pool.pending > 0) {
+		if (!poolRunOne(pool, guard)) pool.idle.wait(guard);
+	}
+}
+
+inline void poolStop(ThreadPool& pool)
+{
+	{
+		std::lock_guard<std::mutex> guard(pool.lock);
+		pool.stop = true;
+	}
+	pool.wake.notify_all();
+	for (size_t n = 0; n < pool.threads.size(); n++) pool.threads[n].join();
+	pool.threads.clear();
+}
+
+#endif
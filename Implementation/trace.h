@@ -0,0 +1,187 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+// Timeline profiler writing Chrome / Perfetto "trace event" JSON.
+// Every thread records its zones into its own ring buffer, so recording a
+// zone never takes a lock: two timestamp reads and one store.
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define TRACE_HAS_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRACE_HAS_TSC 1
+#endif
+
+// number of zones kept per thread, must be a power of two.
+// 1 << 17 zones is a few minutes of show at ~10 zones per frame
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE (1 << 17)
+#endif
+
+// one complete ("ph":"X") event
+struct TraceEvent {
+	const char* name;   // must be a string literal, only the pointer is kept
+	uint64_t begin;     // raw ticks
+	uint64_t end;
+};
+
+// the ring buffer owned by one thread
+struct TraceBuffer {
+	TraceEvent events[TRACE_RING_SIZE];
+	std::atomic<uint32_t> head;   // total number of zones ever written
+	int tid;
+	char name[32];
+};
+
+// tracing is off until traceBegin() is called
+bool traceEnabled = false;
+
+std::mutex traceRegistryLock;
+std::vector<TraceBuffer*> traceBuffers;
+thread_local TraceBuffer* traceLocalBuffer = NULL;
+
+// clock calibration, taken at traceBegin() and refreshed at traceWrite()
+uint64_t traceStartTicks;
+std::chrono::steady_clock::time_point traceStartClock;
+
+inline uint64_t traceTicks()
+{
+#ifdef TRACE_HAS_TSC
+	return __rdtsc();
+#else
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/*
+* get (or lazily create) the ring buffer of the calling thread.
+* this is the only place where the registry lock is taken, once per thread
+*/
+inline TraceBuffer* traceThreadBuffer()
+{
+	if (traceLocalBuffer == NULL) {
+		TraceBuffer* buffer = new TraceBuffer;
+		buffer->head.store(0, std::memory_order_relaxed);
+		std::lock_guard<std::mutex> guard(traceRegistryLock);
+		buffer->tid = (int)traceBuffers.size() + 1;
+		snprintf(buffer->name, sizeof(buffer->name), "thread %d", buffer->tid);
+		traceBuffers.push_back(buffer);
+		traceLocalBuffer = buffer;
+	}
+	return traceLocalBuffer;
+}
+
+/*
+* name the calling thread in the trace viewer ("main", "worker 3"...)
+*/
+inline void traceThreadName(const char* name)
+{
+	if (!traceEnabled) return;
+	TraceBuffer* buffer = traceThreadBuffer();
+	strncpy(buffer->name, name, sizeof(buffer->name) - 1);
+	buffer->name[sizeof(buffer->name) - 1] = 0;
+}
+
+/*
+* store one finished zone, overwriting the oldest one when the ring is full
+*/
+inline void traceRecord(const char* name, uint64_t begin, uint64_t end)
+{
+	TraceBuffer* buffer = traceThreadBuffer();
+	uint32_t index = buffer->head.load(std::memory_order_relaxed);
+	TraceEvent& e = buffer->events[index & (TRACE_RING_SIZE - 1)];
+	e.name = name;
+	e.begin = begin;
+	e.end = end;
+	// publish it for the thread that writes the file
+	buffer->head.store(index + 1, std::memory_order_release);
+}
+
+// scoped zone, records itself when it goes out of scope
+class TraceZone
+{
+public:
+	TraceZone(const char* zoneName) : name(zoneName), begin(traceEnabled ? traceTicks() : 0) {}
+	~TraceZone() { if (begin) traceRecord(name, begin, traceTicks()); }
+
+private:
+	const char* name;
+	uint64_t begin;
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+// open a zone lasting until the end of the enclosing block
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+
+/*
+* start recording, the calling thread is named "main"
+*/
+inline void traceBegin()
+{
+	traceStartTicks = traceTicks();
+	traceStartClock = std::chrono::steady_clock::now();
+	traceEnabled = true;
+	traceThreadName("main");
+}
+
+/*
+* write everything recorded so far as a Chrome trace (chrome://tracing,
+* ui.perfetto.dev). timestamps are in microseconds since traceBegin()
+*/
+inline bool traceWrite(const char* path)
+{
+	if (!traceEnabled) return false;
+
+	// ticks per microsecond, measured over the whole recording
+	double ticksPerUs = 1000.0;
+	double elapsedUs = (double)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - traceStartClock).count();
+	if (elapsedUs > 0) ticksPerUs = (double)(traceTicks() - traceStartTicks) / elapsedUs;
+
+	FILE* f = fopen(path, "w");
+	if (f == NULL) {
+		printf("Unable to write trace %s!\n", path);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> guard(traceRegistryLock);
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	size_t written = 0;
+	for (size_t t = 0; t < traceBuffers.size(); t++) {
+		TraceBuffer* buffer = traceBuffers[t];
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			first ? "" : ",\n", buffer->tid, buffer->name);
+		first = false;
+
+		uint32_t head = buffer->head.load(std::memory_order_acquire);
+		uint32_t count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+		for (uint32_t n = head - count; n != head; n++) {
+			const TraceEvent& e = buffer->events[n & (TRACE_RING_SIZE - 1)];
+			if (e.begin < traceStartTicks) continue;
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				e.name, buffer->tid,
+				(double)(e.begin - traceStartTicks) / ticksPerUs,
+				(double)(e.end - e.begin) / ticksPerUs);
+			written++;
+		}
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+
+	printf("Trace written to %s (%u zones, %u threads)\n", path, (unsigned)written, (unsigned)traceBuffers.size());
+	return true;
+}
+
+#endif
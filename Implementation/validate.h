@@ -0,0 +1,422 @@
+#ifndef __VALIDATE_H_
+#define __VALIDATE_H_
+
+// Differential validation of the kernel variants.
+// The scalar kernels are the reference: every other variant this CPU can
+// run is fed the same randomized and edge case inputs, the outputs are
+// compared channel by channel, and a kernel fails when its largest error
+// goes over its tolerance or it writes past the end of its output.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "kernels.h"
+
+// widest error allowed per kernel, in channel units. all the variants we
+// have are exact; approximate ones (fixed point, fast math) raise theirs
+const int validateTolerance[KERNEL_COUNT] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+// bytes written after the end of every output buffer to catch overruns
+#define VALIDATE_GUARD 64
+#define VALIDATE_GUARD_BYTE 0xA5
+
+// error of one variant against the reference
+struct ValidateStats {
+	int channels;           // 4 for packed ARGB, 1 for 8 bit buffers
+	uint64_t samples;       // pixels compared
+	int maxError[4];
+	double sumError[4];
+	int overruns;           // cases that wrote into the guard zone
+	int sideErrors;         // other outputs (the zbuffer, the generator state, another layout) that differ
+};
+
+// small deterministic generator, the cases only depend on the seed
+uint32_t validateState = 1;
+
+inline uint32_t validateRandom()
+{
+	validateState ^= validateState << 13;
+	validateState ^= validateState >> 17;
+	validateState ^= validateState << 5;
+	return validateState;
+}
+
+inline void validateFill(void* p, size_t bytes)
+{
+	unsigned char* b = (unsigned char*)p;
+	for (size_t n = 0; n < bytes; n++) b[n] = (unsigned char)validateRandom();
+}
+
+/*
+* an output buffer of count elements followed by the guard zone
+*/
+template <class T> std::vector<unsigned char> validateOutput(size_t count)
+{
+	std::vector<unsigned char> buffer(count * sizeof(T) + VALIDATE_GUARD, VALIDATE_GUARD_BYTE);
+	return buffer;
+}
+
+inline bool validateGuardIntact(const std::vector<unsigned char>& buffer)
+{
+	for (size_t n = buffer.size() - VALIDATE_GUARD; n < buffer.size(); n++) {
+		if (buffer[n] != VALIDATE_GUARD_BYTE) return false;
+	}
+	return true;
+}
+
+inline void validateCompare32(ValidateStats& s, const uint32_t* ref, const uint32_t* out, size_t count)
+{
+	for (size_t n = 0; n < count; n++) {
+		for (int c = 0; c < 4; c++) {
+			int e = (int)((ref[n] >> (c * 8)) & 0xff) - (int)((out[n] >> (c * 8)) & 0xff);
+			if (e < 0) e = -e;
+			if (e > s.maxError[c]) s.maxError[c] = e;
+			s.sumError[c] += e;
+		}
+	}
+	s.samples += count;
+}
+
+inline void validateCompare8(ValidateStats& s, const unsigned char* ref, const unsigned char* out, size_t count)
+{
+	for (size_t n = 0; n < count; n++) {
+		int e = (int)ref[n] - (int)out[n];
+		if (e < 0) e = -e;
+		if (e > s.maxError[0]) s.maxError[0] = e;
+		s.sumError[0] += e;
+	}
+	s.samples += count;
+}
+
+// the widths the cases use: one pixel, around every vector width, and the screen
+const int validateWidths[] = { 1, 3, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 640 };
+const int validateNumWidths = sizeof(validateWidths) / sizeof(validateWidths[0]);
+
+/*
+* plasma: random tables, tables saturated so the sum wraps, and the
+* largest palette index
+*/
+inline void validatePlasma(PlasmaRowFn fn, ValidateStats& s)
+{
+	uint32_t palette[256];
+	validateFill(palette, sizeof(palette));
+	for (int w = 0; w < validateNumWidths; w++) {
+		int count = validateWidths[w];
+		for (int pattern = 0; pattern < 4; pattern++) {
+			std::vector<unsigned char> src1(count), src2(count);
+			for (int n = 0; n < count; n++) {
+				switch (pattern) {
+				case 0: src1[n] = (unsigned char)validateRandom(); src2[n] = (unsigned char)validateRandom(); break;
+				case 1: src1[n] = 255; src2[n] = 255; break;            // wraps to 254
+				case 2: src1[n] = 255; src2[n] = 0; break;              // max index
+				default: src1[n] = (unsigned char)n; src2[n] = (unsigned char)(255 - n); break;
+				}
+			}
+			std::vector<unsigned char> ref = validateOutput<uint32_t>(count), out = validateOutput<uint32_t>(count);
+			plasmaRowScalar((uint32_t*)&ref[0], &src1[0], &src2[0], palette, count);
+			fn((uint32_t*)&out[0], &src1[0], &src2[0], palette, count);
+			validateCompare32(s, (uint32_t*)&ref[0], (uint32_t*)&out[0], count);
+			if (!validateGuardIntact(out)) s.overruns++;
+		}
+	}
+}
+
+/*
+* fire: random, all hot (largest sums), all cold, and sparse hot spots
+*/
+inline void validateFire(FireBlurFn fn, ValidateStats& s)
+{
+	const int heights[] = { 3, 4, 17, 480 };
+	for (int w = 2; w < validateNumWidths; w++) {
+		for (int h = 0; h < 4; h++) {
+			int width = validateWidths[w], height = heights[h];
+			if (width * height > 640 * 64 && !(width == 640 && height == 480)) continue;
+			for (int pattern = 0; pattern < 4; pattern++) {
+				std::vector<unsigned char> src(width * height);
+				for (size_t n = 0; n < src.size(); n++) {
+					switch (pattern) {
+					case 0: src[n] = (unsigned char)validateRandom(); break;
+					case 1: src[n] = 255; break;
+					case 2: src[n] = 0; break;
+					default: src[n] = (validateRandom() & 15) == 0 ? 255 : 0; break;
+					}
+				}
+				std::vector<unsigned char> ref = validateOutput<unsigned char>(src.size()), out = validateOutput<unsigned char>(src.size());
+				fireBlurScalar(&src[0], &ref[0], width, height);
+				fn(&src[0], &out[0], width, height);
+				validateCompare8(s, &ref[0], &out[0], src.size());
+				if (!validateGuardIntact(out)) s.overruns++;
+			}
+		}
+	}
+}
+
+/*
+* sampler: every filter and addressing mode, with coordinates inside the
+* texture, far outside on every side, and on the last texel where the
+* bilinear neighbours fall off the border
+*/
+inline void validateSample(SampleRowFn fn, ValidateStats& s)
+{
+	// a power of two for the wrapping, a wider pitch than the texture
+	const int pitch = 80, widths[3] = { 64, 64, 32 }, heights[3] = { 32, 32, 32 };
+	std::vector<uint32_t> pixels(pitch * 32), swizzled(pitch * 32);
+	validateFill(&pixels[0], pixels.size() * sizeof(uint32_t));
+	for (int layout = 0; layout < 3; layout++) {
+		const int width = widths[layout], height = heights[layout];
+		// the same texels in rows and in the layout, they must sample the same
+		SamplerTexture linear = { &pixels[0], width, height, pitch, SAMPLER_LINEAR };
+		SamplerTexture texture = layout == SAMPLER_LINEAR ? linear
+			: samplerSwizzle(&swizzled[0], &pixels[0], width, height, pitch, (SamplerLayout)layout);
+		for (int mode = 0; mode < 6; mode++) {
+			SamplerFilter filter = (SamplerFilter)(mode / 3);
+			SamplerAddress address = (SamplerAddress)(mode % 3);
+			for (int w = 0; w < validateNumWidths; w++) {
+				int count = validateWidths[w];
+				for (int pattern = 0; pattern < 3; pattern++) {
+					std::vector<FixedTexel> u(count), v(count);
+					for (int n = 0; n < count; n++) {
+						switch (pattern) {
+						case 0:
+							u[n] = FixedTexel::fromRaw((int)(validateRandom() % (width * 3 * 256)) - width * 256);
+							v[n] = FixedTexel::fromRaw((int)(validateRandom() % (height * 3 * 256)) - height * 256);
+							break;
+						case 1:
+							u[n] = FixedTexel::fromRaw((int)(validateRandom() % (width * 256)));
+							v[n] = FixedTexel::fromRaw((int)(validateRandom() % (height * 256)));
+							break;
+						default:
+							u[n] = FixedTexel::fromRaw((n & 1) ? (width - 1) * 256 + 255 : -1);
+							v[n] = FixedTexel::fromRaw((n & 2) ? (height - 1) * 256 + 128 : -255);
+							break;
+						}
+					}
+					std::vector<unsigned char> ref = validateOutput<uint32_t>(count), out = validateOutput<uint32_t>(count);
+					std::vector<uint32_t> rows(count);
+					sampleRowScalar((uint32_t*)&ref[0], texture, &u[0], &v[0], count, filter, address);
+					sampleRowScalar(&rows[0], linear, &u[0], &v[0], count, filter, address);
+					fn((uint32_t*)&out[0], texture, &u[0], &v[0], count, filter, address);
+					validateCompare32(s, (uint32_t*)&ref[0], (uint32_t*)&out[0], count);
+					if (memcmp(&ref[0], &rows[0], count * sizeof(uint32_t)) != 0) s.sideErrors++;
+					if (!validateGuardIntact(out)) s.overruns++;
+				}
+			}
+		}
+	}
+}
+
+/*
+* fractal: lines through the set, along its border and far outside,
+* where the iteration count goes from 0 to the 255 limit
+*/
+inline void validateMandelbrot(MandelbrotRowFn fn, ValidateStats& s)
+{
+	const double lines[] = { 0.0, 0.1, -0.6, 1.0, 2.5, -1.2 };
+	for (int l = 0; l < 6; l++) {
+		for (int w = 0; w < validateNumWidths; w++) {
+			int count = validateWidths[w];
+			double start = -2.5 + (validateRandom() % 1000) / 1000.0;
+			double step = 3.5 / (count + (validateRandom() % 7));
+			std::vector<unsigned char> ref = validateOutput<unsigned char>(count), out = validateOutput<unsigned char>(count);
+			mandelbrotRowScalar(&ref[0], start, step, lines[l], count);
+			fn(&out[0], start, step, lines[l], count);
+			validateCompare8(s, &ref[0], &out[0], count);
+			if (!validateGuardIntact(out)) s.overruns++;
+		}
+	}
+}
+
+/*
+* torus spans: random interpolants (negative ones wrap the texture),
+* saturated texture + light, and z values equal to the zbuffer ones
+*/
+inline void validateSpan(SpanFillFn fn, ValidateStats& s)
+{
+	std::vector<uint32_t> texture(256 * 256);
+	std::vector<unsigned char> light(256 * 256);
+	for (int w = 0; w < validateNumWidths; w++) {
+		int count = validateWidths[w];
+		for (int pattern = 0; pattern < 3; pattern++) {
+			if (pattern == 1) {
+				for (size_t n = 0; n < texture.size(); n++) { texture[n] = 0xFFFFFFFF; light[n] = 255; }
+			}
+			else {
+				validateFill(&texture[0], texture.size() * sizeof(uint32_t));
+				validateFill(&light[0], light.size());
+			}
+			SpanSetup span;
+			span.count = count;
+			// starts far enough from the limits of the formats that 640 steps stay inside them
+			span.z = FixedDepth::fromRaw(0x5000 + (int)(validateRandom() % 0x6000)); span.dz = FixedDepth::fromRaw((int)(validateRandom() % 64) - 32);
+			span.tx = Fixed16_16::fromRaw((int32_t)validateRandom() / 2); span.dtx = Fixed16_16::fromRaw((int)(validateRandom() % 0x40000) - 0x20000);
+			span.ty = Fixed16_16::fromRaw((int32_t)validateRandom() / 2); span.dty = Fixed16_16::fromRaw((int)(validateRandom() % 0x40000) - 0x20000);
+			span.px = Fixed16_16::fromRaw((int32_t)validateRandom() / 2); span.dpx = Fixed16_16::fromRaw((int)(validateRandom() % 0x40000) - 0x20000);
+			span.py = Fixed16_16::fromRaw((int32_t)validateRandom() / 2); span.dpy = Fixed16_16::fromRaw((int)(validateRandom() % 0x40000) - 0x20000);
+
+			std::vector<unsigned short> zbuffer(count);
+			for (int n = 0; n < count; n++) {
+				// pattern 2 puts the span exactly at the zbuffer depth: nothing may be drawn
+				zbuffer[n] = pattern == 2 ? (unsigned short)(span.z + span.dz * n).raw : (unsigned short)validateRandom();
+			}
+			std::vector<unsigned char> ref = validateOutput<uint32_t>(count), out = validateOutput<uint32_t>(count);
+			std::vector<unsigned short> zref = zbuffer, zout = zbuffer;
+			spanFillScalar((uint32_t*)&ref[0], &zref[0], span, &texture[0], 256, &light[0]);
+			fn((uint32_t*)&out[0], &zout[0], span, &texture[0], 256, &light[0]);
+			validateCompare32(s, (uint32_t*)&ref[0], (uint32_t*)&out[0], count);
+			if (!validateGuardIntact(out)) s.overruns++;
+			// the zbuffer must come out the same too
+			if (memcmp(&zref[0], &zout[0], count * sizeof(unsigned short)) != 0) s.sideErrors++;
+		}
+	}
+}
+
+/*
+* random numbers: every length around the lane count, the numbers and the
+* state left behind must both match
+*/
+inline void validateRng(RngFillFn fn, ValidateStats& s)
+{
+	for (int count = 0; count < 100; count++) {
+		RngLanes seeded;
+		validateFill(&seeded, sizeof(seeded));
+		RngLanes ref = seeded, lanes = seeded;
+		std::vector<unsigned char> refBuffer = validateOutput<uint32_t>(count);
+		std::vector<unsigned char> outBuffer = validateOutput<uint32_t>(count);
+		// a few calls in a row to carry the state over
+		for (int call = 0; call < 3; call++) {
+			rngFillScalar((uint32_t*)&refBuffer[0], count, ref);
+			fn((uint32_t*)&outBuffer[0], count, lanes);
+			validateCompare32(s, (const uint32_t*)&refBuffer[0], (const uint32_t*)&outBuffer[0], count);
+			if (!validateGuardIntact(outBuffer)) s.overruns++;
+			if (memcmp(&ref, &lanes, sizeof(ref)) != 0) s.sideErrors++;
+		}
+	}
+}
+
+/*
+* points: random matrices and points, every count around the vector widths,
+* and transforms done in place. the floats must match to the bit
+*/
+inline void validateTransform(TransformSoaFn fn, ValidateStats& s)
+{
+	for (int count = 0; count < 70; count++) {
+		float m[9];
+		for (int k = 0; k < 9; k++) m[k] = (int)(validateRandom() % 20001 - 10000) / 10000.0f;
+		std::vector<float> points(3 * count + 1);
+		for (size_t n = 0; n < points.size(); n++) points[n] = (int)(validateRandom() % 200001 - 100000) / 100.0f;
+		const float *x = &points[0], *y = x + count, *z = y + count;
+		std::vector<unsigned char> ref = validateOutput<float>(3 * count), out = validateOutput<float>(3 * count);
+		float* r = (float*)&ref[0];
+		float* o = (float*)&out[0];
+		transformSoaScalar(m, x, y, z, r, r + count, r + 2 * count, count);
+		fn(m, x, y, z, o, o + count, o + 2 * count, count);
+		validateCompare32(s, (const uint32_t*)r, (const uint32_t*)o, 3 * count);
+		if (!validateGuardIntact(out)) s.overruns++;
+		// once more in place, over the output of the first pass
+		if (count > 0) {
+			std::vector<float> a(r, r + 3 * count), b(r, r + 3 * count);
+			transformSoaScalar(m, &a[0], &a[count], &a[2 * count], &a[0], &a[count], &a[2 * count], count);
+			fn(m, &b[0], &b[count], &b[2 * count], &b[0], &b[count], &b[2 * count], count);
+			if (memcmp(&a[0], &b[0], 3 * count * sizeof(float)) != 0) s.sideErrors++;
+		}
+	}
+}
+
+/*
+* palette resolve: random indices, every index in a row, and every width
+*/
+inline void validatePalette(PaletteResolveFn fn, ValidateStats& s)
+{
+	uint32_t palette[256];
+	validateFill(palette, sizeof(palette));
+	for (int w = 0; w < validateNumWidths; w++) {
+		int count = validateWidths[w];
+		for (int pattern = 0; pattern < 2; pattern++) {
+			std::vector<unsigned char> src(count);
+			for (int n = 0; n < count; n++) src[n] = pattern == 0 ? (unsigned char)validateRandom() : (unsigned char)n;
+			std::vector<unsigned char> ref = validateOutput<uint32_t>(count), out = validateOutput<uint32_t>(count);
+			paletteResolveScalar((uint32_t*)&ref[0], &src[0], palette, count);
+			fn((uint32_t*)&out[0], &src[0], palette, count);
+			validateCompare32(s, (const uint32_t*)&ref[0], (const uint32_t*)&out[0], count);
+			if (!validateGuardIntact(out)) s.overruns++;
+		}
+	}
+}
+
+/*
+* print one line of the report, returns false if the variant failed
+*/
+inline bool validateReport(int kernel, int isa, const ValidateStats& s)
+{
+	int worst = 0;
+	for (int c = 0; c < s.channels; c++) {
+		if (s.maxError[c] > worst) worst = s.maxError[c];
+	}
+	bool pass = worst <= validateTolerance[kernel] && s.overruns == 0 && s.sideErrors == 0;
+	printf("%-15s %-7s %10llu ", kernelNames[kernel], isaNames[isa], (unsigned long long)s.samples);
+	// channels printed as B G R A for packed pixels
+	for (int c = 0; c < 4; c++) {
+		if (c < s.channels) printf(" %3d/%6.3f", s.maxError[c], s.samples ? s.sumError[c] / s.samples : 0.0);
+		else printf(" %10s", "");
+	}
+	printf(" %4d %8d %6d  %s\n", validateTolerance[kernel], s.overruns, s.sideErrors, pass ? "ok" : "FAIL");
+	return pass;
+}
+
+/*
+* run every variant the CPU supports against the scalar reference.
+* returns true when all of them are within tolerance
+*/
+inline bool validateKernels(uint32_t seed)
+{
+	kernelsRegisterVariants();
+	KernelIsa supported = cpuDetectIsa();
+	printf("Validating kernel variants against scalar (seed %u, cpu supports %s)\n", seed, isaNames[supported]);
+	printf("%-15s %-7s %10s  %-10s %-10s %-10s %-10s %4s %8s %6s\n", "kernel", "variant", "samples",
+		"B max/mean", "G max/mean", "R max/mean", "A max/mean", "tol", "overruns", "other");
+
+	bool pass = true;
+	int tested = 0;
+	for (int isa = ISA_SCALAR + 1; isa <= supported; isa++) {
+		for (int kernel = 0; kernel < KERNEL_COUNT; kernel++) {
+			ValidateStats s;
+			memset(&s, 0, sizeof(s));
+			// every kernel and variant sees the same cases
+			validateState = seed ? seed : 1;
+			switch (kernel) {
+			case KERNEL_PLASMA_ROW:
+				if (plasmaRowVariants[isa] == NULL) continue;
+				s.channels = 4; validatePlasma(plasmaRowVariants[isa], s); break;
+			case KERNEL_FIRE_BLUR:
+				if (fireBlurVariants[isa] == NULL) continue;
+				s.channels = 1; validateFire(fireBlurVariants[isa], s); break;
+			case KERNEL_SAMPLE_ROW:
+				if (sampleRowVariants[isa] == NULL) continue;
+				s.channels = 4; validateSample(sampleRowVariants[isa], s); break;
+			case KERNEL_MANDELBROT_ROW:
+				if (mandelbrotRowVariants[isa] == NULL) continue;
+				s.channels = 1; validateMandelbrot(mandelbrotRowVariants[isa], s); break;
+			case KERNEL_SPAN_FILL:
+				if (spanFillVariants[isa] == NULL) continue;
+				s.channels = 4; validateSpan(spanFillVariants[isa], s); break;
+			case KERNEL_RNG_FILL:
+				if (rngFillVariants[isa] == NULL) continue;
+				s.channels = 4; validateRng(rngFillVariants[isa], s); break;
+			case KERNEL_TRANSFORM_SOA:
+				if (transformSoaVariants[isa] == NULL) continue;
+				s.channels = 4; validateTransform(transformSoaVariants[isa], s); break;
+			case KERNEL_PALETTE_RESOLVE:
+				if (paletteResolveVariants[isa] == NULL) continue;
+				s.channels = 4; validatePalette(paletteResolveVariants[isa], s); break;
+			}
+			if (!validateReport(kernel, isa, s)) pass = false;
+			tested++;
+		}
+	}
+	printf("%d variants tested, %s\n", tested, pass ? "all within tolerance" : "FAILED");
+	return pass;
+}
+
+#endif
@@ -3,45 +3,66 @@
 
 #include <cmath>
 
-class VECTOR
+// x86 always has SSE2 in 64 bits, and when the compiler is told to use it
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VECTOR_SSE 1
+#include <emmintrin.h>
+#endif
+
+// three floats padded to a 16 byte register, the fourth one is always 0
+class alignas(16) VECTOR
 {
-	float v[3];
+	float v[4];
 
 public:
 
 	      float &operator[](const int i)       { return v[i]; }
 	const float &operator[](const int i) const { return v[i]; }
 
+#ifdef VECTOR_SSE
+	// unaligned loads: arrays of VECTOR are not always 16 byte aligned
+	// before C++17 (32 bit new)
+	__m128 load() const           { return _mm_loadu_ps(v); }
+	void store(const __m128 a)    { _mm_storeu_ps(v, a); }
+#endif
 
 	VECTOR operator+(const VECTOR &a) const
         {
                VECTOR r;
+#ifdef VECTOR_SSE
+               r.store(_mm_add_ps(load(), a.load()));
+#else
                r[0] = v[0] + a[0];
                r[1] = v[1] + a[1];
                r[2] = v[2] + a[2];
+#endif
                return r;
         }
 
 	VECTOR operator-(const VECTOR &a) const
         {
                VECTOR r;
+#ifdef VECTOR_SSE
+               r.store(_mm_sub_ps(load(), a.load()));
+#else
                r[0] = v[0] - a[0];
                r[1] = v[1] - a[1];
                r[2] = v[2] - a[2];
+#endif
                return r;
         }
 
-	VECTOR &operator=(const VECTOR &a)
-	{
-		v[0] = a[0];
-		v[1] = a[1];
-		v[2] = a[2];
-		return *this;
-	}
-
-        VECTOR() {}
-        VECTOR(const float X, const float Y, const float Z) { v[0]=X; v[1]=Y; v[2]=Z; }
-        ~VECTOR() {}
+        constexpr VECTOR() : v{ 0, 0, 0, 0 } {}
+        constexpr VECTOR(const float X, const float Y, const float Z) : v{ X, Y, Z, 0 } {}
+};
+
+// points kept as separate x, y and z arrays, for the batch transforms
+struct VECTORS
+{
+	float *x, *y, *z;
+
+	VECTOR operator[](const int i) const { return VECTOR(x[i], y[i], z[i]); }
+	void set(const int i, const VECTOR &a) { x[i] = a[0]; y[i] = a[1]; z[i] = a[2]; }
 };
 
 inline VECTOR normalize(const VECTOR &a)
@@ -2,6 +2,10 @@
 #include <iostream>
 #include <cmath>
 
+#include "../../Implementation/memtrack.h"
+#include "../../Implementation/fastmath.h"
+#include "../../Implementation/tablecache.h"
+
 //Screen dimension constants
 const int SCREEN_WIDTH = 640;
 const int SCREEN_HEIGHT = 480;
@@ -15,9 +19,10 @@ SDL_Surface* screenSurface = NULL;
 int lastTime = 0, currentTime, deltaTime;
 float msFrame = 1 / (FPS / 1000.0f);
 
-// the two function buffers sized SCREEN_WIDTH * SCREEN_HEIGHT * 4
-unsigned char *plasma1;
-unsigned char *plasma2;
+// the two function buffers sized SCREEN_WIDTH * SCREEN_HEIGHT * 4, one
+// after the other in a table that may be mapped from the table cache
+const unsigned char *plasma1;
+const unsigned char *plasma2;
 // define the plasma movement
 int Windowx1, Windowy1, Windowx2, Windowy2;
 long src1, src2;
@@ -41,6 +46,14 @@ void buildPalette();
 
 int main( int argc, char* args[] )
 {
+	// --tables dir keeps the precomputed tables in dir, shared with the demo
+	// --memreport prints the allocations when closing
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(args[a], "--tables") == 0 && a + 1 < argc) tableCacheDir = args[++a];
+		if (strcmp(args[a], "--memreport") == 0) memReportOnExit = true;
+	}
+	if (tableCacheDir != NULL) frameCacheMakeDir(tableCacheDir);
+
 	//Start up SDL and create window
 	if (!initSDL())
 	{
@@ -126,8 +139,8 @@ void render() {
 }
 
 void close() {
-	free(plasma1);
-	free(plasma2);
+	tableCacheFree(plasma1);
+	if (memReportOnExit) memReport();
 	//Destroy window
 	SDL_DestroyWindow(window);
 	//Quit SDL subsystems
@@ -146,20 +159,26 @@ void waitTime() {
 
 void initPlasma() {
 
-	plasma1 = (unsigned char*)malloc(SCREEN_WIDTH*SCREEN_HEIGHT * 4);
-	plasma2 = (unsigned char*)malloc(SCREEN_WIDTH*SCREEN_HEIGHT * 4);
-
-	int i, j, dst = 0;
-	for (j = 0; j<(SCREEN_HEIGHT*2); j++)
-	{
-		for (i = 0; i<(SCREEN_WIDTH*2); i++)
+	const size_t size = (SCREEN_WIDTH * 2) * (SCREEN_HEIGHT * 2);
+	char params[32];
+	snprintf(params, sizeof(params), "%dx%d", SCREEN_WIDTH, SCREEN_HEIGHT);
+	// the same functions as the demo, so the same table and the same file
+	plasma1 = (const unsigned char*)tableCacheGet("plasma", "plasma.v1", params, size * 2, [size](void* table) {
+		unsigned char* p1 = (unsigned char*)table;
+		unsigned char* p2 = p1 + size;
+		int i, j, dst = 0;
+		for (j = 0; j<(SCREEN_HEIGHT*2); j++)
 		{
-			plasma1[dst] = (unsigned char)(64 + 63 * (sin((double)hypot(SCREEN_HEIGHT - j, SCREEN_WIDTH - i) / 16)));
-			plasma2[dst] = (unsigned char)(64 + 63 * sin((float)i / (37 + 15 * cos((float)j / 74)))
-				* cos((float)j / (31 + 11 * sin((float)i / 57))));
-			dst++;
+			for (i = 0; i<(SCREEN_WIDTH*2); i++)
+			{
+				p1[dst] = (unsigned char)(64 + 63 * (mathSin<MATH_TABLE>((double)mathHypot<MATH_TABLE>(SCREEN_HEIGHT - j, SCREEN_WIDTH - i) / 16)));
+				p2[dst] = (unsigned char)(64 + 63 * mathSin<MATH_TABLE>((float)i / (37 + 15 * mathCos<MATH_TABLE>((float)j / 74)))
+					* mathCos<MATH_TABLE>((float)j / (31 + 11 * mathSin<MATH_TABLE>((float)i / 57))));
+				dst++;
+			}
 		}
-	}
+	});
+	plasma2 = plasma1 + size;
 }
 
 void updatePlasma() {
@@ -169,10 +188,10 @@ void updatePlasma() {
 	buildPalette();
 
 	// move plasma with more sine functions :)
-	Windowx1 = (SCREEN_WIDTH / 2) + (int)(((SCREEN_WIDTH / 2)-1) * cos((double)currentTime / 970));
-	Windowx2 = (SCREEN_WIDTH / 2) + (int)(((SCREEN_WIDTH / 2) - 1) * sin((double)-currentTime / 1140));
-	Windowy1 = (SCREEN_HEIGHT / 2) + (int)(((SCREEN_HEIGHT / 2) - 1) * sin((double)currentTime / 1230));
-	Windowy2 = (SCREEN_HEIGHT / 2) + (int)(((SCREEN_HEIGHT / 2) - 1) * cos((double)-currentTime / 750));
+	Windowx1 = (SCREEN_WIDTH / 2) + (int)(((SCREEN_WIDTH / 2)-1) * mathCos<MATH_POLY>((double)currentTime / 970));
+	Windowx2 = (SCREEN_WIDTH / 2) + (int)(((SCREEN_WIDTH / 2) - 1) * mathSin<MATH_POLY>((double)-currentTime / 1140));
+	Windowy1 = (SCREEN_HEIGHT / 2) + (int)(((SCREEN_HEIGHT / 2) - 1) * mathSin<MATH_POLY>((double)currentTime / 1230));
+	Windowy2 = (SCREEN_HEIGHT / 2) + (int)(((SCREEN_HEIGHT / 2) - 1) * mathCos<MATH_POLY>((double)-currentTime / 750));
 	// we only select the part of the precalculated buffer that we need
 	src1 = Windowy1 * (SCREEN_WIDTH * 2) + Windowx1;
 	src2 = Windowy2 * (SCREEN_WIDTH * 2) + Windowx2;
@@ -213,9 +232,9 @@ void renderPlasma() {
 void buildPalette() {
 	for (int i = 0; i<256; i++)
 	{
-		palette[i].R = (unsigned char)(128 + 127 * cos(i * M_PI / 128 + (double)currentTime / 740));
-		palette[i].G = (unsigned char)(128 + 127 * sin(i * M_PI / 128 + (double)currentTime / 630));
-		palette[i].B = (unsigned char)(128 - 127 * cos(i * M_PI / 128 + (double)currentTime / 810));
+		palette[i].R = (unsigned char)(128 + 127 * mathCos<MATH_TABLE>(i * M_PI / 128 + (double)currentTime / 740));
+		palette[i].G = (unsigned char)(128 + 127 * mathSin<MATH_TABLE>(i * M_PI / 128 + (double)currentTime / 630));
+		palette[i].B = (unsigned char)(128 - 127 * mathCos<MATH_TABLE>(i * M_PI / 128 + (double)currentTime / 810));
 	}
 
 }
\ No newline at end of file
@@ -2,6 +2,10 @@
 #include <iostream>
 #include <cmath>
 
+#include "../../Implementation/memtrack.h"
+#include "../../Implementation/kernels.h"
+#include "../../Implementation/indexed.h"
+
 //Screen dimension constants
 const int SCREEN_WIDTH = 640;
 const int SCREEN_HEIGHT = 480;
@@ -20,9 +24,12 @@ unsigned char *fire1;
 unsigned char *fire2;
 // a temporary variable to swap the two previous buffers
 unsigned char *tmp;
+// where the hot spots go, drawn in bulk every frame
+RngLanes heatRng;
+#define MAX_HOT_SPOTS 512
 
-struct RGBColor { unsigned char R, G, B; };
-RGBColor palette[256];
+// packed 0xAARRGGBB, the fire buffers are the indices
+Uint32 palette[256];
 
 bool initSDL();
 void update();
@@ -45,6 +52,16 @@ void Blur_Up(unsigned char *src, unsigned char *dst);
 
 int main( int argc, char* args[] )
 {
+	// --isa=scalar|sse2|avx2|avx512 forces a kernel variant
+	// --memreport prints the allocations when closing
+	KernelIsa isa = ISA_COUNT;
+	for (int a = 1; a < argc; a++) {
+		if (kernelsParseIsa(args[a]) != ISA_COUNT) isa = kernelsParseIsa(args[a]);
+		if (strcmp(args[a], "--memreport") == 0) memReportOnExit = true;
+	}
+	kernelsInit(isa);
+	kernelsReport();
+
 	//Start up SDL and create window
 	if (!initSDL())
 	{
@@ -130,8 +147,9 @@ void render() {
 }
 
 void close() {
-	free(fire1);
-	free(fire2);
+	memFree(fire1);
+	memFree(fire2);
+	if (memReportOnExit) memReport();
 	//Destroy window
 	SDL_DestroyWindow(window);
 	//Quit SDL subsystems
@@ -151,11 +169,12 @@ void waitTime() {
 void initFire() {
 	buildPalette();
 	// two fire buffers
-	fire1 = (unsigned char*)malloc(SCREEN_WIDTH*SCREEN_HEIGHT);
-	fire2 = (unsigned char*)malloc(SCREEN_WIDTH*SCREEN_HEIGHT);
+	fire1 = (unsigned char*)memAlloc("fire", SCREEN_WIDTH*SCREEN_HEIGHT);
+	fire2 = (unsigned char*)memAlloc("fire", SCREEN_WIDTH*SCREEN_HEIGHT);
 	// clear the buffers
 	memset(fire1, 0, SCREEN_WIDTH*SCREEN_HEIGHT);
 	memset(fire2, 0, SCREEN_WIDTH*SCREEN_HEIGHT);
+	heatRng = rngSeedLanes(1, 0, 0);
 }
 
 void updateFire() {
@@ -171,28 +190,11 @@ void updateFire() {
 }
 
 void renderFire() {
-	Uint8 *dst;
-	int src = 0;
-	long i, j;
-	Uint8 *initbuffer = (Uint8 *)screenSurface->pixels;
-	int bpp = screenSurface->format->BytesPerPixel;
+	// fire2 is already a frame of indices, menos las 3 ultimas lineas
+	IndexedFrame frame = { fire2, SCREEN_WIDTH, SCREEN_HEIGHT - 3, SCREEN_WIDTH };
 
 	SDL_LockSurface(screenSurface);
-	dst = initbuffer;
-	for (j = 0; j<(SCREEN_HEIGHT-3); j++) // Menos las 3 ultimas lineas
-	{
-		dst = initbuffer + j *screenSurface->pitch;
-		for (i = 0; i<SCREEN_WIDTH; i++)
-		{
-			// plot the pixel from fire2
-			unsigned int Color = 0;
-			int indexColor = fire2[src];
-			Color = 0xFF000000 + (palette[indexColor].R << 16) + (palette[indexColor].G << 8) + palette[indexColor].B;
-			*(Uint32 *)dst = Color;
-			dst += bpp;
-			src++;
-		}
-	}
+	indexedResolve(frame, palette, (Uint32 *)screenSurface->pixels, screenSurface->pitch / 4);
 	SDL_UnlockSurface(screenSurface);
 
 }
@@ -216,9 +218,9 @@ void Shade_Pal(int s, int e, int r1, int g1, int b1, int r2, int g2, int b2)
 	for (i = 0; i <= e - s; i++)
 	{
 		k = (float)i / (float)(e - s);
-		palette[s + i].R = (int)(r1 + (r2 - r1)*k);
-		palette[s + i].G = (int)(g1 + (g2 - g1)*k);
-		palette[s + i].B = (int)(b1 + (b2 - b1)*k);
+		palette[s + i] = palettePack((unsigned char)(int)(r1 + (r2 - r1)*k),
+			(unsigned char)(int)(g1 + (g2 - g1)*k),
+			(unsigned char)(int)(b1 + (b2 - b1)*k));
 	}
 }
 
@@ -228,12 +230,14 @@ void Shade_Pal(int s, int e, int r1, int g1, int b1, int r2, int g2, int b2)
 void Heat(unsigned char *dst)
 {
 	int i, j;
+	uint32_t random[MAX_HOT_SPOTS + 1];
+	kernels.rngFill(random, MAX_HOT_SPOTS + 1, heatRng);
 	
-	j = (rand() % 512);
+	j = rngRange(random[0], MAX_HOT_SPOTS);
 	// add some random hot spots at the bottom of the buffer
 	for (i = 0; i<j; i++)
 	{
-		dst[(SCREEN_WIDTH*(SCREEN_HEIGHT - 3)) + (rand() % (SCREEN_WIDTH * 3))] = 255;
+		dst[(SCREEN_WIDTH*(SCREEN_HEIGHT - 3)) + rngRange(random[i + 1], SCREEN_WIDTH * 3)] = 255;
 	}
 }
 
@@ -243,26 +247,5 @@ void Heat(unsigned char *dst)
 */
 void Blur_Up(unsigned char *src, unsigned char *dst)
 {
-	int offs = 0;
-	unsigned char b;
-	for (int j = 0; j<(SCREEN_HEIGHT-2); j++)
-	{
-		// set first pixel of the line to 0
-		dst[offs] = 0; offs++;
-		// calculate the filter for all the other pixels
-		for (int i = 1; i<(SCREEN_WIDTH-1); i++)
-		{
-			// calculate the average
-			b = (int)(src[offs - 1] +  src[offs + 1]
-				+ src[offs + (SCREEN_WIDTH - 1)] + src[offs + (SCREEN_WIDTH)] + src[offs + (SCREEN_WIDTH + 1)]
-				+ src[offs + ((SCREEN_WIDTH*2) - 1)] + src[offs + (SCREEN_WIDTH * 2)] + src[offs + ((SCREEN_WIDTH*2) + 1)]) / 8 ;
-			// store the pixel
-			dst[offs] = b;
-			offs++;
-		}
-		// set last pixel of the line to 0
-		dst[offs] = 0; offs++;
-	}
-	// clear the last 2 lines
-	memset((void *)((long)(dst)+offs), 0, SCREEN_WIDTH * 2);
+	kernels.fireBlur(src, dst, SCREEN_WIDTH, SCREEN_HEIGHT);
 }
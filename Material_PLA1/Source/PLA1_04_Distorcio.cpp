@@ -3,6 +3,14 @@
 #include <iostream>
 #include <cmath>
 
+#include "../../Implementation/memtrack.h"
+#include "../../Implementation/assetpack.h"
+#include "../../Implementation/kernels.h"
+#include "../../Implementation/fixed.h"
+#include "../../Implementation/fastmath.h"
+#include "../../Implementation/tablecache.h"
+#include "../../Implementation/sampler.h"
+
 //Screen dimension constants
 const int SCREEN_WIDTH = 640;
 const int SCREEN_HEIGHT = 480;
@@ -16,8 +24,8 @@ SDL_Surface* screenSurface = NULL;
 int lastTime = 0, currentTime, deltaTime;
 float msFrame = 1 / (FPS / 1000.0f);
 
-// displacement buffers
-char *dispX, *dispY;
+// displacement buffers, one after the other in a table from the table cache
+const Fixed5_3 *dispX, *dispY;
 // image background
 SDL_Surface *image;
 // define the distortion buffer movement
@@ -35,12 +43,25 @@ void initDistortion();
 void updateDistortion();
 void renderDistortion();
 
-void precalculate();
+void precalculate(void* table);
 void Distort();
 void Distort_Bili();
 
 int main( int argc, char* args[] )
 {
+	// --isa=scalar|sse2|avx2|avx512 forces a kernel variant
+	// --tables dir keeps the displacement tables in dir
+	// --memreport prints the allocations when closing
+	KernelIsa isa = ISA_COUNT;
+	for (int a = 1; a < argc; a++) {
+		if (kernelsParseIsa(args[a]) != ISA_COUNT) isa = kernelsParseIsa(args[a]);
+		if (strcmp(args[a], "--memreport") == 0) memReportOnExit = true;
+		if (strcmp(args[a], "--tables") == 0 && a + 1 < argc) tableCacheDir = args[++a];
+	}
+	if (tableCacheDir != NULL) frameCacheMakeDir(tableCacheDir);
+	kernelsInit(isa);
+	kernelsReport();
+
 	//Start up SDL and create window
 	if (!initSDL())
 	{
@@ -127,9 +148,9 @@ void render() {
 }
 
 void close() {
-	free(dispX);
-	free(dispY);
-	SDL_FreeSurface(image);
+	tableCacheFree(dispX);
+	memFreeSurface(image);
+	if (memReportOnExit) memReport();
 	//Destroy window
 	SDL_DestroyWindow(window);
 	//Quit SDL subsystems
@@ -147,27 +168,27 @@ void waitTime() {
 }
 
 void initDistortion() {
-	// two buffers
-	dispX = (char*)malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 4);
-	dispY = (char*)malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 4);
-	// create two distortion functions
-	precalculate();
+	// two buffers, twice the screen in each direction
+	const size_t size = (SCREEN_WIDTH * 2) * (SCREEN_HEIGHT * 2);
+	char params[32];
+	snprintf(params, sizeof(params), "%dx%d", SCREEN_WIDTH, SCREEN_HEIGHT);
+	// create two distortion functions, or map them from the last run
+	dispX = (const Fixed5_3*)tableCacheGet("distortion", "distortion.v1", params, size * 2 * sizeof(Fixed5_3), precalculate);
+	dispY = dispX + size;
 	// load the background image
-	SDL_Surface *temp = IMG_Load("uoc.png");
-	if (temp == NULL) {
-		std::cout << "Image can be loaded! " << IMG_GetError();
+	image = assetLoadImage("distortion", "uoc.png", SDL_PIXELFORMAT_ARGB8888);
+	if (image == NULL) {
 		close();
 		exit(1);
 	}
-	image = SDL_ConvertSurfaceFormat(temp, SDL_PIXELFORMAT_ARGB8888, 0);
 }
 
 void updateDistortion() {
 	// move distortion buffer
-	windowx1 = (SCREEN_WIDTH / 2) + (int)(((SCREEN_WIDTH / 2)-1) * cos((double)currentTime / 2050));
-	windowx2 = (SCREEN_WIDTH / 2) + (int)(((SCREEN_WIDTH / 2) - 1) * sin((double)-currentTime / 1970));
-	windowy1 = (SCREEN_HEIGHT / 2) + (int)(((SCREEN_HEIGHT / 2) - 1) * sin((double)currentTime / 2310));
-	windowy2 = (SCREEN_HEIGHT / 2) + (int)(((SCREEN_HEIGHT / 2) - 1) * cos((double)-currentTime / 2240));
+	windowx1 = (SCREEN_WIDTH / 2) + (int)(((SCREEN_WIDTH / 2)-1) * mathCos<MATH_POLY>((double)currentTime / 2050));
+	windowx2 = (SCREEN_WIDTH / 2) + (int)(((SCREEN_WIDTH / 2) - 1) * mathSin<MATH_POLY>((double)-currentTime / 1970));
+	windowy1 = (SCREEN_HEIGHT / 2) + (int)(((SCREEN_HEIGHT / 2) - 1) * mathSin<MATH_POLY>((double)currentTime / 2310));
+	windowy2 = (SCREEN_HEIGHT / 2) + (int)(((SCREEN_HEIGHT / 2) - 1) * mathCos<MATH_POLY>((double)-currentTime / 2240));
 }
 
 void renderDistortion() {
@@ -181,10 +202,13 @@ void renderDistortion() {
 }
 
 /*
-* calculate a distorion function for X and Y in 5.3 fixed point
+* calculate a distorion function for X and Y in 5.3 fixed point, X then Y
+* in table. bump distortion.v1 in initDistortion() when changing them
 */
-void precalculate()
+void precalculate(void* table)
 {
+	Fixed5_3* tableX = (Fixed5_3*)table;
+	Fixed5_3* tableY = tableX + (SCREEN_WIDTH * 2) * (SCREEN_HEIGHT * 2);
 	int i, j, dst;
 	dst = 0;
 	for (j = 0; j<(SCREEN_HEIGHT * 2); j++)
@@ -195,19 +219,19 @@ void precalculate()
 			float y = (float)j;
 			// notice the values contained in the buffers are signed
 			// i.e. can be both positive and negative
-			// also notice we multiply by 8 to get 5.3 fixed point distortion
-			// coefficients for our bilinear filtering
-			dispX[dst] = (signed char)(8 * (2 * sin(x / 20) + sin(x*y/2000)));
-			dispY[dst] = (signed char)(8 * (cos(x / 31) + cos(x*y / 1783)));
+			// also notice they are 5.3 fixed point, the 3 fractional bits are
+			// the coefficients of our bilinear filtering
+			tableX[dst] = Fixed5_3::fromDouble(2 * sin(x / 20) + sin(x*y/2000));
+			tableY[dst] = Fixed5_3::fromDouble(cos(x / 31) + cos(x*y / 1783));
 
 			// Uncomment this to take another beautiful distorsion
 			/*
-			dispX[dst] = (signed char)(8 * (2 * (sin(x / 20) + sin(x*y / 2000)
+			tableX[dst] = Fixed5_3::fromDouble(2 * (sin(x / 20) + sin(x*y / 2000)
 				+ sin((x + y) / 100) + sin((y - x) / 70) + sin((x + 4 * y) / 70)
-				+ 2 * sin(hypot(256 - x, (150 - y / 8)) / 40))));
-			dispY[dst] = (signed char)(8 * ((cos(x / 31) + cos(x*y / 1783) +
+				+ 2 * sin(hypot(256 - x, (150 - y / 8)) / 40)));
+			tableY[dst] = Fixed5_3::fromDouble((cos(x / 31) + cos(x*y / 1783) +
 				+2 * cos((x + y) / 137) + cos((y - x) / 55) + 2 * cos((x + 8 * y) / 57)
-				+ cos(hypot(384 - x, (274 - y / 9)) / 51))));
+				+ cos(hypot(384 - x, (274 - y / 9)) / 51)));
 			*/
 			dst++;
 		}
@@ -240,8 +264,8 @@ void Distort()
 		{
 			// get distorted coordinates, use the integer part of the distortion
 			// buffers and truncate to closest texel
-			dY = j + (dispY[src1] >> 3);
-			dX = i + (dispX[src2] >> 3);
+			dY = j + dispY[src1].toInt();
+			dX = i + dispX[src2].toInt();
 			// check the texel is valid
 			if ((dY >= 0) && (dY<(SCREEN_HEIGHT - 1)) && (dX >= 0) && (dX<(SCREEN_WIDTH - 1)))
 			{
@@ -269,66 +293,28 @@ void Distort()
 void Distort_Bili()
 {
 	// setup the offsets in the buffers
-	Uint8 *dst;
 	int src1 = windowy1 * (SCREEN_WIDTH * 2) + windowx1,
 		src2 = windowy2 * (SCREEN_WIDTH * 2) + windowx2;
-	int dX, dY, cX, cY;
 	Uint8 *initbuffer = (Uint8 *)screenSurface->pixels;
-	int bpp = screenSurface->format->BytesPerPixel;
-	Uint32 *imagebuffer = (Uint32 *)image->pixels;
-	int bppImage = image->format->BytesPerPixel;
+	SamplerTexture texture = samplerTexture(image);
+	FixedTexel u[SCREEN_WIDTH], v[SCREEN_WIDTH];
 
 	SDL_LockSurface(screenSurface);
 	// loop for all lines
 	for (int j = 0; j<SCREEN_HEIGHT; j++)
 	{
-		dst = initbuffer + j *screenSurface->pitch;
-		// for all pixels
+		// the distorted coordinates of the line, the fractionnal part of
+		// the distortion weights the 4 surrounding texels
 		for (int i = 0; i<SCREEN_WIDTH; i++)
 		{
-			// get distorted coordinates, by using the truncated integer part
-			// of the distortion coefficients
-			dY = j + (dispY[src1] >> 3);
-			dX = i + (dispX[src2] >> 3);
-			// get the linear interpolation coefficiants by using the fractionnal
-			// part of the distortion coefficients
-			cY = dispY[src1] & 0x7;
-			cX = dispX[src2] & 0x7;
-			// check if the texel is valid
-			if ((dY >= 0) && (dY<(SCREEN_HEIGHT-1)) && (dX >= 0) && (dX<(SCREEN_WIDTH-1)))
-			{
-				// load the 4 surrounding texels and multiply them by the
-				// right bilinear coefficients, then get rid of the fractionnal
-				// part by shifting right by 6
-				SDL_Color Colorvalues[4];
-				SDL_GetRGB(*(Uint32*)((Uint8*)image->pixels + dY     * image->pitch + dX     * bppImage), image->format, &Colorvalues[0].r, &Colorvalues[0].g, &Colorvalues[0].b);
-				SDL_GetRGB(*(Uint32*)((Uint8*)image->pixels + dY     * image->pitch + (dX+1) * bppImage), image->format, &Colorvalues[1].r, &Colorvalues[1].g, &Colorvalues[1].b);
-				SDL_GetRGB(*(Uint32*)((Uint8*)image->pixels + (dY+1) * image->pitch + dX     * bppImage), image->format, &Colorvalues[2].r, &Colorvalues[2].g, &Colorvalues[2].b);
-				SDL_GetRGB(*(Uint32*)((Uint8*)image->pixels + (dY+1) * image->pitch + (dX+1) * bppImage), image->format, &Colorvalues[3].r, &Colorvalues[3].g, &Colorvalues[3].b);
-				Uint32 Color[3]; // 0=R  1=G  2=B
-				Color[0] = (Colorvalues[0].r * (0x8 - cX) * (0x8 - cY) +
-					Colorvalues[1].r * cX * (0x8 - cY) +
-					Colorvalues[2].r * (0x8 - cX) * cY +
-					Colorvalues[3].r * cX * cY) >> 6;
-				Color[1] = (Colorvalues[0].g * (0x8 - cX) * (0x8 - cY) +
-					Colorvalues[1].g * cX * (0x8 - cY) +
-					Colorvalues[2].g * (0x8 - cX) * cY +
-					Colorvalues[3].g * cX * cY) >> 6;
-				Color[2] = (Colorvalues[0].b * (0x8 - cX) * (0x8 - cY) +
-					Colorvalues[1].b * cX * (0x8 - cY) +
-					Colorvalues[2].b * (0x8 - cX) * cY +
-					Colorvalues[3].b * cX * cY) >> 6;
-				Uint32 resultColor = SDL_MapRGB(image->format, Color[0], Color[1], Color[2]);
-				*(Uint32 *)dst = resultColor;
-			}
-			// otherwise, just make it black
-			else *(Uint32 *)dst = 0;
-			dst += bpp;
-			src1++; src2++;
+			u[i] = FixedTexel::fromInt(i) + FixedTexel::from(dispX[src2 + i]);
+			v[i] = FixedTexel::fromInt(j) + FixedTexel::from(dispY[src1 + i]);
 		}
+		kernels.sampleRow((Uint32 *)(initbuffer + j * screenSurface->pitch), texture, u, v, SCREEN_WIDTH,
+			SAMPLER_BILINEAR, SAMPLER_BORDER);
 		// next line
-		src1 += SCREEN_WIDTH;
-		src2 += SCREEN_WIDTH;
+		src1 += SCREEN_WIDTH * 2;
+		src2 += SCREEN_WIDTH * 2;
 	}
 	SDL_UnlockSurface(screenSurface);
 }
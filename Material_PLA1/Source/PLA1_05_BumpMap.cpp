@@ -3,6 +3,12 @@
 #include <iostream>
 #include <cmath>
 
+#include "../../Implementation/memtrack.h"
+#include "../../Implementation/assetpack.h"
+#include "../../Implementation/rng.h"
+#include "../../Implementation/fastmath.h"
+#include "../../Implementation/tablecache.h"
+
 //Screen dimension constants
 const int SCREEN_WIDTH = 640;
 const int SCREEN_HEIGHT = 480;
@@ -19,8 +25,8 @@ float msFrame = 1 / (FPS / 1000.0f);
 // size of the spot light
 #define LIGHTSIZE 2.4f
 #define LIGHT_PIXEL_RES 256
-// contains the precalculated spotlight
-unsigned char *light; 
+// contains the precalculated spotlight, from the table cache
+const unsigned char *light;
 // image color
 SDL_Surface *image;
 // imagen bump
@@ -40,11 +46,19 @@ void initBumpMap();
 void updateBumpMap();
 void renderBumpMap();
 
-void Compute_Light();
+void Compute_Light(void* table);
 void Bump();
 
 int main( int argc, char* args[] )
 {
+	// --tables dir keeps the light pattern in dir
+	// --memreport prints the allocations when closing
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(args[a], "--tables") == 0 && a + 1 < argc) tableCacheDir = args[++a];
+		if (strcmp(args[a], "--memreport") == 0) memReportOnExit = true;
+	}
+	if (tableCacheDir != NULL) frameCacheMakeDir(tableCacheDir);
+
 	//Start up SDL and create window
 	if (!initSDL())
 	{
@@ -131,9 +145,10 @@ void render() {
 }
 
 void close() {
-	free(light);
-	SDL_FreeSurface(image);
-	SDL_FreeSurface(bump);
+	tableCacheFree(light);
+	memFreeSurface(image);
+	memFreeSurface(bump);
+	if (memReportOnExit) memReport();
 	//Destroy window
 	SDL_DestroyWindow(window);
 	//Quit SDL subsystems
@@ -151,35 +166,32 @@ void waitTime() {
 }
 
 void initBumpMap() {
-	// contains the image of the spotlight
-	light = (unsigned char*)malloc(LIGHT_PIXEL_RES * LIGHT_PIXEL_RES);
-	// generate the light pattern
-	Compute_Light();
+	// contains the image of the spotlight, generate the light pattern or
+	// map it from the last run
+	char params[32];
+	snprintf(params, sizeof(params), "%d/%g", LIGHT_PIXEL_RES, LIGHTSIZE);
+	light = (const unsigned char*)tableCacheGet("bumpmap", "light.v1", params, LIGHT_PIXEL_RES * LIGHT_PIXEL_RES, Compute_Light);
 	// load the color image
-	SDL_Surface *temp = IMG_Load("wall.png");
-	if (temp == NULL) {
-		std::cout << "Image can be loaded! " << IMG_GetError();
+	image = assetLoadImage("bumpmap", "wall.png", SDL_PIXELFORMAT_ARGB8888);
+	if (image == NULL) {
 		close();
 		exit(1);
 	}
-	image = SDL_ConvertSurfaceFormat(temp, SDL_PIXELFORMAT_ARGB8888, 0);
 	// load the bump image
-	temp = IMG_Load("bump.png");
-	if (temp == NULL) {
-		std::cout << "Image can be loaded! " << IMG_GetError();
+	bump = assetLoadImage("bumpmap", "bump.png", SDL_PIXELFORMAT_ARGB8888);
+	if (bump == NULL) {
 		close();
 		exit(1);
 	}
-	bump = SDL_ConvertSurfaceFormat(temp, SDL_PIXELFORMAT_ARGB8888, 0);
 }
 
 void updateBumpMap() {
 	// move the light.... more sines :)
-	windowx1 = (int)((LIGHT_PIXEL_RES / 2) * cos((double)currentTime / 640)) - 20;
-	windowy1 = (int)((LIGHT_PIXEL_RES / 2) * sin((double)-currentTime / 450)) + 20;
-	windowx2 = (int)((LIGHT_PIXEL_RES / 2) * cos((double)-currentTime / 510)) - 20;
-	windowy2 = (int)((LIGHT_PIXEL_RES / 2) * sin((double)currentTime / 710)) + 20;
-	windowZ = 192 + (int)(((LIGHT_PIXEL_RES / 2) - 1) * sin((double)currentTime / 1120));
+	windowx1 = (int)((LIGHT_PIXEL_RES / 2) * mathCos<MATH_POLY>((double)currentTime / 640)) - 20;
+	windowy1 = (int)((LIGHT_PIXEL_RES / 2) * mathSin<MATH_POLY>((double)-currentTime / 450)) + 20;
+	windowx2 = (int)((LIGHT_PIXEL_RES / 2) * mathCos<MATH_POLY>((double)-currentTime / 510)) - 20;
+	windowy2 = (int)((LIGHT_PIXEL_RES / 2) * mathSin<MATH_POLY>((double)currentTime / 710)) + 20;
+	windowZ = 192 + (int)(((LIGHT_PIXEL_RES / 2) - 1) * mathSin<MATH_POLY>((double)currentTime / 1120));
 }
 
 void renderBumpMap() {
@@ -188,10 +200,12 @@ void renderBumpMap() {
 }
 
 /*
-* generate a "spot light" pattern
+* generate a "spot light" pattern into table
 */
-void Compute_Light()
+void Compute_Light(void* table)
 {
+	unsigned char* pattern = (unsigned char*)table;
+	Rng dither = rngSeed(1, 0, 0);
 	for (int j = 0; j<LIGHT_PIXEL_RES; j++)
 		for (int i = 0; i<LIGHT_PIXEL_RES; i++)
 		{
@@ -199,12 +213,12 @@ void Compute_Light()
 			float dist = (float)((LIGHT_PIXEL_RES / 2) - i)*((LIGHT_PIXEL_RES / 2) - i) + ((LIGHT_PIXEL_RES / 2) - j)*((LIGHT_PIXEL_RES / 2) - j);
 			if (fabs(dist)>1) dist = sqrt(dist);
 			// then fade if according to the distance, and a random coefficient
-			int c = (int)(LIGHTSIZE*dist) + (rand() & 7) - 3;
+			int c = (int)(LIGHTSIZE*dist) + (rngNext(dither) & 7) - 3;
 			// clip it
 			if (c<0) c = 0;
 			if (c>255) c = 255;
 			// and store it
-			light[(j * LIGHT_PIXEL_RES) + i] = 255 - c;
+			pattern[(j * LIGHT_PIXEL_RES) + i] = 255 - c;
 		}
 }
 
@@ -3,6 +3,12 @@
 #include <iostream>
 #include <cmath>
 
+#include "../../Implementation/memtrack.h"
+#include "../../Implementation/kernels.h"
+#include "../../Implementation/fixed.h"
+#include "../../Implementation/indexed.h"
+#include "../../Implementation/sampler.h"
+
 //Screen dimension constants
 const int SCREEN_WIDTH = 640;
 const int SCREEN_HEIGHT = 480;
@@ -37,8 +43,11 @@ long offs;
 // setup the palette
 int i, j = 0, k = 0;
 
-struct RGBColor { unsigned char R, G, B; };
-RGBColor palette[256];
+// packed 0xAARRGGBB, the zoom writes indices into zoomFrame
+Uint32 palette[256];
+IndexedFrame zoomFrame;
+// --bilinear interpolates the indices of the fractal while zooming
+SamplerFilter zoomFilter = SAMPLER_NEAREST;
 
 bool initSDL();
 void update();
@@ -59,6 +68,18 @@ void Zoom(double z);
 
 int main( int argc, char* args[] )
 {
+	// --isa=scalar|sse2|avx2|avx512 forces a kernel variant
+	// --bilinear filters the zoom
+	// --memreport prints the allocations when closing
+	KernelIsa isa = ISA_COUNT;
+	for (int a = 1; a < argc; a++) {
+		if (kernelsParseIsa(args[a]) != ISA_COUNT) isa = kernelsParseIsa(args[a]);
+		if (strcmp(args[a], "--memreport") == 0) memReportOnExit = true;
+		if (strcmp(args[a], "--bilinear") == 0) zoomFilter = SAMPLER_BILINEAR;
+	}
+	kernelsInit(isa);
+	kernelsReport();
+
 	//Start up SDL and create window
 	if (!initSDL())
 	{
@@ -145,8 +166,10 @@ void render() {
 }
 
 void close() {
-	free(frac1);
-	free(frac2);
+	memFreeTable(frac1);
+	memFreeTable(frac2);
+	indexedFree(zoomFrame);
+	if (memReportOnExit) memReport();
 	//Destroy window
 	SDL_DestroyWindow(window);
 	//Quit SDL subsystems
@@ -166,17 +189,18 @@ void waitTime() {
 void buildPalette() {
 	for (int i = 0; i<256; i++)
 	{
-		palette[i].R = (unsigned char)(128 + 127 * cos(i * M_PI / 128 + (double)currentTime / 740));
-		palette[i].G = (unsigned char)(128 + 127 * sin(i * M_PI / 128 + (double)currentTime / 630));
-		palette[i].B = (unsigned char)(128 - 127 * cos(i * M_PI / 128 + (double)currentTime / 810));
+		palette[i] = palettePack(
+			(unsigned char)(128 + 127 * cos(i * M_PI / 128 + (double)currentTime / 740)),
+			(unsigned char)(128 + 127 * sin(i * M_PI / 128 + (double)currentTime / 630)),
+			(unsigned char)(128 - 127 * cos(i * M_PI / 128 + (double)currentTime / 810)));
 	}
 
 }
 
 void initFractal() {
 	// allocate memory for our fractal
-	frac1 = (unsigned char*)malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 4);
-	frac2 = (unsigned char*)malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 4);
+	frac1 = (unsigned char*)memAllocTable("fractal", (SCREEN_WIDTH * 2) * (SCREEN_HEIGHT * 2));
+	frac2 = (unsigned char*)memAllocTable("fractal", (SCREEN_WIDTH * 2) * (SCREEN_HEIGHT * 2));
 	// calculate the first fractal
 	Start_Frac(or -zx, oi - zy, or +zx, oi + zy);
 	for (j = 0; j<(SCREEN_HEIGHT / 2); j++) Compute_Frac();
@@ -270,30 +294,9 @@ void Compute_Frac()
 	for (int j = 0; j<4; j++)
 	{
 		pr = sr;
-		for (int i = 0; i<(SCREEN_WIDTH * 2); i++)
-		{
-			unsigned char c = 0;
-			double vi = pi, vr = pr, nvi, nvr;
-			// loop until distance is above 2, or counter hits limit
-			while ((vr*vr + vi*vi<4) && (c<255))
-			{
-				// compute Z(n+1) given Z(n)
-				nvr = vr*vr - vi*vi + pr;
-				nvi = 2 * vi * vr + pi;
-
-				// that becomes Z(n)
-				vi = nvi;
-				vr = nvr;
-
-				// increment counter
-				c++;
-			}
-			// store colour
-			frac1[offs] = c;
-			offs++;
-			// interpolate X
-			pr += dr;
-		}
+		// one line of iteration counts, stepping dr along X
+		kernels.mandelbrotRow(frac1 + offs, pr, dr, pi, SCREEN_WIDTH * 2);
+		offs += SCREEN_WIDTH * 2;
 		// interpolate Y
 		pi += di;
 	}
@@ -315,47 +318,29 @@ void Done_Frac()
 */
 void Zoom(double z)
 {
-	// setup the offsets in the buffers
-	Uint8 *dst;
-	Uint8 *initbuffer = (Uint8 *)screenSurface->pixels;
-	int bpp = screenSurface->format->BytesPerPixel;
+	// the indices first, through the palette at the end
+	indexedEnsure(zoomFrame, "zoom", SCREEN_WIDTH, SCREEN_HEIGHT);
+	SamplerTexture8 texture = { frac2, SCREEN_WIDTH * 2, SCREEN_HEIGHT * 2, SCREEN_WIDTH * 2 };
 
 	// what's the size of rectangle in the source image we want to display
-	int width = (int)(((SCREEN_WIDTH * 2) << 16) / (256.0f*(1 + z))) << 8,
-		height = (int)(((SCREEN_HEIGHT *2) << 16) / (256.0f*(1 + z))) << 8,
+	Fixed16_16 width = Fixed16_16::fromDouble(SCREEN_WIDTH * 2 / (1 + z)),
+		height = Fixed16_16::fromDouble(SCREEN_HEIGHT * 2 / (1 + z)),
 		// where do we start our interpolation
-		startx = (((SCREEN_WIDTH * 2) << 16) - width) >> 1,
-		starty = (((SCREEN_HEIGHT * 2) << 16) - height) >> 1,
+		startx = (Fixed16_16::fromInt(SCREEN_WIDTH * 2) - width) / 2,
+		starty = (Fixed16_16::fromInt(SCREEN_HEIGHT * 2) - height) / 2,
 		// get our deltas
 		deltax = width / SCREEN_WIDTH,
 		deltay = height / SCREEN_HEIGHT,
-		px, py = starty;
+		py = starty;
 
 	for (int j = 0; j<SCREEN_HEIGHT; j++)
 	{
-		// set start value
-		px = startx;
-		dst = initbuffer + j *screenSurface->pitch;
-		for (int i = 0; i<SCREEN_WIDTH; i++)
-		{
-			// load the bilinear filtered texel
-			unsigned int Color = 0;
-			// Uncomment for bilinear filter
-			/*
-			Color = 
-				(frac2[(py >> 16) * (SCREEN_WIDTH * 2) + (px >> 16)] * (0x100 - ((py >> 8) & 0xff)) * (0x100 - ((px >> 8) & 0xff))
-					+ frac2[(py >> 16) * (SCREEN_WIDTH * 2) + ((px >> 16) + 1)] * (0x100 - ((py >> 8) & 0xff)) * ((px >> 8) & 0xff)
-					+ frac2[((py >> 16) + 1) * (SCREEN_WIDTH * 2) + (px >> 16)] * ((py >> 8) & 0xff) * (0x100 - ((px >> 8) & 0xff))
-					+ frac2[((py >> 16) + 1) * (SCREEN_WIDTH * 2) + ((px >> 16) + 1)] * ((py >> 8) & 0xff) * ((px >> 8) & 0xff)) >> 16;
-			*/
-			int indexColor = frac2[(py >> 16) * (SCREEN_WIDTH * 2) + (px >> 16)]; // Direct Pixel color
-			Color = 0xFF000000 + (palette[indexColor].R << 16) + (palette[indexColor].G << 8) + palette[indexColor].B;
-			*(Uint32 *)dst = Color;
-			// interpolate X
-			px += deltax;
-			dst += bpp;
-		}
+		// a line of texels, the right and bottom neighbours of the last
+		// ones are clamped to the bitmap
+		textureSpan8(zoomFrame.pixels + j * zoomFrame.pitch, texture, startx, py, deltax, Fixed16_16::fromInt(0),
+			SCREEN_WIDTH, zoomFilter, SAMPLER_CLAMP);
 		// interpolate Y
 		py += deltay;
 	}
+	indexedResolve(zoomFrame, palette, (Uint32 *)screenSurface->pixels, screenSurface->pitch / 4);
 }
\ No newline at end of file
@@ -3,6 +3,11 @@
 #include <iostream>
 #include <cmath>
 
+#include "../../Implementation/memtrack.h"
+#include "../../Implementation/assetpack.h"
+#include "../../Implementation/tablecache.h"
+#include "../../Implementation/sampler.h"
+
 //Screen dimension constants
 const int SCREEN_WIDTH = 640;
 const int SCREEN_HEIGHT = 480;
@@ -16,10 +21,14 @@ SDL_Surface* screenSurface = NULL;
 int lastTime = 0, currentTime, deltaTime;
 float msFrame = 1 / (FPS / 1000.0f);
 
-// buffer containing the (u,v) pairs at each pixel
-unsigned char *texcoord;
+// buffer containing the (u,v) pairs at each pixel in 8.8 fixed point, from
+// the table cache
+const Uint16 *texcoord;
 // buffer containing the texture
 SDL_Surface* texdata;
+// the texture as the sampler reads it, in the layout of --layout
+SamplerTexture texture;
+SamplerLayout layout = SAMPLER_LINEAR;
 
 bool initSDL();
 void update();
@@ -29,6 +38,7 @@ void close();
 void waitTime();
 
 void initTunel();
+void Raymarch_Tunel(void* table);
 void renderTunel();
 float get_x_pos(float f);
 float get_y_pos(float f);
@@ -37,6 +47,21 @@ void Draw_Hole(int du, int dv);
 
 int main( int argc, char* args[] )
 {
+	// --isa=scalar|sse2|avx2|avx512 forces a kernel variant
+	// --layout=linear|tiled|morton stores the texture in rows, tiles or Morton order
+	// --tables dir keeps the raymarched coordinates in dir
+	// --memreport prints the allocations when closing
+	KernelIsa isa = ISA_COUNT;
+	for (int a = 1; a < argc; a++) {
+		if (kernelsParseIsa(args[a]) != ISA_COUNT) isa = kernelsParseIsa(args[a]);
+		if (strcmp(args[a], "--memreport") == 0) memReportOnExit = true;
+		if (samplerParseLayout(args[a]) != SAMPLER_LAYOUT_COUNT) layout = samplerParseLayout(args[a]);
+		if (strcmp(args[a], "--tables") == 0 && a + 1 < argc) tableCacheDir = args[++a];
+	}
+	if (tableCacheDir != NULL) frameCacheMakeDir(tableCacheDir);
+	kernelsInit(isa);
+	kernelsReport();
+
 	//Start up SDL and create window
 	if (!initSDL())
 	{
@@ -122,8 +147,10 @@ void render() {
 }
 
 void close() {
-	free(texcoord);
-	SDL_FreeSurface(texdata);
+	tableCacheFree(texcoord);
+	samplerFreeTexture(texture);
+	memFreeSurface(texdata);
+	if (memReportOnExit) memReport();
 	//Destroy window
 	SDL_DestroyWindow(window);
 	//Quit SDL subsystems
@@ -140,10 +167,13 @@ void waitTime() {
 
 }
 
-void initTunel() {
-
-	// alloc memory to store SCREEEN SIZE times u, v
-	texcoord =  (unsigned char*) malloc(SCREEN_WIDTH * SCREEN_HEIGHT *2);
+/*
+* raymarch the (u,v) coordinates of every pixel into table, 8.8 fixed point
+* wrapping at 256 texels. bump tunnel.v2 in initTunel() when changing them
+*/
+void Raymarch_Tunel(void* table)
+{
+	Uint16* coords = (Uint16*)table;
 	long offs = 0;
 	// precalc the (u,v) coordinates
 	for (int j = -(SCREEN_HEIGHT /2); j<(SCREEN_HEIGHT/2); j++) {
@@ -183,18 +213,32 @@ void initTunel() {
 			// calculate the texture coordinates
 			x -= get_x_pos(z);
 			y -= get_y_pos(z);
+			// keep 8 fractional bits for the bilinear weights
 			float ang = atan2(y, x) * 256 / M_PI;
-			unsigned char u = (unsigned char)ang;
-			unsigned char v = (unsigned char)z;
+			Uint16 u = (Uint16)(int)(ang * 256);
+			Uint16 v = (Uint16)(int)(z * 256);
 			// store texture coordinates
-			texcoord[offs] = u;
-			texcoord[offs + 1] = v;
+			coords[offs] = u;
+			coords[offs + 1] = v;
 			offs += 2;
 		}
 	}
+}
+
+void initTunel() {
+
+	// SCREEEN SIZE times u, v, raymarched once and then mapped from the cache
+	char params[32];
+	snprintf(params, sizeof(params), "%dx%d", SCREEN_WIDTH, SCREEN_HEIGHT);
+	texcoord = (const Uint16*)tableCacheGet("tunnel", "tunnel.v2", params, SCREEN_WIDTH * SCREEN_HEIGHT * 2 * sizeof(Uint16), Raymarch_Tunel);
 
 	// load the texture
-	texdata = IMG_Load("texture.png");
+	texdata = assetLoadImage("tunnel", "texture.png", SDL_PIXELFORMAT_ARGB8888);
+	if (texdata == NULL) {
+		close();
+		exit(1);
+	}
+	texture = samplerLoadTexture("tunnel", texdata, layout);
 }
 
 
@@ -226,31 +270,25 @@ float get_radius(float f)
 	return 128;
 };
 
+/*
+* draw the tunnel with the texture scrolled by (du,dv) texels, filtered
+*/
 void Draw_Hole(int du, int dv)
 {
-	Uint8 *dst;
 	Uint8 *initbuffer = (Uint8 *)screenSurface->pixels;
-	int bpp = screenSurface->format->BytesPerPixel;
-	Uint8 *initbufferTexture = (Uint8 *)texdata->pixels;
-	int bppTexture = texdata->format->BytesPerPixel;
+	FixedTexel u[SCREEN_WIDTH], v[SCREEN_WIDTH];
 
-	long doffs = 0, soffs = 0;
+	long soffs = 0;
 	SDL_LockSurface(screenSurface);
 	for (int j = 0; j<SCREEN_HEIGHT; j++) {
-		dst = initbuffer + j *screenSurface->pitch;
 		for (int i = 0; i<SCREEN_WIDTH; i++) {
-			// load (u,v) and add displacement
-			unsigned char u = texcoord[soffs] + du;
-			unsigned char v = texcoord[soffs + 1] + dv;
-
-			SDL_Color Color;
-			SDL_GetRGB(*(Uint32*)((Uint8*)texdata->pixels + v * texdata->pitch + u * bppTexture), texdata->format, &Color.r, &Color.g, &Color.b);
-			Uint32 resultColor = SDL_MapRGB(screenSurface->format, Color.r, Color.g, Color.b);
-			*(Uint32 *)dst = resultColor;
-			dst += bpp;
-
+			// load (u,v) and add displacement, the texture wraps around
+			u[i] = FixedTexel::fromRaw(texcoord[soffs]) + FixedTexel::fromInt(du);
+			v[i] = FixedTexel::fromRaw(texcoord[soffs + 1]) + FixedTexel::fromInt(dv);
 			soffs += 2;
 		}
+		kernels.sampleRow((Uint32 *)(initbuffer + j * screenSurface->pitch), texture, u, v, SCREEN_WIDTH,
+			SAMPLER_BILINEAR, SAMPLER_WRAP);
 	}
 	SDL_UnlockSurface(screenSurface);
-}
\ No newline at end of file
+}
@@ -3,6 +3,11 @@
 #include <iostream>
 #include <cmath>
 
+#include "../../Implementation/memtrack.h"
+#include "../../Implementation/assetpack.h"
+#include "../../Implementation/fixed.h"
+#include "../../Implementation/sampler.h"
+
 //Screen dimension constants
 const int SCREEN_WIDTH = 640;
 const int SCREEN_HEIGHT = 480;
@@ -18,10 +23,15 @@ float msFrame = 1 / (FPS / 1000.0f);
 
 // buffer containing the texture
 SDL_Surface* texdata;
+// the texture as the sampler reads it, in the layout of --layout
+SamplerTexture texture;
+SamplerLayout layout = SAMPLER_LINEAR;
 // Points from texture
-int pointx1, pointy1,
+Fixed16_16 pointx1, pointy1,
 	pointx2, pointy2,
 	pointx3, pointy3;
+// F switches between bilinear and nearest texels
+SamplerFilter filter = SAMPLER_BILINEAR;
 
 bool initSDL();
 void update();
@@ -40,6 +50,18 @@ void TextureScreen();
 
 int main( int argc, char* args[] )
 {
+	// --isa=scalar|sse2|avx2|avx512 forces a kernel variant
+	// --layout=linear|tiled|morton stores the texture in rows, tiles or Morton order
+	// --memreport prints the allocations when closing
+	KernelIsa isa = ISA_COUNT;
+	for (int a = 1; a < argc; a++) {
+		if (kernelsParseIsa(args[a]) != ISA_COUNT) isa = kernelsParseIsa(args[a]);
+		if (strcmp(args[a], "--memreport") == 0) memReportOnExit = true;
+		if (samplerParseLayout(args[a]) != SAMPLER_LAYOUT_COUNT) layout = samplerParseLayout(args[a]);
+	}
+	kernelsInit(isa);
+	kernelsReport();
+
 	//Start up SDL and create window
 	if (!initSDL())
 	{
@@ -67,6 +89,9 @@ int main( int argc, char* args[] )
 					if (e.key.keysym.scancode == SDL_SCANCODE_ESCAPE) {
 						quit = true;
 					}
+					if (e.key.keysym.scancode == SDL_SCANCODE_F) {
+						filter = filter == SAMPLER_BILINEAR ? SAMPLER_NEAREST : SAMPLER_BILINEAR;
+					}
 				}
 				//User requests quit
 				if (e.type == SDL_QUIT)
@@ -124,7 +149,9 @@ void render() {
 }
 
 void close() {
-	SDL_FreeSurface(texdata);
+	samplerFreeTexture(texture);
+	memFreeSurface(texdata);
+	if (memReportOnExit) memReport();
 	//Destroy window
 	SDL_DestroyWindow(window);
 	//Quit SDL subsystems
@@ -144,13 +171,12 @@ void waitTime() {
 void initRotozoom() {
 
 	// load the texture
-	SDL_Surface* temp = IMG_Load("texture_zoom.png");
-	if (temp == NULL) {
-		std::cout << "Image can be loaded! " << IMG_GetError();
+	texdata = assetLoadImage("rotozoom", "texture_zoom.png", SDL_PIXELFORMAT_ARGB8888);
+	if (texdata == NULL) {
 		close();
 		exit(1);
 	}
-	texdata = SDL_ConvertSurfaceFormat(temp, SDL_PIXELFORMAT_ARGB8888, 0);
+	texture = samplerLoadTexture("rotozoom", texdata, layout);
 }
 
 void updateRotozoom() {
@@ -166,32 +192,28 @@ void renderRotozoom() {
 }
 /*
 * wrapper for the TextureScreen procedure
-* all parameters are 16.16 fixed point
+* sets the three corners of the screen in texture space
 */
 void DoRotoZoom(float cx, float cy, float radius, float angle)
 {
-	pointx1 = (int)(65536.0f * (cx + radius * cos(angle))),
-	pointy1 = (int)(65536.0f * (cy + radius * sin(angle))),
-	pointx2 = (int)(65536.0f * (cx + radius * cos(angle + 2.02458))),
-	pointy2 = (int)(65536.0f * (cy + radius * sin(angle + 2.02458))),
-	pointx3 = (int)(65536.0f * (cx + radius * cos(angle - 1.11701))),
-	pointy3 = (int)(65536.0f * (cy + radius * sin(angle - 1.11701)));
+	pointx1 = Fixed16_16::fromDouble(cx + radius * cos(angle)),
+	pointy1 = Fixed16_16::fromDouble(cy + radius * sin(angle)),
+	pointx2 = Fixed16_16::fromDouble(cx + radius * cos(angle + 2.02458)),
+	pointy2 = Fixed16_16::fromDouble(cy + radius * sin(angle + 2.02458)),
+	pointx3 = Fixed16_16::fromDouble(cx + radius * cos(angle - 1.11701)),
+	pointy3 = Fixed16_16::fromDouble(cy + radius * sin(angle - 1.11701));
 }
 
 /*
 * render a textured screen with no blocks
-* all parameters are 16.16 fixed point
+* the corners are 16.16 fixed point, the texture wraps around
 */
 void TextureScreen()
 {
 	// setup the offsets in the buffers
-	Uint8 *dst;
 	Uint8 *initbuffer = (Uint8 *)screenSurface->pixels;
-	int bpp = screenSurface->format->BytesPerPixel;
-	Uint8 *imagebuffer = (Uint8 *)texdata->pixels;
-	int bppImage = texdata->format->BytesPerPixel;
 	// compute deltas
-	int dxdx = (pointx2 - pointx1) / SCREEN_WIDTH,
+	Fixed16_16 dxdx = (pointx2 - pointx1) / SCREEN_WIDTH,
 		dydx = (pointy2 - pointy1) / SCREEN_WIDTH,
 		dxdy = (pointx3 - pointx1) / SCREEN_HEIGHT,
 		dydy = (pointy3 - pointy1) / SCREEN_HEIGHT;
@@ -200,22 +222,9 @@ void TextureScreen()
 	// loop for all lines
 	for (int j = 0; j<SCREEN_HEIGHT; j++)
 	{
-		dst = initbuffer + j *screenSurface->pitch;
-		pointx3 = pointx1;
-		pointy3 = pointy1;
-		// for each pixel
-		for (int i = 0; i<SCREEN_WIDTH; i++)
-		{
-			// get texel and store pixel
-			Uint8 *p = (Uint8 *)imagebuffer + ((pointy3 >> 16) & 0xff) * texdata->pitch + ((pointx3 >> 16) & 0xFF) * bppImage;
-			// copy it to the screen
-			*(Uint32 *)dst = *(Uint32 *)p;
-			// interpolate to get next texel in texture space
-			pointx3 += dxdx;
-			pointy3 += dydx;
-			// next pixel
-			dst += bpp;
-		}
+		// the line is a straight walk through texture space
+		textureSpan((Uint32 *)(initbuffer + j * screenSurface->pitch), texture, pointx1, pointy1, dxdx, dydx,
+			SCREEN_WIDTH, filter, SAMPLER_WRAP);
 		// interpolate to get start of next line in texture space
 		pointx1 += dxdy;
 		pointy1 += dydy;
@@ -5,6 +5,10 @@
 
 #include "vector.h"
 #include "matrix.h"
+#include "../../Implementation/memtrack.h"
+#include "../../Implementation/fastmath.h"
+#include "../../Implementation/kernels.h"
+#include "tour.h"
 
 //Screen dimension constants
 const int SCREEN_WIDTH = 640;
@@ -25,8 +29,8 @@ float msFrame = 1 / (FPS / 1000.0f);
 MATRIX obj;
 // how far it is from the viewer
 float base_dist;
-// points of our object
-VECTOR *pts;
+// points of our object, and the same rotated for this frame
+VECTORS pts, view;
 // store the precalculated scaling values
 int scaleX[SCREEN_WIDTH];
 int scaleY[SCREEN_HEIGHT];
@@ -51,6 +55,16 @@ void Draw(SDL_Surface *where, VECTOR v);
 
 int main( int argc, char* args[] )
 {
+	// --isa=scalar|sse2|avx2|avx512 forces a kernel variant
+	// --memreport prints the allocations when closing
+	KernelIsa isa = ISA_COUNT;
+	for (int a = 1; a < argc; a++) {
+		if (kernelsParseIsa(args[a]) != ISA_COUNT) isa = kernelsParseIsa(args[a]);
+		if (strcmp(args[a], "--memreport") == 0) memReportOnExit = true;
+	}
+	kernelsInit(isa);
+	kernelsReport();
+
 	//Start up SDL and create window
 	if (!initSDL())
 	{
@@ -136,7 +150,10 @@ void render() {
 }
 
 void close() {
-	SDL_FreeSurface(secondScreen);
+	memFree(pts.x);
+	memFree(view.x);
+	memFreeSurface(secondScreen);
+	if (memReportOnExit) memReport();
 	//Destroy window
 	SDL_DestroyWindow(window);
 	//Quit SDL subsystems
@@ -154,15 +171,22 @@ void waitTime() {
 }
 
 void initParticles() {
+	tourBuild();
 	// generate our points
-	pts = new VECTOR[MAXPTS];
+	// x, y and z arrays one after the other
+	pts.x = (float*)memAlloc("particles", 3 * MAXPTS * sizeof(float));
+	pts.y = pts.x + MAXPTS;
+	pts.z = pts.y + MAXPTS;
+	view.x = (float*)memAlloc("particles", 3 * MAXPTS * sizeof(float));
+	view.y = view.x + MAXPTS;
+	view.z = view.y + MAXPTS;
 	for (int i = 0; i < MAXPTS; i++) {
-		pts[i] = (rotX(2.0f*M_PI*sin((float)i / 203))
-			* rotY(2.0f*M_PI*cos((float)i / 157))
-			* rotZ(-2.0f*M_PI*cos((float)i / 181))) * VECTOR(64 + 16 * sin((float)i / 191), 0, 0);
+		pts.set(i, (rotX<MATH_POLY>(2.0f*M_PI*mathSin<MATH_POLY>((float)i / 203))
+			* rotY<MATH_POLY>(2.0f*M_PI*mathCos<MATH_POLY>((float)i / 157))
+			* rotZ<MATH_POLY>(-2.0f*M_PI*mathCos<MATH_POLY>((float)i / 181))) * VECTOR(64 + 16 * mathSin<MATH_POLY>((float)i / 191), 0, 0));
 	}
 	// create the second buffer for effects
-	secondScreen =SDL_CreateRGBSurface(0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, 0, 0, 0, 0);
+	secondScreen = memTrackSurface("particles", SDL_CreateRGBSurface(0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, 0, 0, 0, 0));
 //	secondScreen = SDL_CreateRGBSurfaceWithFormat(0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, screenSurface->format->format);
 }
 
@@ -173,10 +197,11 @@ void updateParticles() {
 	for (int i = 0; i < SCREEN_WIDTH; i++) scaleX[i] = (int)(sx + (i - sx)*0.85f);
 	for (int i = 0; i < SCREEN_HEIGHT; i++) scaleY[i] = (int)(sy + (i - sy)*0.85f);
 	// setup the position of the object
-	base_dist = 128 + 64 * sin((float)currentTime / 3200);
-	obj = rotX(2.0f*M_PI*sin((float)currentTime / 2800))
-		* rotY(2.0f*M_PI*cos((float)currentTime / 3000))
-		* rotZ(-2.0f*M_PI*sin((float)currentTime / 2500));
+	VECTOR p;
+	Quat q;
+	pathEval(tour, currentTime, p, q);
+	base_dist = 128 + 64 * p[2];
+	obj = quatToMatrix(q);
 }
 
 void renderParticles() {
@@ -189,9 +214,10 @@ void renderParticles() {
 	Blur(secondScreen, screenSurface);
 	//SDL_BlitSurface(secondScreen, NULL, screenSurface, NULL);
 
-	// draw the particles
+	// rotate all the particles at once, then draw them
+	obj.transform(pts, view, MAXPTS);
 	for (int i = 0; i < MAXPTS; i++) {
-		Draw(screenSurface, obj * pts[i]);
+		Draw(screenSurface, view[i]);
 	}
 
 	//SDL_UnlockSurface(screenSurface);
@@ -5,6 +5,11 @@
 
 #include "vector.h"
 #include "matrix.h"
+#include "../../Implementation/memtrack.h"
+#include "../../Implementation/assetpack.h"
+#include "../../Implementation/kernels.h"
+#include "../../Implementation/fixed.h"
+#include "tour.h"
 
 //Screen dimension constants
 const int SCREEN_WIDTH = 640;
@@ -43,13 +48,16 @@ struct
 {
 	VECTOR *vertices, *normals;
 } org, cur;
+// the vertices followed by the normals as x, y, z arrays, all transformed
+// in one batch
+VECTORS orgBatch, curBatch;
 
 // this structure contains all the relevant data for each poly
 typedef struct
 {
 	int p[4];  // pointer to the vertices
-	int tx[4]; // static X texture index
-	int ty[4]; // static Y texture index
+	Fixed16_16 tx[4]; // static X texture index
+	Fixed16_16 ty[4]; // static Y texture index
 	VECTOR normal, centre;
 } POLY;
 
@@ -61,7 +69,8 @@ int num_vertices;
 
 // one entry of the edge table
 typedef struct {
-	int x, px, py, tx, ty, z;
+	Fixed16_16 x, px, py, tx, ty;
+	FixedDepth z;
 } edge_data;
 
 // store two edges per horizontal line
@@ -86,7 +95,8 @@ void update3D();
 void render3D();
 
 void InitEdgeTable();
-void ScanEdge(VECTOR p1, int tx1, int ty1, int px1, int py1, VECTOR p2, int tx2, int ty2, int px2, int py2);
+void ScanEdge(VECTOR p1, Fixed16_16 tx1, Fixed16_16 ty1, Fixed16_16 px1, Fixed16_16 py1,
+	VECTOR p2, Fixed16_16 tx2, Fixed16_16 ty2, Fixed16_16 px2, Fixed16_16 py2);
 void DrawSpan(int y, edge_data *p1, edge_data *p2);
 void DrawPolies();
 void init_object();
@@ -95,6 +105,16 @@ void TransformPts();
 
 int main( int argc, char* args[] )
 {
+	// --isa=scalar|sse2|avx2|avx512 forces a kernel variant
+	// --memreport prints the allocations when closing
+	KernelIsa isa = ISA_COUNT;
+	for (int a = 1; a < argc; a++) {
+		if (kernelsParseIsa(args[a]) != ISA_COUNT) isa = kernelsParseIsa(args[a]);
+		if (strcmp(args[a], "--memreport") == 0) memReportOnExit = true;
+	}
+	kernelsInit(isa);
+	kernelsReport();
+
 	//Start up SDL and create window
 	if (!initSDL())
 	{
@@ -180,13 +200,17 @@ void render() {
 }
 
 void close() {
-	SDL_FreeSurface(texture);
-	free(zbuffer);
-	free(org.vertices);
-	free(org.normals);
-	free(cur.vertices);
-	free(cur.normals);
-	free(polies);
+	memFreeSurface(texture);
+	memFree(light);
+	memFree(zbuffer);
+	memDeleteArray(org.vertices);
+	memDeleteArray(org.normals);
+	memDeleteArray(cur.vertices);
+	memDeleteArray(cur.normals);
+	memFree(orgBatch.x);
+	memFree(curBatch.x);
+	memDeleteArray(polies);
+	if (memReportOnExit) memReport();
 	//Destroy window
 	SDL_DestroyWindow(window);
 	//Quit SDL subsystems
@@ -204,17 +228,16 @@ void waitTime() {
 }
 
 void init3D() {
+	tourBuild();
 	// Load Texture
-	SDL_Surface *temp = IMG_Load("texture_torus.png");
-	if (temp == NULL) {
-		std::cout << "Image can be loaded! " << IMG_GetError();
+	texture = assetLoadImage("3d", "texture_torus.png", SDL_PIXELFORMAT_ARGB8888);
+	if (texture == NULL) {
 		close();
 		exit(1);
 	}
-	texture = SDL_ConvertSurfaceFormat(temp, SDL_PIXELFORMAT_ARGB8888, 0);
 
 	// prepare the lighting
-	light = new unsigned char[256 * 256];
+	light = (unsigned char*)memAlloc("3d", 256 * 256);
 	for (int j = 0; j<256; j++)
 	{
 		for (int i = 0; i<256; i++)
@@ -228,7 +251,7 @@ void init3D() {
 		}
 	}
 	// prepare 3D data
-	zbuffer = (unsigned short*) malloc(SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(unsigned short));
+	zbuffer = (unsigned short*) memAlloc("3d", SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(unsigned short));
 	init_object();
 
 }
@@ -236,15 +259,13 @@ void init3D() {
 void update3D() {
 	// clear the zbuffer
 	memset(zbuffer, 255, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(unsigned short));
-	// set the torus' rotation
-	objrot = rotX((float)currentTime / 1100 + M_PI*cos((float)currentTime / 2200))
-		* rotY((float)currentTime / 1300 + M_PI*sin((float)currentTime / 2600))
-		* rotZ((float)currentTime / 1500 - M_PI*cos((float)currentTime / 2500));
+	// the torus follows the tour: its rotation...
+	VECTOR p;
+	Quat q;
+	pathEval(tour, currentTime, p, q);
+	objrot = quatToMatrix(q);
 	// and it's position
-	objpos = VECTOR(
-		48 * cos((float)currentTime / 1266.0f),
-		48 * sin((float)currentTime / 1424.0f),
-		200 + 80 * sin((float)currentTime / 1912.0f));
+	objpos = VECTOR(48 * p[0], 48 * p[1], 200 + 80 * p[2]);
 	// rotate and project our points
 	TransformPts();
 }
@@ -263,8 +284,8 @@ void InitEdgeTable()
 {
 	for (int i = 0; i<SCREEN_HEIGHT; i++)
 	{
-		edge_table[i][0].x = -1;
-		edge_table[i][1].x = -1;
+		edge_table[i][0].x = Fixed16_16::fromRaw(-1);
+		edge_table[i][1].x = Fixed16_16::fromRaw(-1);
 	}
 	poly_minY = SCREEN_HEIGHT;
 	poly_maxY = -1;
@@ -274,8 +295,8 @@ void InitEdgeTable()
 * scan along one edge of the poly, i.e. interpolate all values and store
 * in the edge table
 */
-void ScanEdge(VECTOR p1, int tx1, int ty1, int px1, int py1,
-	VECTOR p2, int tx2, int ty2, int px2, int py2)
+void ScanEdge(VECTOR p1, Fixed16_16 tx1, Fixed16_16 ty1, Fixed16_16 px1, Fixed16_16 py1,
+	VECTOR p2, Fixed16_16 tx2, Fixed16_16 ty2, Fixed16_16 px2, Fixed16_16 py2)
 {
 	// we can't handle this case, so we recall the proc with reversed params
 	// saves having to swap all the vars, but it's not good practice
@@ -284,25 +305,25 @@ void ScanEdge(VECTOR p1, int tx1, int ty1, int px1, int py1,
 		return;
 	}
 	// convert to fixed point
-	int x1 = (int)(p1[0] * 65536),
-		y1 = (int)(p1[1]),
-		z1 = (int)(p1[2] * 16),
-		x2 = (int)(p2[0] * 65536),
-		y2 = (int)(p2[1]),
-		z2 = (int)(p2[2] * 16);
+	Fixed16_16 x1 = Fixed16_16::fromDouble(p1[0]),
+		x2 = Fixed16_16::fromDouble(p2[0]);
+	FixedDepth z1 = FixedDepth::fromDouble(p1[2]),
+		z2 = FixedDepth::fromDouble(p2[2]);
+	int y1 = (int)(p1[1]),
+		y2 = (int)(p2[1]);
 	// update the min and max of the current polygon
 	if (y1<poly_minY) poly_minY = y1;
 	if (y2>poly_maxY) poly_maxY = y2;
 	// compute deltas for interpolation
 	int dy = y2 - y1;
 	if (dy == 0) return;
-	int dx = (x2 - x1) / dy,                // assume 16.16 fixed point
+	Fixed16_16 dx = (x2 - x1) / dy,
 		dtx = (tx2 - tx1) / dy,
 		dty = (ty2 - ty1) / dy,
 		dpx = (px2 - px1) / dy,
-		dpy = (py2 - py1) / dy,
-		dz = (z2 - z1) / dy;              // probably 12.4, but doesn't matter
-										  // interpolate along the edge
+		dpy = (py2 - py1) / dy;
+	FixedDepth dz = (z2 - z1) / dy;
+	// interpolate along the edge
 	for (int y = y1; y<y2; y++)
 	{
 		// don't go out of the screen
@@ -311,7 +332,7 @@ void ScanEdge(VECTOR p1, int tx1, int ty1, int px1, int py1,
 		if (y >= 0)
 		{
 			// is first slot free?
-			if (edge_table[y][0].x == -1)
+			if (edge_table[y][0].x == Fixed16_16::fromRaw(-1))
 			{ // if so, use that
 				edge_table[y][0].x = x1;
 				edge_table[y][0].tx = tx1;
@@ -352,71 +373,37 @@ void DrawSpan(int y, edge_data *p1, edge_data *p2)
 		return;
 	};
 	// load starting points
-	int z1 = p1->z,
-		px1 = p1->px,
-		py1 = p1->py,
-		tx1 = p1->tx,
-		ty1 = p1->ty,
-		x1 = p1->x >> 16,
-		x2 = p2->x >> 16;
+	int x1 = p1->x.toInt(),
+		x2 = p2->x.toInt();
 	// check if it's inside the screen
 	if ((x1>(SCREEN_WIDTH - 1)) || (x2<0)) return;
 	// compute deltas for interpolation
 	int dx = x2 - x1;
 	if (dx == 0) return;
-	int dtx = (p2->tx - p1->tx) / dx,  // assume 16.16 fixed point
+	Fixed16_16 dtx = (p2->tx - p1->tx) / dx,
 		dty = (p2->ty - p1->ty) / dx,
 		dpx = (p2->px - p1->px) / dx,
-		dpy = (p2->py - p1->py) / dx,
-		dz = (p2->z - p1->z) / dx;
-
-	// setup the offsets in the buffers
-	Uint8 *dst;
-	Uint8 *initbuffer = (Uint8 *)screenSurface->pixels;
-	int bpp = screenSurface->format->BytesPerPixel;
-	Uint8 *imagebuffer = (Uint8 *)texture->pixels;
-	int bppImage = texture->format->BytesPerPixel;
-
-	// get destination offset in buffer
-	long offs = y * SCREEN_WIDTH + x1;
-	// loop for all pixels concerned
-	for (int i = x1; i<x2; i++)
-	{
-		if (i>(SCREEN_WIDTH - 1)) return;
-		// check z buffer
-		if (i >= 0) if (z1<zbuffer[offs])
-		{
-			// if visible load the texel from the translated texture
-			Uint8 *p = (Uint8 *)imagebuffer + ((ty1 >> 16) & 0xff) * texture->pitch + ((tx1 >> 16) & 0xFF) * bppImage;
-			SDL_Color ColorTexture;
-			SDL_GetRGB(*(Uint32*)(p), texture->format, &ColorTexture.r, &ColorTexture.g, &ColorTexture.b);
-			// and the texel from the light map
-			unsigned char LightFactor = light[((py1 >> 8) & 0xff00) + ((px1 >> 16) & 0xff)];
-			// mix them together, and store
-			int ColorR = (ColorTexture.r + LightFactor);
-			if (ColorR > 255) 
-				ColorR = 255;
-			int ColorG = (ColorTexture.g + LightFactor);
-			if (ColorG > 255) 
-				ColorG = 255;
-			int ColorB = (ColorTexture.b + LightFactor);
-			if (ColorB > 255) 
-				ColorB = 255;
-			Uint32 resultColor = 0xFF000000 | (ColorR << 16) | (ColorG << 8) | ColorB;
-			dst = initbuffer + y *screenSurface->pitch + i * bpp;
-			*(Uint32 *)dst = resultColor;
-			// and update the zbuffer
-			zbuffer[offs] = z1;
-		}
-		// interpolate our values
-		px1 += dpx;
-		py1 += dpy;
-		tx1 += dtx;
-		ty1 += dty;
-		z1 += dz;
-		// and find next pixel
-		offs++;
-	}
+		dpy = (p2->py - p1->py) / dx;
+	FixedDepth dz = (p2->z - p1->z) / dx;
+
+	// clip the span to the screen, moving the start values to the first
+	// visible pixel
+	int first = x1 < 0 ? 0 : x1,
+		last = x2 > SCREEN_WIDTH ? SCREEN_WIDTH : x2,
+		skip = first - x1;
+	SpanSetup span;
+	span.count = last - first;
+	span.z = p1->z + dz * skip; span.dz = dz;
+	span.tx = p1->tx + dtx * skip; span.dtx = dtx;
+	span.ty = p1->ty + dty * skip; span.dty = dty;
+	span.px = p1->px + dpx * skip; span.dpx = dpx;
+	span.py = p1->py + dpy * skip; span.dpy = dpy;
+
+	// z buffered, the texel from the translated texture mixed with the
+	// texel from the light map
+	Uint32 *dst = (Uint32 *)((Uint8 *)screenSurface->pixels + y * screenSurface->pitch) + first;
+	kernels.spanFill(dst, zbuffer + y * SCREEN_WIDTH + first, span,
+		(Uint32 *)texture->pixels, texture->pitch / 4, light);
 }
 
 /*
@@ -447,15 +434,15 @@ void DrawPolies()
 					// the static texture coordinates
 					polies[n].tx[i], polies[n].ty[i],
 					// the dynamic text coords computed with the normals
-					(int)(65536 * (128 + 127 * cur.normals[polies[n].p[i]][0])),
-					(int)(65536 * (128 + 127 * cur.normals[polies[n].p[i]][1])),
+					Fixed16_16::fromDouble(128 + 127 * cur.normals[polies[n].p[i]][0]),
+					Fixed16_16::fromDouble(128 + 127 * cur.normals[polies[n].p[i]][1]),
 					// second vertex in screen space
 					cur.vertices[polies[n].p[(i + 1) & 3]],
 					// static text coords
 					polies[n].tx[(i + 1) & 3], polies[n].ty[(i + 1) & 3],
 					// dynamic texture coords
-					(int)(65536 * (128 + 127 * cur.normals[polies[n].p[(i + 1) & 3]][0])),
-					(int)(65536 * (128 + 127 * cur.normals[polies[n].p[(i + 1) & 3]][1]))
+					Fixed16_16::fromDouble(128 + 127 * cur.normals[polies[n].p[(i + 1) & 3]][0]),
+					Fixed16_16::fromDouble(128 + 127 * cur.normals[polies[n].p[(i + 1) & 3]][1])
 				);
 			}
 			// quick clipping
@@ -481,10 +468,10 @@ void init_object()
 {
 	// allocate necessary memory for points and their normals
 	num_vertices = SLICES*SPANS;
-	org.vertices = new VECTOR[num_vertices];
-	cur.vertices = new VECTOR[num_vertices];
-	org.normals = new VECTOR[num_vertices];
-	cur.normals = new VECTOR[num_vertices];
+	org.vertices = memNewArray<VECTOR>("3d", num_vertices);
+	cur.vertices = memNewArray<VECTOR>("3d", num_vertices);
+	org.normals = memNewArray<VECTOR>("3d", num_vertices);
+	cur.normals = memNewArray<VECTOR>("3d", num_vertices);
 	int i, j, k = 0;
 	// now create all the points and their normals, start looping
 	// round the origin (circle C1)
@@ -511,10 +498,21 @@ void init_object()
 			k++;
 		}
 	}
+	orgBatch.x = (float*)memAlloc("3d", 3 * 2 * num_vertices * sizeof(float));
+	orgBatch.y = orgBatch.x + 2 * num_vertices;
+	orgBatch.z = orgBatch.y + 2 * num_vertices;
+	curBatch.x = (float*)memAlloc("3d", 3 * 2 * num_vertices * sizeof(float));
+	curBatch.y = curBatch.x + 2 * num_vertices;
+	curBatch.z = curBatch.y + 2 * num_vertices;
+	for (i = 0; i < num_vertices; i++)
+	{
+		orgBatch.set(i, org.vertices[i]);
+		orgBatch.set(num_vertices + i, org.normals[i]);
+	}
 
 	// now initialize the polygons, there are as many quads as vertices
 	num_polies = SPANS*SLICES;
-	polies = new POLY[num_polies];
+	polies = memNewArray<POLY>("3d", num_polies);
 	// perform the same loop
 	for (i = 0; i<SLICES; i++)
 	{
@@ -529,16 +527,16 @@ void init_object()
 			P.p[2] = ((i + 1) % SLICES)*SPANS + ((j + 1) % SPANS);
 
 			// now compute the static texture refs (X)
-			P.tx[0] = (i * 512 / SLICES) << 16;
-			P.tx[1] = (i * 512 / SLICES) << 16;
-			P.tx[3] = ((i + 1) * 512 / SLICES) << 16;
-			P.tx[2] = ((i + 1) * 512 / SLICES) << 16;
+			P.tx[0] = Fixed16_16::fromInt(i * 512 / SLICES);
+			P.tx[1] = Fixed16_16::fromInt(i * 512 / SLICES);
+			P.tx[3] = Fixed16_16::fromInt((i + 1) * 512 / SLICES);
+			P.tx[2] = Fixed16_16::fromInt((i + 1) * 512 / SLICES);
 
 			// now compute the static texture refs (Y)
-			P.ty[0] = (j * 512 / SPANS) << 16;
-			P.ty[1] = ((j + 1) * 512 / SPANS) << 16;
-			P.ty[3] = (j * 512 / SPANS) << 16;
-			P.ty[2] = ((j + 1) * 512 / SPANS) << 16;
+			P.ty[0] = Fixed16_16::fromInt(j * 512 / SPANS);
+			P.ty[1] = Fixed16_16::fromInt((j + 1) * 512 / SPANS);
+			P.ty[3] = Fixed16_16::fromInt(j * 512 / SPANS);
+			P.ty[2] = Fixed16_16::fromInt((j + 1) * 512 / SPANS);
 
 			// get the normalized diagonals
 			VECTOR d1 = normalize(org.vertices[P.p[2]] - org.vertices[P.p[0]]),
@@ -564,11 +562,12 @@ void init_object()
 */
 void TransformPts()
 {
+	// perform rotation
+	objrot.transform(orgBatch, curBatch, 2 * num_vertices);
 	for (int i = 0; i<num_vertices; i++)
 	{
-		// perform rotation
-		cur.normals[i] = objrot * org.normals[i];
-		cur.vertices[i] = objrot * org.vertices[i];
+		cur.normals[i] = curBatch[num_vertices + i];
+		cur.vertices[i] = curBatch[i];
 		// now project onto the screen
 		cur.vertices[i][2] += objpos[2];
 		cur.vertices[i][0] = SCREEN_HEIGHT * (cur.vertices[i][0] + objpos[0]) / cur.vertices[i][2] + (SCREEN_WIDTH / 2); 
@@ -5,6 +5,9 @@
 
 #include "vector.h"
 #include "matrix.h"
+#include "../../Implementation/memtrack.h"
+#include "../../Implementation/assetpack.h"
+#include "tour.h"
 
 //Screen dimension constants
 const int SCREEN_WIDTH = 640;
@@ -38,6 +41,11 @@ void DrawPlane(VECTOR Bp, VECTOR Up, VECTOR Vp);
 
 int main( int argc, char* args[] )
 {
+	// --memreport prints the allocations when closing
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(args[a], "--memreport") == 0) memReportOnExit = true;
+	}
+
 	//Start up SDL and create window
 	if (!initSDL())
 	{
@@ -123,7 +131,8 @@ void render() {
 }
 
 void close() {
-	SDL_FreeSurface(texture);
+	memFreeSurface(texture);
+	if (memReportOnExit) memReport();
 	//Destroy window
 	SDL_DestroyWindow(window);
 	//Quit SDL subsystems
@@ -141,22 +150,26 @@ void waitTime() {
 }
 
 void initPlane() {
-	SDL_Surface *temp = IMG_Load("texture.png");
-	if (temp == NULL) {
-		std::cout << "Image can be loaded! " << IMG_GetError();
+	tourBuild();
+	texture = assetLoadImage("plane", "texture.png", SDL_PIXELFORMAT_ARGB8888);
+	if (texture == NULL) {
 		close();
 		exit(1);
 	}
-	texture = SDL_ConvertSurfaceFormat(temp, SDL_PIXELFORMAT_ARGB8888, 0);
 
 }
 
 void updatePlane() {
-	// setup the 3 control points of our plane, could do something much
-	// more dynamic (with rotX also) but this looks good enough
-	A = VECTOR((float)(currentTime) / 50, 8, (float)(currentTime) / 10);
-	B = rotY(0.32) * VECTOR(256, 0, 0);
-	C = rotY(0.32) * VECTOR(0, 0, 256);
+	// setup the 3 control points of our plane from the tour. a plane
+	// tumbling like the torus would look wrong, so it only keeps the turn
+	// around the vertical, and wanders a little around its scrolling
+	VECTOR p;
+	Quat q;
+	pathEval(tour, currentTime, p, q);
+	MATRIX heading = rotY(0.32) * quatToMatrix(quatTwist(q, VECTOR(0, 1, 0)));
+	A = VECTOR((float)(currentTime) / 50 + 64 * p[0], 8 + 2 * p[1], (float)(currentTime) / 10 + 64 * p[2]);
+	B = heading * VECTOR(256, 0, 0);
+	C = heading * VECTOR(0, 0, 256);
 }
 
 void renderPlane() {
@@ -4,6 +4,8 @@
 #include <iostream>
 #include <cmath>
 
+#include "../../Implementation/assetpack.h"
+
 //Screen dimension constants
 const int SCREEN_WIDTH = 640;
 const int SCREEN_HEIGHT = 480;
@@ -129,6 +131,7 @@ void render() {
 }
 
 void close() {
+	memFreeSurface(flashTexture);
 	Mix_HaltMusic();
 	Mix_FreeMusic(mySong);
 	Mix_Quit();
@@ -166,13 +169,11 @@ void initMusic() {
 	MusicPreviousBeat = -1;
 	Backgroundcolor = 0xFF000000 | ((rand() % 256) << 16) | ((rand() % 256) << 8) | (rand() % 256);
 	// load the texture
-	SDL_Surface* temp = IMG_Load("uoc.png");
-	if (temp == NULL) {
-		std::cout << "Image can be loaded! " << IMG_GetError();
+	flashTexture = assetLoadImage("flash", "uoc.png", SDL_PIXELFORMAT_ARGB8888);
+	if (flashTexture == NULL) {
 		close();
 		exit(1);
 	}
-	flashTexture = SDL_ConvertSurfaceFormat(temp, SDL_PIXELFORMAT_ARGB8888, 0);
 
 }
 
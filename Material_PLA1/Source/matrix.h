@@ -2,7 +2,11 @@
 #define __MATRIX_H_
 
 #include "vector.h"
+#include "../../Implementation/fastmath.h"
+#include "../../Implementation/kernels.h"
 
+// 3x3 rows of padded VECTORs, so a row is one register: v * M sums the rows
+// scaled by the coordinates of v
 class MATRIX
 {
 
@@ -18,59 +22,75 @@ public:
         {
                MATRIX r;
                for (int i=0; i<3; i++)
-                   for (int j=0; j<3; j++)
-                   {
-     	                r[i][j] = m[i][0] * b[0][j]
-                                + m[i][1] * b[1][j]
-                                + m[i][2] * b[2][j];
-                   }
+                   r[i] = b * m[i];
                return r;
         }
 
-	MATRIX(	const double a11, const double a12, const double a13,
+	constexpr MATRIX(	const double a11, const double a12, const double a13,
 		const double a21, const double a22, const double a23,
 		const double a31, const double a32, const double a33)
+		: m{ VECTOR((float)a11, (float)a12, (float)a13),
+		     VECTOR((float)a21, (float)a22, (float)a23),
+		     VECTOR((float)a31, (float)a32, (float)a33) }
 	{
-		m[0][0]=a11; m[0][1]=a12; m[0][2]=a13;
-		m[1][0]=a21; m[1][1]=a22; m[1][2]=a23;
-		m[2][0]=a31; m[2][1]=a32; m[2][2]=a33;
 	}
 
         VECTOR operator*(const VECTOR &v) const
         {
            VECTOR r;
+#ifdef VECTOR_SSE
+           // the same products summed in the same order as below
+           __m128 x = _mm_mul_ps(_mm_set1_ps(v[0]), m[0].load());
+           __m128 y = _mm_mul_ps(_mm_set1_ps(v[1]), m[1].load());
+           __m128 z = _mm_mul_ps(_mm_set1_ps(v[2]), m[2].load());
+           r.store(_mm_add_ps(_mm_add_ps(x, y), z));
+#else
            r[0] = v[0] * m[0][0] + v[1] * m[1][0] + v[2] * m[2][0];
            r[1] = v[0] * m[0][1] + v[1] * m[1][1] + v[2] * m[2][1];
            r[2] = v[0] * m[0][2] + v[1] * m[1][2] + v[2] * m[2][2];
+#endif
            return r;
         }
 
-	 MATRIX() {}
-	~MATRIX() {}
+	/*
+	* transform count points at once, dst may be src. it goes through the
+	* kernels table, kernelsInit() must have been called
+	*/
+	void transform(const VECTORS &src, const VECTORS &dst, const int count) const
+	{
+		const float rows[9] = { m[0][0], m[0][1], m[0][2], m[1][0], m[1][1], m[1][2], m[2][0], m[2][1], m[2][2] };
+		kernels.transformSoa(rows, src.x, src.y, src.z, dst.x, dst.y, dst.z, count);
+	}
+
+	constexpr MATRIX() : m{} {}
 };
 
+// rotations with the sine and cosine of fastmath.h, libm unless asked
+template<MathPrecision P = MATH_LIBM>
 MATRIX rotX(const double theta)
 {
-	const double c = cos(theta);
-	const double s = sin(theta);
+	const double c = mathCos<P>(theta);
+	const double s = mathSin<P>(theta);
 	return MATRIX(	 1, 0, 0,
 			 0, c, s,
 			 0,-s, c);
 }
 
+template<MathPrecision P = MATH_LIBM>
 MATRIX rotY(const double theta)
 {
-	const double c = cos(theta);
-	const double s = sin(theta);
+	const double c = mathCos<P>(theta);
+	const double s = mathSin<P>(theta);
 	return MATRIX(	 c, 0,-s,
 			 0, 1, 0,
 			 s, 0, c);
 }
 
+template<MathPrecision P = MATH_LIBM>
 MATRIX rotZ(const double theta)
 {
-	const double c = cos(theta);
-	const double s = sin(theta);
+	const double c = mathCos<P>(theta);
+	const double s = mathSin<P>(theta);
 	return MATRIX(	 c, s, 0,
 			-s, c, 0,
 			 0, 0, 1);
@@ -0,0 +1,38 @@
+#ifndef __TOUR_H_
+#define __TOUR_H_
+
+// The path the 3D effects share: the torus, the particles and the textured
+// plane all follow it, each in its own units. Positions stay in [-1, 1],
+// the orientation tumbles two turns around X, three around Y and one
+// around Z every loop.
+
+#include "../../Implementation/path.h"
+
+#define TOUR_KEY_MS 2000.0
+#define TOUR_KEYS 12
+
+const float tourPositions[TOUR_KEYS][3] = {
+	{  0.0f,  0.0f,  0.0f }, {  0.8f,  0.3f, -0.4f }, {  0.6f, -0.7f, -0.9f }, { -0.2f, -0.9f, -0.2f },
+	{ -0.9f, -0.2f,  0.6f }, { -0.5f,  0.6f,  1.0f }, {  0.3f,  0.9f,  0.4f }, {  0.9f,  0.1f, -0.5f },
+	{  0.2f, -0.6f, -1.0f }, { -0.7f, -0.5f, -0.3f }, { -0.8f,  0.4f,  0.7f }, { -0.1f,  0.5f,  0.3f }
+};
+
+Path tour;
+
+/*
+* build the table, once at startup
+*/
+inline void tourBuild()
+{
+	tour.keys.clear();
+	tour.loop = true;
+	// one more key closing the loop on the first
+	for (int k = 0; k <= TOUR_KEYS; k++) {
+		const float* p = tourPositions[k % TOUR_KEYS];
+		pathAddKey(tour, k * TOUR_KEY_MS, VECTOR(p[0], p[1], p[2]),
+			quatFromEuler(k * 2 * M_PI / 6, k * 2 * M_PI / 4, -k * 2 * M_PI / 12));
+	}
+	pathBuild(tour, PATH_CATMULL_ROM, PATH_SQUAD);
+}
+
+#endif